@@ -0,0 +1,104 @@
+#include "bench/Bench.h"
+
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+
+namespace bench {
+
+struct Result {
+  std::string name;
+  size_t operations;
+  int64_t nanoseconds;
+  // Only set for distributions, see reportPercentiles()
+  int64_t p50 = -1;
+  int64_t p99 = -1;
+};
+
+static OutputFormat outputFormat = OutputFormat::Text;
+static std::vector<Result> results;
+
+static double getNanosecondsPerOperation(Result const& result) {
+  return result.operations > 0 ? double(result.nanoseconds) / result.operations
+                               : 0.0;
+}
+
+static std::string escapeJSON(std::string const& string) {
+  std::string escaped;
+  for (char c : string) {
+    if (c == '"' || c == '\\') {
+      escaped += '\\';
+    }
+    escaped += c;
+  }
+  return escaped;
+}
+
+void setOutputFormat(OutputFormat format) { outputFormat = format; }
+
+void measure(std::string const& name, size_t operations,
+             std::function<void()> body) {
+  auto start = std::chrono::steady_clock::now();
+  body();
+  auto elapsed = std::chrono::steady_clock::now() - start;
+
+  Result result{
+      name, operations,
+      std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count()};
+
+  if (outputFormat == OutputFormat::JSON) {
+    results.push_back(result);
+    return;
+  }
+
+  std::cout << std::left << std::setw(40) << name << std::right
+            << std::setw(10) << (result.nanoseconds / 1000000) << " ms"
+            << std::setw(12) << std::fixed << std::setprecision(1)
+            << getNanosecondsPerOperation(result) << " ns/op" << std::endl;
+}
+
+void reportPercentiles(std::string const& name, std::vector<int64_t> samples) {
+  if (samples.empty()) {
+    return;
+  }
+
+  std::sort(samples.begin(), samples.end());
+  Result result{name, samples.size(), 0};
+  result.p50 = samples[samples.size() / 2];
+  result.p99 = samples[std::min(samples.size() - 1, samples.size() * 99 / 100)];
+
+  if (outputFormat == OutputFormat::JSON) {
+    results.push_back(result);
+    return;
+  }
+
+  std::cout << std::left << std::setw(40) << name << std::right
+            << std::setw(10) << result.p50 << " ns p50" << std::setw(10)
+            << result.p99 << " ns p99" << std::endl;
+}
+
+void finishReport() {
+  if (outputFormat != OutputFormat::JSON) {
+    return;
+  }
+
+  std::cout << "{\"benchmarks\": [";
+  for (size_t i = 0; i < results.size(); i++) {
+    auto const& result = results[i];
+    std::cout << (i > 0 ? "," : "") << "\n  {\"name\": \""
+              << escapeJSON(result.name)
+              << "\", \"operations\": " << result.operations;
+    if (result.p50 >= 0) {
+      std::cout << ", \"p50_ns\": " << result.p50
+                << ", \"p99_ns\": " << result.p99 << "}";
+      continue;
+    }
+    std::cout << ", \"total_ns\": " << result.nanoseconds
+              << ", \"ns_per_op\": " << std::fixed << std::setprecision(1)
+              << getNanosecondsPerOperation(result) << "}";
+  }
+  std::cout << "\n]}" << std::endl;
+  results.clear();
+}
+}
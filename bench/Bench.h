@@ -0,0 +1,40 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <chrono>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace bench {
+
+enum class OutputFormat {
+  // One aligned line per benchmark, as they run
+  Text,
+  // A single document once all benchmarks ran, for tracking regressions
+  JSON,
+};
+
+void setOutputFormat(OutputFormat format);
+
+// Runs body once, timing it, and reports the total and per-operation cost
+// given that body performed `operations` operations.
+void measure(std::string const& name, size_t operations,
+             std::function<void()> body);
+
+// Reports the median and the 99th percentile of the given samples, in
+// nanoseconds, e.g. the latency each packet saw.
+void reportPercentiles(std::string const& name, std::vector<int64_t> samples);
+
+// Prints whatever measure() held back, i.e. the JSON document.
+void finishReport();
+
+void runTimerBenchmarks();
+void runLoopBenchmarks();
+void runIOBenchmarks();
+void runCallbackBenchmarks();
+void runFIFOBenchmarks();
+void runCoroutineBenchmarks();
+void runPacketBenchmarks();
+}
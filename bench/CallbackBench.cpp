@@ -0,0 +1,103 @@
+#include "bench/Bench.h"
+
+#include <event/Callback.h>
+
+#include <functional>
+#include <stdexcept>
+#include <vector>
+
+namespace bench {
+
+static const size_t kCallbackCount = 1000;
+static const size_t kInvokeRounds = 10000;
+
+// What event::Callback used to be, kept around to compare against.
+template <typename R> class StdFunctionCallback {
+public:
+  StdFunctionCallback() {}
+
+  StdFunctionCallback(StdFunctionCallback&& move)
+      : target(std::move(move.target)), func_(std::move(move.func_)),
+        method_(std::move(move.method_)) {}
+
+  StdFunctionCallback& operator=(std::function<R()> func) {
+    func_ = func;
+    method_ = nullptr;
+    target = nullptr;
+    return *this;
+  }
+
+  template <typename T, R (T::*Method)()> void setMethod(T* object) {
+    func_ = nullptr;
+    method_ = [](void* object) { return (((T*)object)->*Method)(); };
+    target = object;
+  }
+
+  R invoke() {
+    if (!!func_) {
+      return func_();
+    } else if (!!method_) {
+      if (target == nullptr) {
+        throw std::runtime_error("Invoking an Callable with an empty target.");
+      }
+      return method_(target);
+    } else {
+      throw std::runtime_error("Invoking an empty Callable.");
+    }
+  }
+
+  void* target = nullptr;
+
+private:
+  std::function<R()> func_;
+  std::function<R(void*)> method_;
+};
+
+class Counter {
+public:
+  void increment() { count++; }
+
+  size_t count = 0;
+};
+
+// Binds and invokes a loop's worth of callbacks, the way actions are set up
+// once and then invoked over and over again.
+template <typename C> static void benchCallbacks(std::string const& name) {
+  std::vector<Counter> counters(kCallbackCount);
+  std::vector<C> methods(kCallbackCount);
+  std::vector<C> lambdas(kCallbackCount);
+
+  measure(name + "/bind", kCallbackCount * 2, [&]() {
+    for (size_t i = 0; i < kCallbackCount; i++) {
+      Counter* counter = &counters[i];
+      methods[i].template setMethod<Counter, &Counter::increment>(counter);
+      lambdas[i] = [counter]() { counter->count++; };
+    }
+  });
+
+  measure(name + "/invoke method", kCallbackCount * kInvokeRounds, [&]() {
+    for (size_t round = 0; round < kInvokeRounds; round++) {
+      for (auto& callback : methods) {
+        callback.invoke();
+      }
+    }
+  });
+
+  measure(name + "/invoke lambda", kCallbackCount * kInvokeRounds, [&]() {
+    for (size_t round = 0; round < kInvokeRounds; round++) {
+      for (auto& callback : lambdas) {
+        callback.invoke();
+      }
+    }
+  });
+
+  if (counters[0].count != 2 * kInvokeRounds) {
+    throw std::logic_error("Callbacks were not invoked.");
+  }
+}
+
+void runCallbackBenchmarks() {
+  benchCallbacks<StdFunctionCallback<void>>("callback/std::function");
+  benchCallbacks<event::Callback<void>>("callback/inline");
+}
+}
@@ -0,0 +1,139 @@
+#include "bench/Bench.h"
+
+#include <event/Condition.h>
+#include <event/Coroutine.h>
+#include <event/Trigger.h>
+#include <event/VirtualClock.h>
+
+#include <stdexcept>
+#include <vector>
+
+namespace bench {
+
+using namespace std::chrono_literals;
+
+static const size_t kCoroutineSteps = 100000;
+static const size_t kCoroutineCount = 10000;
+
+// A protocol going through its steps one condition at a time, written once as
+// a chain of triggers and once as a coroutine.
+static void armStep(event::BaseCondition* condition, size_t* steps) {
+  event::Trigger::arm({condition}, [condition, steps]() {
+    condition->arm();
+    (*steps)++;
+    armStep(condition, steps);
+  });
+}
+
+static event::Coroutine runSteps(event::BaseCondition* condition,
+                                 size_t* steps) {
+  while (true) {
+    co_await condition;
+    condition->arm();
+    (*steps)++;
+  }
+}
+
+static void benchSteps() {
+  auto loop = event::EventLoop::getCurrentLoop();
+  auto drive = [loop](event::BaseCondition& condition) {
+    for (size_t i = 0; i < kCoroutineSteps; i++) {
+      condition.fire();
+      loop->runOnce();
+    }
+  };
+
+  size_t triggerSteps = 0;
+  event::BaseCondition triggerCondition;
+  armStep(&triggerCondition, &triggerSteps);
+  measure("coroutine/step (trigger chain)", kCoroutineSteps,
+          [&]() { drive(triggerCondition); });
+
+  size_t coroutineSteps = 0;
+  event::BaseCondition coroutineCondition;
+  event::Coroutine coroutine = runSteps(&coroutineCondition, &coroutineSteps);
+  measure("coroutine/step (co_await)", kCoroutineSteps,
+          [&]() { drive(coroutineCondition); });
+
+  if (triggerSteps != kCoroutineSteps || coroutineSteps != kCoroutineSteps) {
+    throw std::logic_error("Protocol steps were not taken.");
+  }
+}
+
+static event::Coroutine waitOnce(event::Condition* condition, size_t* done) {
+  co_await condition;
+  (*done)++;
+}
+
+static event::Coroutine sleepOnce(event::Duration delay, size_t* done) {
+  co_await delay;
+  (*done)++;
+}
+
+// Coroutines starting, waiting once and finishing, e.g. one per handshake
+static void benchLifecycle() {
+  auto loop = event::EventLoop::getCurrentLoop();
+  event::BaseCondition condition;
+  std::vector<event::Coroutine> coroutines;
+  size_t done = 0;
+
+  auto startAll = [&]() {
+    for (size_t i = 0; i < kCoroutineCount; i++) {
+      coroutines.push_back(waitOnce(&condition, &done));
+    }
+  };
+  auto finishAll = [&]() {
+    condition.fire();
+    loop->runOnce();
+    condition.arm();
+    coroutines.clear();
+  };
+
+  // Let the frame pool grow first
+  coroutines.reserve(kCoroutineCount);
+  startAll();
+  finishAll();
+
+  measure("coroutine/start", kCoroutineCount, startAll);
+  measure("coroutine/finish", kCoroutineCount, finishAll);
+
+  if (done != 2 * kCoroutineCount) {
+    throw std::logic_error("Coroutines did not finish.");
+  }
+}
+
+// The coroutine counterpart of trigger/performIn
+static void benchSleeps() {
+  static const size_t kSpread = 1000;
+
+  event::VirtualClock clock;
+  auto loop = event::EventLoop::getCurrentLoop();
+  std::vector<event::Coroutine> coroutines;
+  size_t done = 0;
+
+  coroutines.reserve(kCoroutineCount);
+  measure("coroutine/sleep", kCoroutineCount, [&]() {
+    for (size_t i = 0; i < kCoroutineCount; i++) {
+      coroutines.push_back(sleepOnce(event::Duration(i % kSpread + 1), &done));
+    }
+  });
+
+  // One extra millisecond, as timeouts get rounded up to the next tick
+  measure("coroutine/sleep fire", kCoroutineCount, [&]() {
+    for (size_t i = 0; i <= kSpread; i++) {
+      clock.advance(1ms);
+      loop->runOnce();
+    }
+  });
+
+  if (done != kCoroutineCount) {
+    throw std::logic_error("Coroutines did not wake up.");
+  }
+}
+
+void runCoroutineBenchmarks() {
+  benchSteps();
+  benchLifecycle();
+  benchSleeps();
+}
+}
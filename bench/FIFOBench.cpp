@@ -0,0 +1,131 @@
+#include "bench/Bench.h"
+
+#include <common/Util.h>
+#include <event/FIFO.h>
+
+#include <memory>
+#include <queue>
+#include <stdexcept>
+#include <vector>
+
+namespace bench {
+
+static const size_t kFIFOCapacity = 256;
+static const size_t kPacketCount = 1000000;
+
+// Owns its buffer like a networking::Packet does, so moving one around is as
+// cheap (or as expensive) as moving a real packet.
+struct BenchPacket {
+  std::unique_ptr<Byte[]> data;
+  size_t size = 0;
+};
+
+// What event::FIFO used to be, kept around to compare against.
+template <typename T> class DequeFIFO {
+public:
+  DequeFIFO(std::size_t capacity)
+      : capacity_(capacity), canPush_(new event::BaseCondition()),
+        canPop_(new event::BaseCondition()) {
+    updateConditions();
+  }
+
+  event::Condition* canPush() { return canPush_.get(); }
+  event::Condition* canPop() { return canPop_.get(); }
+
+  void push(T&& element) {
+    if (queue_.size() >= capacity_) {
+      throw std::runtime_error("Trying to push into a full FIFO.");
+    }
+
+    queue_.push(std::move(element));
+    updateConditions();
+  }
+
+  T pop() {
+    if (queue_.size() == 0) {
+      throw std::runtime_error("Trying to pop from an empty FIFO.");
+    }
+
+    T result(std::move(queue_.front()));
+    queue_.pop();
+    updateConditions();
+    return result;
+  }
+
+private:
+  std::size_t capacity_;
+  std::queue<T> queue_;
+
+  std::unique_ptr<event::BaseCondition> canPush_;
+  std::unique_ptr<event::BaseCondition> canPop_;
+
+  void updateConditions() {
+    canPush_->set(queue_.size() < capacity_);
+    canPop_->set(queue_.size() > 0);
+  }
+};
+
+// Packets cycle between a free list and the FIFO, the way buffers cycle
+// between a data pipe's socket and the tunnel.
+static std::vector<BenchPacket> getPackets() {
+  std::vector<BenchPacket> packets(kFIFOCapacity);
+  for (auto& packet : packets) {
+    packet.data.reset(new Byte[2048]);
+  }
+  return packets;
+}
+
+// Fills the FIFO up and drains it again, one packet at a time.
+template <typename Q> static void benchSingle(std::string const& name) {
+  Q fifo(kFIFOCapacity);
+  auto packets = getPackets();
+  size_t moved = 0;
+
+  measure(name, kPacketCount, [&]() {
+    while (moved < kPacketCount) {
+      while (fifo.canPush()->eval() && !packets.empty()) {
+        fifo.push(std::move(packets.back()));
+        packets.pop_back();
+      }
+      while (fifo.canPop()->eval()) {
+        packets.push_back(fifo.pop());
+        packets.back().size++;
+        moved++;
+      }
+    }
+  });
+}
+
+static void benchBatch() {
+  event::FIFO<BenchPacket> fifo(kFIFOCapacity);
+  auto packets = getPackets();
+  size_t moved = 0;
+
+  measure("fifo/ring batch", kPacketCount, [&]() {
+    while (moved < kPacketCount) {
+      size_t room = fifo.reserve(packets.size());
+      for (size_t i = 0; i < room; i++) {
+        fifo.emplace(std::move(packets.back()));
+        packets.pop_back();
+      }
+      fifo.commit();
+
+      while (fifo.canPop()->eval()) {
+        auto span = fifo.peek();
+        for (auto& packet : span) {
+          packet.size++;
+          packets.push_back(std::move(packet));
+        }
+        fifo.discard(span.size);
+        moved += span.size;
+      }
+    }
+  });
+}
+
+void runFIFOBenchmarks() {
+  benchSingle<DequeFIFO<BenchPacket>>("fifo/deque push+pop");
+  benchSingle<event::FIFO<BenchPacket>>("fifo/ring push+pop");
+  benchBatch();
+}
+}
@@ -0,0 +1,195 @@
+#include "bench/Bench.h"
+
+#include <common/Util.h>
+#include <event/Action.h>
+#include <event/IOCondition.h>
+#include <event/VirtualClock.h>
+
+#include <errno.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace bench {
+
+using namespace std::chrono_literals;
+
+static const size_t kPacketSize = 1400;
+static const event::Duration kScriptLength = 1000ms;
+
+static const size_t kLatencyPackets = 10000;
+static const std::chrono::microseconds kLatencyInterval = 50us;
+
+// A datagram socket the loop reads from, with the other end of it playing
+// back a script of packets against a virtual clock. This exercises the real
+// IO wait without any actual network traffic, and the same way every run.
+class ScriptedFd {
+public:
+  // Sends a packet every `interval` for as long as the script lasts
+  ScriptedFd(event::Duration interval) : interval_(interval) {
+    int fds[2];
+    int ret = socketpair(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK, 0, fds);
+    checkUnixError(ret, "creating a socket pair");
+    fd_ = fds[0];
+    peerFd_ = fds[1];
+
+    reader_.reset(new event::Action({event::IOConditionManager::canRead(fd_)}));
+    reader_->callback.setMethod<ScriptedFd, &ScriptedFd::doRead>(this);
+  }
+
+  ~ScriptedFd() {
+    reader_.reset();
+    event::IOConditionManager::close(fd_);
+    close(fd_);
+    close(peerFd_);
+  }
+
+  // Sends whatever the script has due by `elapsed`
+  void play(event::Duration elapsed) {
+    while (next_ <= elapsed && next_ < kScriptLength) {
+      Byte packet[kPacketSize] = {};
+      int ret = send(peerFd_, packet, kPacketSize, 0);
+      checkUnixError(ret, "sending a scripted packet");
+      sent_++;
+      next_ += interval_;
+    }
+  }
+
+  size_t getPacketCount() const {
+    return (kScriptLength + interval_ - 1ms) / interval_;
+  }
+  size_t getReceivedCount() const { return received_; }
+
+private:
+  ScriptedFd(ScriptedFd const& copy) = delete;
+  ScriptedFd& operator=(ScriptedFd const& copy) = delete;
+
+  ScriptedFd(ScriptedFd&& move) = delete;
+  ScriptedFd& operator=(ScriptedFd&& move) = delete;
+
+  int fd_;
+  int peerFd_;
+  event::Duration interval_;
+  event::Duration next_ = event::Duration::zero();
+  size_t sent_ = 0;
+  size_t received_ = 0;
+  std::unique_ptr<event::Action> reader_;
+
+  void doRead() {
+    Byte packet[kPacketSize];
+    while (true) {
+      int ret = recv(fd_, packet, kPacketSize, 0);
+      if (ret < 0 && errno == EAGAIN) {
+        break;
+      }
+      checkUnixError(ret, "receiving a scripted packet");
+      received_++;
+    }
+  }
+};
+
+// Plays back a second worth of traffic over `count` sockets, each sending at
+// its own rate, and reports the cost per packet that made it through the loop.
+static void benchScriptedReads(size_t count) {
+  std::vector<std::unique_ptr<ScriptedFd>> fds;
+  size_t total = 0;
+  for (size_t i = 0; i < count; i++) {
+    fds.emplace_back(new ScriptedFd(event::Duration(i % 10 + 1)));
+    total += fds.back()->getPacketCount();
+  }
+
+  event::VirtualClock clock;
+  auto loop = event::EventLoop::getCurrentLoop();
+  auto start = clock.now();
+
+  measure("io/scripted read (" + std::to_string(count) + " fds)", total,
+          [&]() {
+            while (clock.now() - start <= kScriptLength) {
+              auto elapsed =
+                  std::chrono::duration_cast<event::Duration>(clock.now() -
+                                                              start);
+              for (auto& fd : fds) {
+                fd->play(elapsed);
+              }
+              loop->runOnce();
+              clock.advance(1ms);
+            }
+          });
+
+  size_t received = 0;
+  for (auto& fd : fds) {
+    received += fd->getReceivedCount();
+  }
+
+  if (received != total) {
+    throw std::runtime_error("Received " + std::to_string(received) +
+                             " out of " + std::to_string(total) +
+                             " scripted packets.");
+  }
+}
+
+// Time from a packet being sent from another thread to the loop getting to
+// read it, which is what the loop adds to each packet's latency. Unlike the
+// scripted reads, this needs real time and a real IO wait.
+static void benchPacketLatency(bool busyPoll) {
+  int fds[2];
+  int ret = socketpair(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK, 0, fds);
+  checkUnixError(ret, "creating a socket pair");
+
+  std::vector<int64_t> latencies;
+  latencies.reserve(kLatencyPackets);
+
+  auto reader = std::make_unique<event::Action>(
+      std::vector<event::Condition*>{event::IOConditionManager::canRead(fds[0])});
+  reader->callback = [&latencies, fd = fds[0]]() {
+    int64_t sent;
+    while (recv(fd, &sent, sizeof(sent), 0) == sizeof(sent)) {
+      auto now = std::chrono::steady_clock::now().time_since_epoch();
+      latencies.push_back(
+          std::chrono::duration_cast<std::chrono::nanoseconds>(now).count() -
+          sent);
+    }
+  };
+
+  std::thread sender([fd = fds[1]]() {
+    for (size_t i = 0; i < kLatencyPackets; i++) {
+      std::this_thread::sleep_for(kLatencyInterval);
+      auto now = std::chrono::steady_clock::now().time_since_epoch();
+      int64_t sent =
+          std::chrono::duration_cast<std::chrono::nanoseconds>(now).count();
+      send(fd, &sent, sizeof(sent), 0);
+    }
+  });
+
+  auto loop = event::EventLoop::getCurrentLoop();
+  loop->setBusyPoll(busyPoll);
+  while (latencies.size() < kLatencyPackets) {
+    loop->runOnce();
+  }
+  loop->setBusyPoll(false);
+  sender.join();
+
+  reader.reset();
+  event::IOConditionManager::close(fds[0]);
+  close(fds[0]);
+  close(fds[1]);
+
+  reportPercentiles(std::string("io/packet latency (") +
+                        (busyPoll ? "busy-poll" : "blocking") + ")",
+                    latencies);
+}
+
+void runIOBenchmarks() {
+  for (size_t count : {10, 100, 1000}) {
+    benchScriptedReads(count);
+  }
+
+  benchPacketLatency(false);
+  benchPacketLatency(true);
+}
+}
@@ -0,0 +1,296 @@
+#include "bench/Bench.h"
+
+#include <common/Util.h>
+#include <event/Action.h>
+#include <event/FIFO.h>
+#include <event/IOCondition.h>
+#include <event/Timer.h>
+#include <event/Trigger.h>
+#include <event/VirtualClock.h>
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace bench {
+
+using namespace std::chrono_literals;
+
+static const size_t kIterations = 10000;
+
+// Mimics the shape of an idle server session: a socket nobody sends to, a
+// queue with nothing in it, and a timeout far away.
+class IdleSession {
+public:
+  IdleSession() : queue_(16), timer_(60s) {
+    fd_ = socket(AF_INET, SOCK_DGRAM, 0);
+    checkUnixError(fd_, "creating a socket");
+
+    reader_.reset(new event::Action({event::IOConditionManager::canRead(fd_)}));
+    reader_->callback = []() {};
+
+    writer_.reset(new event::Action(
+        {queue_.canPop(), event::IOConditionManager::canWrite(fd_)}));
+    writer_->callback = []() {};
+
+    expirer_.reset(new event::Action({timer_.didFire()}));
+    expirer_->callback = []() {};
+  }
+
+  ~IdleSession() {
+    reader_.reset();
+    writer_.reset();
+    event::IOConditionManager::close(fd_);
+    close(fd_);
+  }
+
+private:
+  int fd_;
+  event::FIFO<int> queue_;
+  event::Timer timer_;
+
+  std::unique_ptr<event::Action> reader_;
+  std::unique_ptr<event::Action> writer_;
+  std::unique_ptr<event::Action> expirer_;
+};
+
+static void benchIdleSessions(size_t count) {
+  std::vector<std::unique_ptr<IdleSession>> sessions;
+  for (size_t i = 0; i < count; i++) {
+    sessions.emplace_back(new IdleSession());
+  }
+
+  // A single busy action keeps the loop from ever blocking, so that all we
+  // measure is the bookkeeping cost of an iteration.
+  size_t invoked = 0;
+  event::Action busy;
+  busy.callback = [&invoked]() { invoked++; };
+  busy.attach({});
+
+  auto loop = event::EventLoop::getCurrentLoop();
+  for (size_t i = 0; i < 10; i++) {
+    loop->runOnce();
+  }
+
+  measure("loop/iteration (" + std::to_string(count) + " idle sessions)",
+          kIterations, [&]() {
+            for (size_t i = 0; i < kIterations; i++) {
+              loop->runOnce();
+            }
+          });
+}
+
+// An idle loop should only wake up for the timers that are due, rather than
+// at a fixed interval. Runs it for kIdleWindow of real time, with idle
+// sessions around, and reports how long each wait lasted.
+static void benchIdleWakeups() {
+  static const auto kIdleWindow = 10s;
+  // The window's own timer, plus whatever the timer wheel needs to cascade
+  static const size_t kMaxIdleWakeups = 20;
+
+  std::vector<std::unique_ptr<IdleSession>> sessions;
+  for (size_t i = 0; i < 100; i++) {
+    sessions.emplace_back(new IdleSession());
+  }
+
+  bool done = false;
+  event::Timer window(kIdleWindow);
+  event::Action finisher({window.didFire()});
+  finisher.callback = [&done]() { done = true; };
+
+  auto loop = event::EventLoop::getCurrentLoop();
+  size_t start = loop->getIterationCount();
+  std::vector<int64_t> waits;
+  auto last = std::chrono::steady_clock::now();
+  while (!done) {
+    loop->runOnce();
+    auto now = std::chrono::steady_clock::now();
+    waits.push_back(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(now - last)
+            .count());
+    last = now;
+  }
+
+  size_t wakeups = loop->getIterationCount() - start;
+  reportPercentiles("loop/idle wakeup interval", waits);
+  if (wakeups > kMaxIdleWakeups) {
+    throw std::logic_error("Idle loop woke up " + std::to_string(wakeups) +
+                           " times in 10 seconds.");
+  }
+}
+
+// Actions waiting on internal conditions that never change should cost
+// nothing per iteration, however many there are.
+static void benchIdleActions(size_t count) {
+  std::vector<std::unique_ptr<event::BaseCondition>> conditions;
+  std::vector<std::unique_ptr<event::Action>> actions;
+  for (size_t i = 0; i < count; i++) {
+    conditions.emplace_back(new event::BaseCondition());
+    actions.emplace_back(new event::Action({conditions.back().get()}));
+    actions.back()->callback = []() {};
+  }
+
+  size_t invoked = 0;
+  event::Action busy;
+  busy.callback = [&invoked]() { invoked++; };
+  busy.attach({});
+
+  auto loop = event::EventLoop::getCurrentLoop();
+  for (size_t i = 0; i < 10; i++) {
+    loop->runOnce();
+  }
+
+  measure("loop/iteration (" + std::to_string(count) + " idle actions)",
+          kIterations, [&]() {
+            for (size_t i = 0; i < kIterations; i++) {
+              loop->runOnce();
+            }
+          });
+}
+
+// What the loop adds on top of the callback itself for every action it runs
+static void benchReadyActions(size_t count) {
+  size_t invoked = 0;
+  std::vector<std::unique_ptr<event::Action>> actions;
+  for (size_t i = 0; i < count; i++) {
+    actions.emplace_back(new event::Action());
+    actions.back()->callback = [&invoked]() { invoked++; };
+    actions.back()->attach({});
+  }
+
+  auto loop = event::EventLoop::getCurrentLoop();
+  for (size_t i = 0; i < 10; i++) {
+    loop->runOnce();
+  }
+
+  size_t iterations = kIterations * 10 / count + 1;
+  measure("loop/ready action (" + std::to_string(count) + " ready)",
+          iterations * count, [&]() {
+            for (size_t i = 0; i < iterations; i++) {
+              loop->runOnce();
+            }
+          });
+}
+
+// Creating and destroying conditions and actions is what every session setup
+// and teardown boils down to.
+static void benchRegistration() {
+  static const size_t kCount = 100000;
+
+  std::vector<std::unique_ptr<event::BaseCondition>> conditions;
+  std::vector<std::unique_ptr<event::Action>> actions;
+  conditions.reserve(kCount);
+  actions.reserve(kCount);
+
+  measure("loop/register", kCount, [&]() {
+    for (size_t i = 0; i < kCount; i++) {
+      conditions.emplace_back(new event::BaseCondition());
+      actions.emplace_back(new event::Action({conditions.back().get()}));
+    }
+  });
+
+  measure("loop/unregister", kCount, [&]() {
+    actions.clear();
+    conditions.clear();
+  });
+}
+
+// Every session teardown, pipe close and reconnect goes through a one-shot
+// trigger.
+static void benchTriggers() {
+  static const size_t kCount = 100000;
+
+  event::BaseCondition condition;
+  size_t fired = 0;
+  auto loop = event::EventLoop::getCurrentLoop();
+
+  auto armAll = [&]() {
+    for (size_t i = 0; i < kCount; i++) {
+      event::Trigger::arm({&condition}, [&fired]() { fired++; });
+    }
+  };
+  auto fireAll = [&]() {
+    condition.fire();
+    loop->runOnce();
+    condition.arm();
+  };
+
+  // Let the trigger pool grow first, as it would in a long running server.
+  armAll();
+  fireAll();
+
+  measure("trigger/arm", kCount, armAll);
+  measure("trigger/fire", kCount, fireAll);
+
+  // One trigger at a time going through its whole life, which is what most
+  // of them do.
+  measure("trigger/churn", kCount, [&]() {
+    for (size_t i = 0; i < kCount; i++) {
+      event::Trigger::perform([&fired]() { fired++; });
+      loop->runOnce();
+    }
+  });
+
+  if (fired != 3 * kCount) {
+    throw std::logic_error("Triggers were not fired.");
+  }
+}
+
+// Delayed triggers, spread over a second and walked through on a virtual
+// clock. Each one comes with a timer.
+static void benchDelayedTriggers() {
+  static const size_t kCount = 100000;
+  static const size_t kSpread = 1000;
+
+  event::VirtualClock clock;
+  size_t fired = 0;
+  auto loop = event::EventLoop::getCurrentLoop();
+
+  auto armAll = [&]() {
+    for (size_t i = 0; i < kCount; i++) {
+      event::Trigger::performIn(event::Duration(i % kSpread + 1),
+                                [&fired]() { fired++; });
+    }
+  };
+  // One extra millisecond, as timeouts get rounded up to the next tick
+  auto fireAll = [&]() {
+    for (size_t i = 0; i <= kSpread; i++) {
+      clock.advance(1ms);
+      loop->runOnce();
+    }
+  };
+
+  armAll();
+  fireAll();
+
+  measure("trigger/performIn", kCount, armAll);
+  measure("trigger/performIn fire", kCount, fireAll);
+
+  if (fired != 2 * kCount) {
+    throw std::logic_error("Delayed triggers were not fired.");
+  }
+}
+
+void runLoopBenchmarks() {
+  benchIdleWakeups();
+  benchRegistration();
+  benchTriggers();
+  benchDelayedTriggers();
+
+  for (size_t count : {1, 10, 100, 1000}) {
+    benchReadyActions(count);
+  }
+
+  for (size_t count : {10, 1000, 100000}) {
+    benchIdleActions(count);
+  }
+
+  for (size_t count : {10, 100, 1000, 10000}) {
+    benchIdleSessions(count);
+  }
+}
+}
@@ -0,0 +1,99 @@
+#include "bench/Bench.h"
+
+#include <event/FIFO.h>
+#include <networking/Packet.h>
+#include <stats/StatsManager.h>
+
+#include <memory>
+#include <stdexcept>
+
+namespace bench {
+
+// The capacities of TunnelPacket, DataPacket and UDPPacket
+static const size_t kTunnelPacketSize = networking::kDataPathPacketSize;
+static const size_t kDataPacketSize = networking::kDataPathPacketSize;
+static const size_t kUDPPacketSize = networking::kDataPathPacketSize;
+
+static const size_t kForwardedPackets = 1000000;
+static const size_t kForwardBatch = 64;
+static const size_t kFIFOCapacity = 256;
+
+using networking::Packet;
+
+// What Dispatcher::doSend and DataPipe::doSend do to each packet, minus the
+// IO: a tunnel packet gets read, handed to a data pipe's outbound FIFO as a
+// data packet, and leaves as a UDP packet, all in the same buffer.
+static void forwardBatch(event::FIFO<Packet>& outboundQ) {
+  size_t room = outboundQ.reserve(kForwardBatch);
+  for (size_t i = 0; i < room; i++) {
+    Packet in(kTunnelPacketSize);
+    in.size = 1400;
+    outboundQ.emplace(std::move(in));
+  }
+  outboundQ.commit();
+
+  size_t sent = 0;
+  for (auto& data : outboundQ.peek()) {
+    Packet out(std::move(data));
+    sent++;
+  }
+  outboundQ.discard(sent);
+}
+
+// The same with a fresh buffer per packet, which is what Packet used to do
+static void forwardBatchFromHeap(event::FIFO<std::unique_ptr<Byte[]>>& queue) {
+  size_t room = queue.reserve(kForwardBatch);
+  for (size_t i = 0; i < room; i++) {
+    std::unique_ptr<Byte[]> in(new Byte[kTunnelPacketSize]);
+    std::unique_ptr<Byte[]> data(new Byte[kDataPacketSize]);
+    std::swap(in, data);
+    queue.emplace(std::move(data));
+  }
+  queue.commit();
+
+  size_t sent = 0;
+  for (auto& data : queue.peek()) {
+    std::unique_ptr<Byte[]> out(new Byte[kUDPPacketSize]);
+    std::swap(out, data);
+    sent++;
+  }
+  queue.discard(sent);
+}
+
+// Heap allocations made by the packet pool since the last collection
+static double heapAllocations = 0;
+
+static double collectHeapAllocations() {
+  stats::StatsManager::collect();
+  return heapAllocations;
+}
+
+void runPacketBenchmarks() {
+  stats::StatsManager::subscribe([](auto const& data) {
+    auto it = data.find(std::make_pair("PacketPool", "heap_allocs"));
+    heapAllocations = (it == data.end() ? 0 : it->second);
+  });
+
+  event::FIFO<std::unique_ptr<Byte[]>> queue(kFIFOCapacity);
+  measure("packet/forward (new[])", kForwardedPackets, [&]() {
+    for (size_t i = 0; i < kForwardedPackets / kForwardBatch; i++) {
+      forwardBatchFromHeap(queue);
+    }
+  });
+
+  // Lets the pool warm up, and resets the stats
+  event::FIFO<Packet> outboundQ(kFIFOCapacity);
+  forwardBatch(outboundQ);
+  collectHeapAllocations();
+
+  measure("packet/forward (pooled)", kForwardedPackets, [&]() {
+    for (size_t i = 0; i < kForwardedPackets / kForwardBatch; i++) {
+      forwardBatch(outboundQ);
+    }
+  });
+
+  if (collectHeapAllocations() != 0) {
+    throw std::logic_error("Forwarding packets hit the heap.");
+  }
+}
+}
@@ -0,0 +1,133 @@
+#include "bench/Bench.h"
+
+#include <event/Action.h>
+#include <event/Timer.h>
+#include <event/TimerWheel.h>
+#include <event/VirtualClock.h>
+
+#include <memory>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace bench {
+
+using namespace std::chrono_literals;
+
+static const size_t kTimerCount = 100000;
+static const size_t kExtendRounds = 10;
+
+// Roughly what a server session does: timeouts spread over a few seconds to a
+// few minutes, extended over and over again as traffic comes in.
+static std::vector<event::Duration> getTimeouts() {
+  std::mt19937 random(42);
+  std::uniform_int_distribution<int> distribution(1000, 120000);
+
+  std::vector<event::Duration> timeouts;
+  for (size_t i = 0; i < kTimerCount; i++) {
+    timeouts.emplace_back(distribution(random));
+  }
+  return timeouts;
+}
+
+static void benchTimers() {
+  auto timeouts = getTimeouts();
+  std::vector<std::unique_ptr<event::Timer>> timers;
+  timers.reserve(kTimerCount);
+
+  measure("timer/arm", kTimerCount, [&]() {
+    for (size_t i = 0; i < kTimerCount; i++) {
+      timers.emplace_back(new event::Timer(timeouts[i]));
+    }
+  });
+
+  measure("timer/extend", kTimerCount * kExtendRounds, [&]() {
+    for (size_t round = 0; round < kExtendRounds; round++) {
+      for (size_t i = 0; i < kTimerCount; i++) {
+        timers[i]->extend(timeouts[(i + round) % kTimerCount]);
+      }
+    }
+  });
+
+  measure("timer/reset", kTimerCount, [&]() {
+    for (size_t i = 0; i < kTimerCount; i++) {
+      timers[i]->reset(timeouts[kTimerCount - i - 1]);
+    }
+  });
+
+  measure("timer/cancel", kTimerCount, [&]() { timers.clear(); });
+}
+
+// Fires every timer through the loop, as seen by the actions waiting on them.
+// A virtual clock walks the loop through the expiries one millisecond per
+// iteration without having to wait for them.
+static void benchTimerFiring() {
+  event::VirtualClock clock;
+  auto timeouts = getTimeouts();
+  std::vector<std::unique_ptr<event::Timer>> timers;
+  std::vector<std::unique_ptr<event::Action>> actions;
+
+  size_t fired = 0;
+  for (size_t i = 0; i < kTimerCount; i++) {
+    event::Timer* timer = new event::Timer(timeouts[i]);
+    timers.emplace_back(timer);
+    actions.emplace_back(new event::Action({timer->didFire()}));
+    actions.back()->callback = [&fired, timer]() {
+      // Disarms the timer, which would keep on firing otherwise
+      timer->reset();
+      fired++;
+    };
+  }
+
+  auto loop = event::EventLoop::getCurrentLoop();
+  measure("timer/fire", kTimerCount, [&]() {
+    while (fired < kTimerCount) {
+      clock.advance(1ms);
+      loop->runOnce();
+    }
+  });
+
+  actions.clear();
+  timers.clear();
+}
+
+static void benchTimerWheel() {
+  auto timeouts = getTimeouts();
+  std::vector<event::BaseCondition> conditions(kTimerCount);
+  std::vector<event::TimerWheel::Entry> entries(kTimerCount);
+  event::TimerWheel wheel;
+
+  for (size_t i = 0; i < kTimerCount; i++) {
+    entries[i].condition = &conditions[i];
+  }
+
+  measure("wheel/schedule", kTimerCount, [&]() {
+    for (size_t i = 0; i < kTimerCount; i++) {
+      wheel.schedule(&entries[i], timeouts[i].count());
+    }
+  });
+
+  // Walk the wheel through all of the expiries one millisecond at a time, as
+  // a busy loop would, so that every entry gets cascaded down and fired.
+  size_t fired = 0;
+  event::TimerWheel::Tick end = 120000;
+  measure("wheel/advance+fire", kTimerCount, [&]() {
+    for (event::TimerWheel::Tick tick = 1; tick <= end; tick++) {
+      fired += wheel.advance(tick);
+    }
+  });
+
+  if (fired != kTimerCount) {
+    throw std::runtime_error("Timer wheel fired " + std::to_string(fired) +
+                             " out of " + std::to_string(kTimerCount) +
+                             " entries.");
+  }
+}
+
+void runTimerBenchmarks() {
+  benchTimers();
+  benchTimerFiring();
+  benchTimerWheel();
+}
+}
@@ -0,0 +1,36 @@
+#include "bench/Bench.h"
+
+#include <common/Logger.h>
+#include <event/EventLoop.h>
+
+#include <cstring>
+#include <iostream>
+
+int main(int argc, char* argv[]) {
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--json") == 0) {
+      bench::setOutputFormat(bench::OutputFormat::JSON);
+      // Logs go to stdout as well, and would corrupt the document.
+      common::Logger::getDefault("").setLoggingThreshold(
+          common::LogLevel::ERROR);
+    } else {
+      std::cerr << "Usage: " << argv[0] << " [--json]" << std::endl;
+      return 1;
+    }
+  }
+
+  // All benchmarks share this thread's loop. The condition managers are
+  // static and outlive main(), so the loop has to as well.
+  new event::EventLoop();
+
+  bench::runTimerBenchmarks();
+  bench::runLoopBenchmarks();
+  bench::runIOBenchmarks();
+  bench::runCallbackBenchmarks();
+  bench::runFIFOBenchmarks();
+  bench::runCoroutineBenchmarks();
+  bench::runPacketBenchmarks();
+
+  bench::finishReport();
+  return 0;
+}
@@ -1,6 +1,9 @@
 #pragma once
 
+#include <atomic>
 #include <iostream>
+#include <mutex>
+#include <sstream>
 
 #define L()                                                                    \
   ::common::Logger::getDefault("=======").withLogLevel(common::LogLevel::INFO)
@@ -22,33 +25,40 @@ public:
   Logger(std::ostream& out = std::cout) : out_(out) {}
 
   template <typename T> Logger& operator<<(const T& v) {
-    if (level_ < threshold_) {
+    if (level_ < getThreshold()) {
       return *this;
     }
 
     if (!linePrimed_) {
-      out_ << logHeader() << "[" << tag_ << "] ";
+      line_ << logHeader() << "[" << tag_ << "] ";
       for (size_t i = tag_.length(); i < kLoggerTagPaddingTo; i++) {
-        out_ << " ";
+        line_ << " ";
       }
       linePrimed_ = true;
     }
-    out_ << v;
+    line_ << v;
     return *this;
   }
 
   Logger& operator<<(std::ostream& (*os)(std::ostream&)) {
-    if (level_ < threshold_) {
+    if (level_ < getThreshold()) {
       return *this;
     }
 
-    out_ << os;
+    // Lines are written out as a whole, so that lines logged from different
+    // threads don't get mixed up.
+    {
+      std::lock_guard<std::mutex> lock(getOutputMutex());
+      out_ << line_.str() << os;
+    }
+    line_.str("");
     linePrimed_ = false;
     return *this;
   }
 
+  // Each thread gets its own default logger
   static Logger& getDefault(std::string const& tag) {
-    static Logger defaultLogger;
+    static thread_local Logger defaultLogger;
     defaultLogger.tag_ = tag;
     return defaultLogger;
   }
@@ -58,7 +68,8 @@ public:
     return *this;
   }
 
-  void setLoggingThreshold(LogLevel threshold) { threshold_ = threshold; }
+  // The threshold is shared by all loggers
+  void setLoggingThreshold(LogLevel threshold) { getThreshold() = threshold; }
 
 private:
   const size_t kTimestampBufferSize = 64;
@@ -66,18 +77,29 @@ private:
   bool linePrimed_ = false;
   std::string tag_;
   std::ostream& out_;
-  LogLevel threshold_ = VERBOSE;
+  std::ostringstream line_;
   LogLevel level_ = VERBOSE;
 
+  static std::atomic<LogLevel>& getThreshold() {
+    static std::atomic<LogLevel> threshold(VERBOSE);
+    return threshold;
+  }
+
+  static std::mutex& getOutputMutex() {
+    static std::mutex mutex;
+    return mutex;
+  }
+
   std::string logHeader() {
     char timestampBuffer[kTimestampBufferSize];
     time_t rawTime;
-    struct tm* timeInfo;
+    struct tm timeInfo;
 
     time(&rawTime);
-    timeInfo = localtime(&rawTime);
+    localtime_r(&rawTime, &timeInfo);
 
-    strftime(timestampBuffer, kTimestampBufferSize, "[%F %H:%M:%S] ", timeInfo);
+    strftime(timestampBuffer, kTimestampBufferSize, "[%F %H:%M:%S] ",
+             &timeInfo);
     return std::string(timestampBuffer);
   }
 };
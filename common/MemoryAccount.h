@@ -0,0 +1,111 @@
+#pragma once
+
+#include <unistd.h>
+
+#include <atomic>
+#include <utility>
+
+namespace common {
+
+// Keeps count of the bytes held by a group of buffers, e.g. those of a
+// session, and adds them up into its parent's, e.g. those of the whole
+// process. Accounts can be charged from any thread.
+class MemoryAccount {
+public:
+  explicit MemoryAccount(MemoryAccount* parent = getGlobal())
+      : parent_(parent) {}
+
+  // Whatever is still charged goes away along with the account
+  ~MemoryAccount() {
+    if (parent_ != nullptr) {
+      parent_->release(bytes_.load(std::memory_order_relaxed));
+    }
+  }
+
+  // The account every other one adds up into
+  static MemoryAccount* getGlobal() {
+    static MemoryAccount global(nullptr);
+    return &global;
+  }
+
+  void charge(size_t bytes) {
+    for (MemoryAccount* account = this; account != nullptr;
+         account = account->parent_) {
+      account->bytes_.fetch_add(bytes, std::memory_order_relaxed);
+    }
+  }
+
+  void release(size_t bytes) {
+    for (MemoryAccount* account = this; account != nullptr;
+         account = account->parent_) {
+      account->bytes_.fetch_sub(bytes, std::memory_order_relaxed);
+    }
+  }
+
+  size_t getBytes() const { return bytes_.load(std::memory_order_relaxed); }
+
+  // Past this many bytes, whoever brings more data in on this account should
+  // drop it instead. 0 means no limit.
+  void setLimit(size_t limit) {
+    limit_.store(limit, std::memory_order_relaxed);
+  }
+
+  // Whether this account or any of its parents went over its limit
+  bool isOverLimit() const {
+    for (MemoryAccount const* account = this; account != nullptr;
+         account = account->parent_) {
+      size_t limit = account->limit_.load(std::memory_order_relaxed);
+      if (limit != 0 && account->getBytes() >= limit) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+private:
+  MemoryAccount(MemoryAccount const& copy) = delete;
+  MemoryAccount& operator=(MemoryAccount const& copy) = delete;
+
+  MemoryAccount* parent_;
+  std::atomic<size_t> bytes_{0};
+  std::atomic<size_t> limit_{0};
+};
+
+// Holds a fixed number of bytes charged to an account for as long as it lives,
+// e.g. for a buffer allocated upfront.
+class MemoryCharge {
+public:
+  MemoryCharge() {}
+
+  MemoryCharge(MemoryAccount* account, size_t bytes)
+      : account_(account), bytes_(bytes) {
+    if (account_ != nullptr) {
+      account_->charge(bytes_);
+    }
+  }
+
+  ~MemoryCharge() {
+    if (account_ != nullptr) {
+      account_->release(bytes_);
+    }
+  }
+
+  MemoryCharge(MemoryCharge&& move)
+      : account_(move.account_), bytes_(move.bytes_) {
+    move.account_ = nullptr;
+  }
+
+  MemoryCharge& operator=(MemoryCharge&& move) {
+    std::swap(account_, move.account_);
+    std::swap(bytes_, move.bytes_);
+    return *this;
+  }
+
+private:
+  MemoryCharge(MemoryCharge const& copy) = delete;
+  MemoryCharge& operator=(MemoryCharge const& copy) = delete;
+
+  MemoryAccount* account_ = nullptr;
+  size_t bytes_ = 0;
+};
+}
@@ -28,6 +28,10 @@ Notebook::Notebook(std::string path) : path_(path) {
   return Notebook::instance_;
 }
 
+std::unique_lock<std::mutex> Notebook::lock() {
+  return std::unique_lock<std::mutex>(mutex_);
+}
+
 void Notebook::save() {
   std::ofstream output(path_);
   output << storage_.dump() << std::endl;
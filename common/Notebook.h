@@ -2,18 +2,22 @@
 
 #include <json/src/json.hpp>
 
+#include <mutex>
 #include <string>
 
 namespace common {
 
 using json = nlohmann::json;
 
+// The notebook is shared by all threads. Hold the lock returned by lock() while
+// reading, modifying or saving it.
 class Notebook {
 public:
   Notebook(std::string path);
 
   static Notebook* getInstance();
 
+  std::unique_lock<std::mutex> lock();
   void save();
   json& operator[](std::string key);
 
@@ -26,6 +30,7 @@ private:
 
   static Notebook* instance_;
 
+  std::mutex mutex_;
   std::string path_;
   json storage_;
 };
@@ -41,16 +41,16 @@ AESEncryptor::AESEncryptor(AESKey const& key) : key_(key) {}
 
 /* virtual */ size_t AESEncryptor::encrypt(Byte* data, size_t size,
                                            size_t capacity) /* override */ {
-  Byte iv[CryptoPP::AES::BLOCKSIZE];
+  assertTrue(size + CryptoPP::AES::BLOCKSIZE <= capacity,
+             "Not enough place to store AES encryption IV.");
+
+  // The IV goes right where it is sent from, after the data
+  Byte* iv = data + size;
   random_.GenerateBlock(iv, CryptoPP::AES::BLOCKSIZE);
 
   CryptoPP::CFB_Mode<CryptoPP::AES>::Encryption encryption(key_.key,
                                                            key_.key.size(), iv);
   encryption.ProcessData(data, data, size);
-
-  assertTrue(size + CryptoPP::AES::BLOCKSIZE <= capacity,
-             "Not enough place to store AES encryption IV.");
-  memcpy(data + size, iv, CryptoPP::AES::BLOCKSIZE);
   return size + CryptoPP::AES::BLOCKSIZE;
 }
 
@@ -60,13 +60,12 @@ AESEncryptor::AESEncryptor(AESKey const& key) : key_(key) {}
       size >= CryptoPP::AES::BLOCKSIZE,
       "AES decryption encountered a size that is less than the IV size.");
 
-  Byte iv[CryptoPP::AES::BLOCKSIZE];
-  memcpy(iv, data + (size - CryptoPP::AES::BLOCKSIZE),
-         CryptoPP::AES::BLOCKSIZE);
+  size_t payloadSize = size - CryptoPP::AES::BLOCKSIZE;
+  Byte* iv = data + payloadSize;
 
   CryptoPP::CFB_Mode<CryptoPP::AES>::Decryption decryption(key_.key,
                                                            key_.key.size(), iv);
-  decryption.ProcessData(data, data, size);
-  return size - CryptoPP::AES::BLOCKSIZE;
+  decryption.ProcessData(data, data, payloadSize);
+  return payloadSize;
 }
 }
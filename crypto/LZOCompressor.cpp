@@ -8,33 +8,45 @@ LZOCompressor::LZOCompressor() { workMem_.resize(LZO1X_1_MEM_COMPRESS); }
 
 /* virtual */ size_t LZOCompressor::encrypt(Byte* data, size_t size,
                                             size_t capacity) /* override */ {
-  if (capacity > buffer_.capacity()) {
+  if (capacity > buffer_.size()) {
     buffer_.resize(capacity);
   }
 
-  lzo_uint compressedSize = capacity;
-  auto ret = lzo1x_1_compress(data, size, buffer_.data(), &compressedSize,
-                              workMem_.data());
-  assertTrue(ret == LZO_E_OK, "LZOCompressor compression failed.");
-
+  size_t compressedSize = compress(data, size, buffer_.data(), capacity);
   memcpy(data, buffer_.data(), compressedSize);
-
   return compressedSize;
 }
 
 /* virtual */ size_t LZOCompressor::decrypt(Byte* data, size_t size,
                                             size_t capacity) /* override */ {
-  if (capacity > buffer_.capacity()) {
+  if (capacity > buffer_.size()) {
     buffer_.resize(capacity);
   }
 
-  lzo_uint decompressedSize = capacity;
-  auto ret = lzo1x_decompress(data, size, buffer_.data(), &decompressedSize,
-                              workMem_.data());
-  assertTrue(ret == LZO_E_OK, "LZOCompressor decompression failed.");
-
+  size_t decompressedSize = decompress(data, size, buffer_.data(), capacity);
   memcpy(data, buffer_.data(), decompressedSize);
+  return decompressedSize;
+}
+
+size_t LZOCompressor::compress(Byte const* data, size_t size, Byte* output,
+                               size_t capacity) {
+  assertTrue(size + size / 16 + 64 + 3 <= capacity,
+             "LZOCompressor output buffer is too small.");
+
+  lzo_uint compressedSize = capacity;
+  auto ret = lzo1x_1_compress(data, size, output, &compressedSize,
+                              workMem_.data());
+  assertTrue(ret == LZO_E_OK, "LZOCompressor compression failed.");
+  return compressedSize;
+}
 
+size_t LZOCompressor::decompress(Byte const* data, size_t size, Byte* output,
+                                 size_t capacity) {
+  // Packets come from the network, and output is only as large as a packet
+  lzo_uint decompressedSize = capacity;
+  auto ret = lzo1x_decompress_safe(data, size, output, &decompressedSize,
+                                   nullptr);
+  assertTrue(ret == LZO_E_OK, "LZOCompressor decompression failed.");
   return decompressedSize;
 }
 }
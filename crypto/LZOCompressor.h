@@ -14,9 +14,23 @@ class LZOCompressor : public Encryptor {
 public:
   LZOCompressor();
 
+  // LZO cannot work in place, so these go through a buffer of their own and
+  // copy the result back.
   virtual size_t encrypt(Byte* data, size_t size, size_t capacity) override;
   virtual size_t decrypt(Byte* data, size_t size, size_t capacity) override;
 
+  // Work from one buffer into another instead, e.g. into a fresh packet that
+  // then takes the place of the original one.
+  size_t compress(Byte const* data, size_t size, Byte* output,
+                  size_t capacity);
+  size_t decompress(Byte const* data, size_t size, Byte* output,
+                    size_t capacity);
+
+  // The bytes held by the work memory and the buffer
+  size_t getFootprint() const {
+    return workMem_.capacity() + buffer_.capacity();
+  }
+
 private:
   std::vector<Byte> workMem_;
   std::vector<Byte> buffer_;
@@ -1,21 +1,42 @@
 #include "event/Action.h"
 
 #include <iostream>
+#include <stdexcept>
 
 namespace event {
 
-Action::Action(std::vector<Condition*> conditions) : conditions_(conditions) {
-  EventLoop::getCurrentLoop()->addAction(this);
+Action::Action(std::vector<Condition*> conditions) { attach(conditions); }
+
+Action::Action() {}
+
+Action::~Action() { detach(); }
+
+void Action::attach(std::vector<Condition*> const& conditions) {
+  if (isAttached()) {
+    throw std::logic_error("Attaching an action that is already attached.");
+  }
+  EventLoop::getCurrentLoop()->addAction(this, conditions);
 }
 
-Action::~Action() { EventLoop::getCurrentLoop()->removeAction(this); }
+void Action::detach() {
+  if (isAttached()) {
+    EventLoop::getCurrentLoop()->removeAction(this);
+  }
+}
+
+bool Action::isAttached() const { return handle_ != ActionHandle(); }
 
 void Action::invoke() { callback.invoke(); }
 
 bool Action::canInvoke() const {
-  for (auto condition : conditions_) {
-    if (!EventLoop::getCurrentLoop()->hasCondition(condition) ||
-        !condition->eval()) {
+  if (dead_) {
+    return false;
+  }
+
+  auto loop = EventLoop::getCurrentLoop();
+  for (auto handle : conditions_) {
+    Condition* condition = loop->getCondition(handle);
+    if (condition == nullptr || !condition->eval()) {
       return false;
     }
   }
@@ -23,13 +44,19 @@ bool Action::canInvoke() const {
   return true;
 }
 
-bool Action::isDead() const {
-  for (auto condition : conditions_) {
-    if (!EventLoop::getCurrentLoop()->hasCondition(condition)) {
-      return true;
-    }
-  }
+bool Action::isDead() const { return dead_; }
+
+ActionHandle Action::getHandle() const { return handle_; }
 
-  return false;
+void Action::setName(std::string const& name) {
+  stats_ = EventLoop::getCurrentLoop()->getActionStats(name);
 }
+
+void Action::setGroup(std::string const& name) {
+  groupStats_ = EventLoop::getCurrentLoop()->getActionStats(name);
+}
+
+void Action::setPriority(ActionPriority priority) { priority_ = priority; }
+
+ActionPriority Action::getPriority() const { return priority_; }
 }
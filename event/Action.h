@@ -4,7 +4,10 @@
 #include <event/Condition.h>
 #include <event/EventLoop.h>
 
+#include <stdint.h>
+
 #include <functional>
+#include <string>
 #include <vector>
 
 namespace event {
@@ -12,14 +15,37 @@ namespace event {
 class Action {
 public:
   Action(std::vector<Condition*> conditions);
+  // Creates an action that is not attached to the event loop yet
+  Action();
   ~Action();
 
   friend class EventLoop;
 
+  // A detached action is never invoked. Attaching it again, possibly to other
+  // conditions, lets owners reuse an action instead of allocating a new one.
+  void attach(std::vector<Condition*> const& conditions);
+  void detach();
+  bool isAttached() const;
+
   void invoke();
   bool canInvoke() const;
   bool isDead() const;
 
+  // Changes every time the action gets attached
+  ActionHandle getHandle() const;
+
+  // Actions with the same name share their stats on invocations and the time
+  // spent running them.
+  void setName(std::string const& name);
+
+  // Actions in the same group also add up to the group's stats, e.g. to tell
+  // how much time the loop spends on each session.
+  void setGroup(std::string const& name);
+
+  // Defaults to ActionPriority::Control
+  void setPriority(ActionPriority priority);
+  ActionPriority getPriority() const;
+
   Callback<void> callback;
 
 private:
@@ -29,6 +55,18 @@ private:
   Action(Action const&& move) = delete;
   Action& operator=(Action const&& move) = delete;
 
-  std::vector<Condition*> conditions_;
+  ActionHandle handle_;
+  std::vector<ConditionHandle> conditions_;
+  // Where the action is in each of its conditions' list of actions
+  std::vector<uint32_t> positions_;
+
+  ActionStats* stats_ = nullptr;
+  ActionStats* groupStats_ = nullptr;
+  ActionPriority priority_ = ActionPriority::Control;
+
+  // Bookkeeping for the event loop
+  bool dead_ = false;
+  bool eligible_ = false;
+  bool queued_ = false;
 };
 }
@@ -1,49 +1,74 @@
 #pragma once
 
-#include <functional>
+#include <new>
 #include <stdexcept>
+#include <type_traits>
+#include <utility>
 
 namespace event {
 
+// Room a Callback has for a callable before it has to put it on the heap.
+// Method callbacks and lambdas capturing up to four pointers fit.
+static const size_t kCallbackInlineSize = 4 * sizeof(void*);
+
+// Calls either a method on target, or a callable. Method callbacks are what
+// long lived objects should use, as they never allocate and can be moved along
+// with their object by pointing target at the new address. Small callables are
+// stored inline as well, only larger ones end up on the heap.
 template <typename R> class Callback {
 public:
   Callback() {}
 
-  Callback(Callback&& move)
-      : target(std::move(move.target)), func_(std::move(move.func_)),
-        method_(std::move(move.method_)) {}
+  template <typename F, typename = typename std::enable_if<!std::is_same<
+                            typename std::decay<F>::type, Callback>::value>::type>
+  Callback(F&& func) {
+    *this = std::forward<F>(func);
+  }
+
+  ~Callback() { reset(); }
+
+  Callback(Callback&& move) : target(move.target) { moveFrom(move); }
 
   Callback& operator=(Callback&& move) {
-    std::swap(func_, move.func_);
-    std::swap(method_, move.method_);
-    std::swap(target, move.target);
+    if (this != &move) {
+      reset();
+      target = move.target;
+      moveFrom(move);
+    }
     return *this;
   }
 
-  Callback& operator=(std::function<R()> func) {
-    func_ = func;
-    method_ = nullptr;
-    target = nullptr;
+  template <typename F, typename = typename std::enable_if<!std::is_same<
+                            typename std::decay<F>::type, Callback>::value>::type>
+  Callback& operator=(F&& func) {
+    using Func = typename std::decay<F>::type;
+
+    reset();
+    if (sizeof(Func) <= sizeof(storage_) &&
+        alignof(Func) <= alignof(Storage) &&
+        std::is_nothrow_move_constructible<Func>::value) {
+      new (&storage_) Func(std::forward<F>(func));
+      invoker_ = &invokeInline<Func>;
+      manager_ = &manageInline<Func>;
+    } else {
+      *reinterpret_cast<Func**>(&storage_) = new Func(std::forward<F>(func));
+      invoker_ = &invokeHeap<Func>;
+      manager_ = &manageHeap<Func>;
+    }
     return *this;
   }
 
   template <typename T, R (T::*Method)()> void setMethod(T* object) {
-    func_ = nullptr;
-    method_ = [](void* object) { return (((T*)object)->*Method)(); };
+    reset();
+    invoker_ = &invokeMethod<T, Method>;
     target = object;
   }
 
   R invoke() {
-    if (!!func_) {
-      return func_();
-    } else if (!!method_) {
-      if (target == nullptr) {
-        throw std::runtime_error("Invoking an Callable with an empty target.");
-      }
-      return method_(target);
-    } else {
+    if (invoker_ == nullptr) {
       throw std::runtime_error("Invoking an empty Callable.");
     }
+    return invoker_(*this);
   }
 
   void* target = nullptr;
@@ -52,7 +77,67 @@ private:
   Callback(Callback const& copy) = delete;
   Callback& operator=(Callback const& copy) = delete;
 
-  std::function<R()> func_;
-  std::function<R(void*)> method_;
+  using Storage =
+      typename std::aligned_storage<kCallbackInlineSize, alignof(void*)>::type;
+
+  // Calls whatever the callback holds
+  R (*invoker_)(Callback& callback) = nullptr;
+  // Moves the stored callable from one callback to another if to is set, and
+  // destroys it in from either way. Not set if there is nothing to manage.
+  void (*manager_)(Callback& from, Callback* to) = nullptr;
+  Storage storage_;
+
+  void reset() {
+    if (manager_ != nullptr) {
+      manager_(*this, nullptr);
+    }
+    invoker_ = nullptr;
+    manager_ = nullptr;
+    target = nullptr;
+  }
+
+  void moveFrom(Callback& move) {
+    invoker_ = move.invoker_;
+    manager_ = move.manager_;
+    if (manager_ != nullptr) {
+      manager_(move, this);
+    }
+    move.invoker_ = nullptr;
+    move.manager_ = nullptr;
+    move.target = nullptr;
+  }
+
+  template <typename T, R (T::*Method)()>
+  static R invokeMethod(Callback& callback) {
+    if (callback.target == nullptr) {
+      throw std::runtime_error("Invoking an Callable with an empty target.");
+    }
+    return (static_cast<T*>(callback.target)->*Method)();
+  }
+
+  template <typename F> static R invokeInline(Callback& callback) {
+    return (*reinterpret_cast<F*>(&callback.storage_))();
+  }
+
+  template <typename F> static void manageInline(Callback& from, Callback* to) {
+    F* func = reinterpret_cast<F*>(&from.storage_);
+    if (to != nullptr) {
+      new (&to->storage_) F(std::move(*func));
+    }
+    func->~F();
+  }
+
+  template <typename F> static R invokeHeap(Callback& callback) {
+    return (**reinterpret_cast<F**>(&callback.storage_))();
+  }
+
+  template <typename F> static void manageHeap(Callback& from, Callback* to) {
+    F** func = reinterpret_cast<F**>(&from.storage_);
+    if (to != nullptr) {
+      *reinterpret_cast<F**>(&to->storage_) = *func;
+    } else {
+      delete *func;
+    }
+  }
 };
 }
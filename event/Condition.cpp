@@ -0,0 +1,64 @@
+#include "event/Condition.h"
+
+#include <algorithm>
+
+namespace event {
+
+ComputedCondition::~ComputedCondition() {
+  for (auto input : inputs_) {
+    auto& dependents = input->dependents_;
+    dependents.erase(std::remove(dependents.begin(), dependents.end(), this),
+                     dependents.end());
+  }
+}
+
+void ComputedCondition::dependOn(Condition* condition) {
+  if (std::find(inputs_.begin(), inputs_.end(), condition) != inputs_.end()) {
+    return;
+  }
+
+  inputs_.push_back(condition);
+  condition->dependents_.push_back(this);
+}
+
+ConditionWaiter::~ConditionWaiter() {
+  if (isWaiting()) {
+    EventLoop::getCurrentLoop()->removeWaiter(this);
+  }
+}
+
+void ConditionWaiter::wait(Condition* condition,
+                           std::coroutine_handle<> handle) {
+  handle_ = handle;
+  EventLoop::getCurrentLoop()->addWaiter(this, condition);
+}
+
+void WaiterList::push(ConditionWaiter* waiter) {
+  waiter->list_ = this;
+  waiter->prev_ = tail;
+  waiter->next_ = nullptr;
+  if (tail == nullptr) {
+    head = waiter;
+  } else {
+    tail->next_ = waiter;
+  }
+  tail = waiter;
+}
+
+void WaiterList::remove(ConditionWaiter* waiter) {
+  if (waiter->prev_ == nullptr) {
+    head = waiter->next_;
+  } else {
+    waiter->prev_->next_ = waiter->next_;
+  }
+  if (waiter->next_ == nullptr) {
+    tail = waiter->prev_;
+  } else {
+    waiter->next_->prev_ = waiter->prev_;
+  }
+
+  waiter->list_ = nullptr;
+  waiter->prev_ = nullptr;
+  waiter->next_ = nullptr;
+}
+}
@@ -3,14 +3,48 @@
 #include <event/Callback.h>
 #include <event/EventLoop.h>
 
+#include <coroutine>
 #include <functional>
+#include <vector>
 
 namespace event {
 
+class ComputedCondition;
+class Condition;
+
+// A coroutine suspended until a condition holds (see event/Coroutine.h).
+// Waiters are resumed by the event loop right after whatever fired their
+// condition returns, without going through the actions scheduled in between.
+class ConditionWaiter {
+public:
+  ConditionWaiter() {}
+  // Stops waiting, e.g. when the coroutine's frame gets destroyed
+  ~ConditionWaiter();
+
+  void wait(Condition* condition, std::coroutine_handle<> handle);
+  bool isWaiting() const { return list_ != nullptr; }
+
+private:
+  ConditionWaiter(ConditionWaiter const& copy) = delete;
+  ConditionWaiter& operator=(ConditionWaiter const& copy) = delete;
+
+  friend class EventLoop;
+  friend struct WaiterList;
+
+  // The handle stops resolving if the condition goes away in the meantime
+  ConditionHandle condition_;
+  std::coroutine_handle<> handle_;
+
+  // Either the condition's waiters or the event loop's ready ones
+  WaiterList* list_ = nullptr;
+  ConditionWaiter* prev_ = nullptr;
+  ConditionWaiter* next_ = nullptr;
+};
+
 class Condition {
 public:
   Condition(ConditionType type = ConditionType::Internal) : type(type) {
-    EventLoop::getCurrentLoop()->addCondition(this);
+    handle_ = EventLoop::getCurrentLoop()->addCondition(this);
   }
 
   virtual ~Condition() { EventLoop::getCurrentLoop()->removeCondition(this); }
@@ -19,12 +53,30 @@ public:
 
   virtual bool eval() = 0;
 
+protected:
+  // Must be called whenever the value of the condition might have changed, so
+  // that the actions depending on it get reconsidered by the event loop.
+  void notify() { EventLoop::getCurrentLoop()->conditionChanged(this); }
+
 private:
   Condition(Condition const& copy) = delete;
   Condition& operator=(Condition const& copy) = delete;
 
   Condition(Condition const&& move) = delete;
   Condition& operator=(Condition const&& move) = delete;
+
+  friend class EventLoop;
+  friend class ComputedCondition;
+
+  ConditionHandle handle_;
+
+  // Actions and computed conditions that depend on this condition
+  std::vector<Action*> actions_;
+  std::vector<ComputedCondition*> dependents_;
+  WaiterList waiters_;
+
+  // Number of eligible actions that could be unblocked by this condition
+  size_t interest_ = 0;
 };
 
 class BaseCondition : public Condition {
@@ -33,9 +85,15 @@ public:
       : Condition(type), value_(false) {}
 
   bool eval() { return value_; }
-  void arm() { value_ = false; }
-  void fire() { value_ = true; }
-  void set(bool value) { value_ = value; }
+  void arm() { set(false); }
+  void fire() { set(true); }
+
+  void set(bool value) {
+    if (value_ != value) {
+      value_ = value;
+      notify();
+    }
+  }
 
 private:
   BaseCondition(BaseCondition const& copy) = delete;
@@ -47,19 +105,35 @@ private:
   bool value_;
 };
 
+// A condition whose value is computed from other state. The event loop only
+// re-evaluates it when it has reason to believe the value has changed, so the
+// owner must either call invalidate() whenever the expression might yield a
+// different result, or declare the conditions it is computed from with
+// dependOn().
 class ComputedCondition : public Condition {
 public:
   ComputedCondition() : Condition(ConditionType::Internal) {}
+  ~ComputedCondition();
 
   Callback<bool> expression;
 
   bool eval() { return expression.invoke(); }
 
+  void invalidate() { notify(); }
+
+  // Invalidates this condition whenever the given condition changes. The
+  // dependency goes away by itself once either condition is destroyed.
+  void dependOn(Condition* condition);
+
 private:
   ComputedCondition(ComputedCondition const& copy) = delete;
   ComputedCondition& operator=(ComputedCondition const& copy) = delete;
 
   ComputedCondition(ComputedCondition const&& move) = delete;
   ComputedCondition& operator=(ComputedCondition const&& move) = delete;
+
+  friend class EventLoop;
+
+  std::vector<Condition*> inputs_;
 };
 }
@@ -0,0 +1,69 @@
+#include "event/Coroutine.h"
+
+#include <new>
+#include <vector>
+
+namespace event {
+
+// Frames are rounded up to multiples of this, and anything larger than the
+// largest class goes straight to the heap.
+static const size_t kFrameSizeClassBytes = 64;
+static const size_t kFrameSizeClasses = 32;
+
+namespace {
+
+struct FreeFrame {
+  FreeFrame* next;
+};
+
+struct FrameFreeLists {
+  FreeFrame* heads[kFrameSizeClasses] = {};
+
+  ~FrameFreeLists() {
+    for (auto head : heads) {
+      while (head != nullptr) {
+        FreeFrame* next = head->next;
+        ::operator delete(head);
+        head = next;
+      }
+    }
+  }
+};
+
+thread_local FrameFreeLists freeLists;
+
+size_t getSizeClass(size_t size) {
+  return (size + kFrameSizeClassBytes - 1) / kFrameSizeClassBytes - 1;
+}
+}
+
+/* static */ void* FramePool::allocate(size_t size) {
+  size_t sizeClass = getSizeClass(size);
+  if (sizeClass >= kFrameSizeClasses) {
+    return ::operator new(size);
+  }
+
+  FreeFrame*& head = freeLists.heads[sizeClass];
+  if (head == nullptr) {
+    return ::operator new((sizeClass + 1) * kFrameSizeClassBytes);
+  }
+
+  FreeFrame* frame = head;
+  head = frame->next;
+  return frame;
+}
+
+/* static */ void FramePool::deallocate(void* frame, size_t size) {
+  size_t sizeClass = getSizeClass(size);
+  if (sizeClass >= kFrameSizeClasses) {
+    ::operator delete(frame);
+    return;
+  }
+
+  // Frames go back to the pool of the thread destroying them, which is the
+  // thread of the loop they ran on.
+  FreeFrame* freed = static_cast<FreeFrame*>(frame);
+  freed->next = freeLists.heads[sizeClass];
+  freeLists.heads[sizeClass] = freed;
+}
+}
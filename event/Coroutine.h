@@ -0,0 +1,165 @@
+#pragma once
+
+#include <event/Condition.h>
+#include <event/FIFO.h>
+#include <event/Timer.h>
+
+#include <chrono>
+#include <coroutine>
+#include <memory>
+#include <type_traits>
+#include <utility>
+
+namespace event {
+
+// Coroutine frames come from per-thread free lists, one per size class, so
+// that starting a coroutine only allocates until the pool has warmed up.
+class FramePool {
+public:
+  static void* allocate(size_t size);
+  static void deallocate(void* frame, size_t size);
+};
+
+// Suspends the coroutine until the condition holds, or not at all if it
+// already does.
+class ConditionAwaiter {
+public:
+  ConditionAwaiter(Condition* condition) : condition_(condition) {}
+
+  bool await_ready() { return condition_->eval(); }
+  void await_suspend(std::coroutine_handle<> handle) {
+    waiter_.wait(condition_, handle);
+  }
+  void await_resume() {}
+
+private:
+  Condition* condition_;
+  ConditionWaiter waiter_;
+};
+
+// Pops an element from the FIFO, waiting for one to arrive if it is empty
+template <typename T> class PopAwaiter {
+public:
+  PopAwaiter(FIFO<T>* fifo) : fifo_(fifo) {}
+
+  bool await_ready() { return fifo_->canPop()->eval(); }
+  void await_suspend(std::coroutine_handle<> handle) {
+    waiter_.wait(fifo_->canPop(), handle);
+  }
+  T await_resume() { return fifo_->pop(); }
+
+private:
+  FIFO<T>* fifo_;
+  ConditionWaiter waiter_;
+};
+
+// What pop() returns. The awaiter itself cannot be moved, as it links into
+// the condition it waits on, so the coroutine builds it in place.
+template <typename T> struct PopRequest {
+  FIFO<T>* fifo;
+};
+
+template <typename T> PopRequest<T> pop(FIFO<T>* fifo) {
+  return PopRequest<T>{fifo};
+}
+
+// A coroutine run on the event loop. It starts running right away, and is
+// resumed by the event loop whenever what it awaits comes through. Besides
+// the awaitables above, a coroutine can await
+//
+//  - a Condition*, to wait until it holds, and
+//  - a duration, to sleep for that long.
+//
+// The Coroutine object owns the frame: destroying it destroys the coroutine
+// wherever it is suspended, so owners should keep it alongside the state the
+// coroutine works on.
+class Coroutine {
+public:
+  class promise_type {
+  public:
+    Coroutine get_return_object() {
+      return Coroutine(
+          std::coroutine_handle<promise_type>::from_promise(*this));
+    }
+
+    std::suspend_never initial_suspend() noexcept { return {}; }
+    // Keeps the frame around for the Coroutine object to destroy
+    std::suspend_always final_suspend() noexcept { return {}; }
+    void return_void() {}
+    // Exceptions propagate to whoever resumed the coroutine, as they would
+    // out of an action.
+    void unhandled_exception() { throw; }
+
+    static void* operator new(size_t size) {
+      return FramePool::allocate(size);
+    }
+    static void operator delete(void* frame, size_t size) {
+      FramePool::deallocate(frame, size);
+    }
+
+    ConditionAwaiter await_transform(Condition* condition) {
+      return ConditionAwaiter(condition);
+    }
+
+    template <typename Rep, typename Period>
+    ConditionAwaiter
+    await_transform(std::chrono::duration<Rep, Period> const& delay) {
+      // One timer serves all the sleeps of a coroutine
+      if (timer_ == nullptr) {
+        timer_.reset(new Timer());
+      }
+      timer_->reset(std::chrono::duration_cast<Duration>(delay));
+      return ConditionAwaiter(timer_->didFire());
+    }
+
+    template <typename T>
+    PopAwaiter<T> await_transform(PopRequest<T> const& request) {
+      return PopAwaiter<T>(request.fifo);
+    }
+
+    // Anything else that is awaitable on its own
+    template <typename Awaitable>
+      requires requires(Awaitable& awaitable) { awaitable.await_ready(); }
+    Awaitable&& await_transform(Awaitable&& awaitable) {
+      return std::forward<Awaitable>(awaitable);
+    }
+
+  private:
+    std::unique_ptr<Timer> timer_;
+  };
+
+  Coroutine() {}
+  ~Coroutine() { reset(); }
+
+  Coroutine(Coroutine&& move) : handle_(move.handle_) {
+    move.handle_ = nullptr;
+  }
+
+  Coroutine& operator=(Coroutine&& move) {
+    if (this != &move) {
+      reset();
+      handle_ = move.handle_;
+      move.handle_ = nullptr;
+    }
+    return *this;
+  }
+
+  bool isDone() const { return !handle_ || handle_.done(); }
+
+  // Destroys the coroutine. Must not be called from within the coroutine.
+  void reset() {
+    if (handle_) {
+      handle_.destroy();
+      handle_ = nullptr;
+    }
+  }
+
+private:
+  Coroutine(std::coroutine_handle<promise_type> handle) : handle_(handle) {}
+
+  Coroutine(Coroutine const& copy) = delete;
+  Coroutine& operator=(Coroutine const& copy) = delete;
+
+  std::coroutine_handle<promise_type> handle_;
+};
+}
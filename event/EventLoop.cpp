@@ -2,44 +2,258 @@
 
 #include <event/Action.h>
 #include <event/IOCondition.h>
+#include <event/TaskQueue.h>
+#include <event/VirtualClock.h>
 
 #include <common/Util.h>
+#include <stats/RateStat.h>
 
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+
+#if LINUX
+#include <sched.h>
+#endif
+
+#include <algorithm>
 #include <iostream>
 #include <stdexcept>
 
 namespace event {
 
-EventLoop* EventLoop::instance = nullptr;
+using namespace std::chrono_literals;
+
+static const Duration kDefaultSlowActionThreshold = 10ms;
+static const Duration kDefaultHousekeepingBudget = 5ms;
+
+struct LoopStats {
+  LoopStats()
+      : iterations("Loop", "iterations"), preparing("Loop", "prepare_ms"),
+        waiting("Loop", "wait_ms"), polling("Loop", "poll_ms"),
+        invoking("Loop", "invoke_ms"), slowActions("Loop", "slow_actions"),
+        deferredActions("Loop", "deferred_actions"),
+        resumedWaiters("Loop", "resumed_waiters") {}
+
+  stats::RateStat iterations;
+  // Running preparers and figuring out what to wait for
+  stats::RateStat preparing;
+  // Blocked in the condition managers, waiting for something to happen
+  stats::RateStat waiting;
+  // The rest of what the condition managers do, e.g. firing IO conditions
+  stats::RateStat polling;
+  stats::RateStat invoking;
+  stats::RateStat slowActions;
+  // Ready actions pushed to the next iteration by their priority's budget
+  stats::RateStat deferredActions;
+  // Coroutines resumed straight from the condition they waited on
+  stats::RateStat resumedWaiters;
+};
+
+struct ActionStats {
+  ActionStats(std::string const& name)
+      : name(name), invocations(name, "calls"), time(name, "ms") {}
+
+  std::string name;
+  stats::RateStat invocations;
+  stats::RateStat time;
+};
+
+static double toMilliseconds(Time::duration duration) {
+  return std::chrono::duration<double, std::milli>(duration).count();
+}
+
+thread_local EventLoop* EventLoop::instance = nullptr;
+
+/* static */ bool EventLoop::defaultBusyPoll_ = false;
+/* static */ std::vector<int> EventLoop::busyPollCPUs_;
+/* static */ std::atomic<int> EventLoop::busyPollLoops_{0};
+
+// A loop that cannot be pinned still runs, just wherever the kernel puts it
+static void pinCurrentThread(int cpu) {
+#if LINUX
+  cpu_set_t cpus;
+  CPU_ZERO(&cpus);
+  CPU_SET(cpu, &cpus);
+  int ret = sched_setaffinity(0, sizeof(cpus), &cpus);
+  if (ret < 0) {
+    LOG_I("Event") << "Cannot pin an event loop to CPU " << cpu << ": "
+                   << strerror(errno) << std::endl;
+    return;
+  }
+  LOG_I("Event") << "Pinned an event loop to CPU " << cpu << "." << std::endl;
+#else
+  LOG_E("Event") << "Pinning event loops to CPUs is not supported here."
+                 << std::endl;
+#endif
+}
+
+EventLoop::EventLoop()
+    : conditions_(), conditionManagers_(), stats_(new LoopStats()),
+      slowActionThreshold_(kDefaultSlowActionThreshold) {
+  priorityBudgets_.fill(Duration::max());
+  setPriorityBudget(ActionPriority::Housekeeping, kDefaultHousekeepingBudget);
 
-EventLoop::EventLoop() : actions_(), conditions_(), conditionManagers_() {
   if (EventLoop::instance != nullptr) {
-    throw std::runtime_error("Only 1 EventLoop should be created.");
+    throw std::runtime_error("Only 1 EventLoop should be created per thread.");
   }
 
   EventLoop::instance = this;
 
+  if (defaultBusyPoll_) {
+    setBusyPoll(true);
+    if (!busyPollCPUs_.empty()) {
+      pinCurrentThread(
+          busyPollCPUs_[busyPollLoops_++ % busyPollCPUs_.size()]);
+    }
+  }
+
   // This is needed to force IOConditionManager to initialize and attach its
   // preparer, even in the case that the program doesn't actually use IO.
   // Otherwise we have no blocking operation on the event loop, and the CPU
   // usage is going to skyrocket.
   IOConditionManager::canRead(0);
+
+  tasks_.reset(new TaskQueue());
+}
+
+EventLoop::~EventLoop() {}
+
+ActionHandle EventLoop::addAction(Action* action,
+                                 std::vector<Condition*> const& conditions) {
+  // Subscribe the action to all its conditions, so that it gets queued
+  // whenever one of them changes.
+  for (auto condition : conditions) {
+    action->conditions_.push_back(condition->handle_);
+    action->positions_.push_back(condition->actions_.size());
+    condition->actions_.push_back(action);
+  }
+
+  ActionHandle handle = actions_.insert(action);
+  action->handle_ = handle;
+  queueAction(action);
+
+  return handle;
+}
+
+void EventLoop::removeAction(Action* action) {
+  setInterest(action, false);
+
+  for (size_t i = 0; i < action->conditions_.size(); i++) {
+    Condition* condition = conditions_.get(action->conditions_[i]);
+    if (condition != nullptr) {
+      unsubscribe(condition, action->positions_[i]);
+    }
+  }
+
+  actions_.erase(action->handle_);
+
+  // Leave the action in a state it can be attached again from. Its old handle
+  // stops resolving, so whatever still refers to it is simply skipped.
+  action->handle_ = ActionHandle();
+  action->conditions_.clear();
+  action->positions_.clear();
+  action->dead_ = false;
+  action->queued_ = false;
 }
 
-void EventLoop::addAction(Action* action) { actions_.insert(action); }
+void EventLoop::unsubscribe(Condition* condition, uint32_t position) {
+  // The last action takes the place of the one leaving, so removing an action
+  // costs the same no matter how many others wait on the same condition.
+  auto& actions = condition->actions_;
+  uint32_t last = actions.size() - 1;
+  Action* moved = actions[last];
+  actions[position] = moved;
+  actions.pop_back();
 
-void EventLoop::removeAction(Action* action) { actions_.erase(action); }
+  if (position == last) {
+    return;
+  }
 
-void EventLoop::addCondition(Condition* condition) {
-  conditions_.insert(condition);
+  for (size_t i = 0; i < moved->conditions_.size(); i++) {
+    if (moved->conditions_[i] == condition->handle_ &&
+        moved->positions_[i] == last) {
+      moved->positions_[i] = position;
+      break;
+    }
+  }
 }
 
-bool EventLoop::hasCondition(Condition* condition) {
-  return (conditions_.find(condition) != conditions_.end());
+ConditionHandle EventLoop::addCondition(Condition* condition) {
+  return conditions_.insert(condition);
 }
 
 void EventLoop::removeCondition(Condition* condition) {
-  conditions_.erase(condition);
+  conditions_.erase(condition->handle_);
+
+  for (auto action : condition->actions_) {
+    killAction(action);
+  }
+
+  // Waiters are never resumed, and their interest goes away along with the
+  // condition.
+  while (!condition->waiters_.empty()) {
+    condition->waiters_.remove(condition->waiters_.head);
+  }
+
+  // Computed conditions are likely to evaluate differently now that one of
+  // their inputs is gone.
+  for (auto dependent : condition->dependents_) {
+    auto& inputs = dependent->inputs_;
+    inputs.erase(std::remove(inputs.begin(), inputs.end(), condition),
+                 inputs.end());
+    dependent->invalidate();
+  }
+}
+
+Action* EventLoop::getAction(ActionHandle handle) const {
+  return actions_.get(handle);
+}
+
+Condition* EventLoop::getCondition(ConditionHandle handle) const {
+  return conditions_.get(handle);
+}
+
+bool EventLoop::hasCondition(ConditionHandle handle) const {
+  return conditions_.contains(handle);
+}
+
+void EventLoop::conditionChanged(Condition* condition) {
+  for (auto action : condition->actions_) {
+    queueAction(action);
+  }
+
+  // Waiters keep their interest until they are resumed, as this could be
+  // called by a condition manager in the middle of going through its
+  // conditions.
+  if (!condition->waiters_.empty() && condition->eval()) {
+    while (!condition->waiters_.empty()) {
+      ConditionWaiter* waiter = condition->waiters_.head;
+      condition->waiters_.remove(waiter);
+      readyWaiters_.push(waiter);
+    }
+  }
+
+  for (auto dependent : condition->dependents_) {
+    dependent->invalidate();
+  }
+}
+
+void EventLoop::addWaiter(ConditionWaiter* waiter, Condition* condition) {
+  waiter->condition_ = condition->handle_;
+  condition->waiters_.push(waiter);
+  if (condition->type != ConditionType::Internal) {
+    addInterest(condition);
+  }
+}
+
+void EventLoop::removeWaiter(ConditionWaiter* waiter) {
+  waiter->list_->remove(waiter);
+
+  Condition* condition = conditions_.get(waiter->condition_);
+  if (condition != nullptr && condition->type != ConditionType::Internal) {
+    removeInterest(condition);
+  }
 }
 
 void EventLoop::addConditionManager(ConditionManager* manager,
@@ -51,118 +265,429 @@ void EventLoop::addPreparer(EventLoopPreparer* preparer) {
   preparers_.push_back(preparer);
 }
 
-void EventLoop::run() {
-  while (true) {
-    // First we run all the preparers
-    //
-    // They must be run before the subsequent dead action purging, as some types
-    // of events (e.g. Trigger) are allowed to be dead, and the Trigger manager
-    // itself is supposed to purge those.
-    for (auto preparer : preparers_) {
-      preparer->prepare();
-    }
-
-    // First we purge the dead actions (i.e. actions that refer to at least one
-    // condition that doesn't exist anymore)
-    size_t purged = 0;
-    for (auto it = actions_.begin(); it != actions_.end();) {
-      if ((*it)->isDead()) {
-        purged++;
-        it = actions_.erase(it);
-      } else {
-        it++;
-      }
+void EventLoop::post(Callback<void> task) { tasks_->post(std::move(task)); }
+
+size_t EventLoop::getIterationCount() const { return iterationCount_; }
+
+std::vector<ActionHandle> const& EventLoop::getDeadActions() const {
+  return deadActions_;
+}
+
+void EventLoop::willWait() { waitStart_ = std::chrono::steady_clock::now(); }
+
+void EventLoop::didWait() {
+  waited_ += std::chrono::steady_clock::now() - waitStart_;
+}
+
+ActionStats* EventLoop::getActionStats(std::string const& name) {
+  auto& stats = actionStats_[name];
+  if (stats == nullptr) {
+    stats.reset(new ActionStats(name));
+  }
+  return stats.get();
+}
+
+void EventLoop::setSlowActionThreshold(Duration threshold) {
+  slowActionThreshold_ = threshold;
+}
+
+void EventLoop::setPriorityBudget(ActionPriority priority, Duration budget) {
+  priorityBudgets_[static_cast<size_t>(priority)] = budget;
+}
+
+void EventLoop::setBusyPoll(bool busyPoll) { busyPoll_ = busyPoll; }
+
+bool EventLoop::isBusyPolling() const { return busyPoll_; }
+
+/* static */ void EventLoop::setDefaultBusyPoll(bool busyPoll, int firstCPU) {
+  defaultBusyPoll_ = busyPoll;
+  busyPollCPUs_.clear();
+  if (firstCPU < 0) {
+    return;
+  }
+
+#if LINUX
+  // Taken before any loop pins its thread, as threads started from a pinned
+  // one would only see its CPU.
+  cpu_set_t cpus;
+  CPU_ZERO(&cpus);
+  checkUnixError(sched_getaffinity(0, sizeof(cpus), &cpus),
+                 "getting the CPUs event loops can run on");
+
+  std::vector<int> allowed;
+  for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+    if (CPU_ISSET(cpu, &cpus)) {
+      allowed.push_back(cpu);
     }
+  }
 
-    if (purged > 0) {
-      LOG_E("Event") << "Purged " << std::to_string(purged)
-                     << " dead actions. This should ideally never happen."
-                     << std::endl;
+  // Counting up from firstCPU, or from the first one if it is out of reach
+  auto first = std::lower_bound(allowed.begin(), allowed.end(), firstCPU);
+  if (first == allowed.end()) {
+    first = allowed.begin();
+  }
+  busyPollCPUs_.insert(busyPollCPUs_.end(), first, allowed.end());
+  busyPollCPUs_.insert(busyPollCPUs_.end(), allowed.begin(), first);
+#else
+  busyPollCPUs_.push_back(firstCPU);
+#endif
+}
+
+ConditionManager* EventLoop::getConditionManager(ConditionType type) {
+  for (auto pair : conditionManagers_) {
+    if (pair.first == type) {
+      return pair.second;
     }
+  }
 
-    // Tell condition managers to prepare conditions they manage. For example,
-    // the IO condition manager might use select, poll, or epoll to resolve
-    // values for all IO conditions.
+  return nullptr;
+}
 
-    // Conditions are divided into two types: internal and external. External
-    // conditions are those related to external I/O. Internal conditions are
-    // those changed exclusively as a result of an Action.
+void EventLoop::queueAction(Action* action) {
+  if (!action->queued_) {
+    action->queued_ = true;
+    pendingActions_.push_back(action->handle_);
+  }
+}
 
-    // First we need to find all "interesting" external conditions. An external
-    // condition is interesting if it could potentially unblock at least one
-    // action.
-    // On the contrary, if an action currently has an internal condition unmet,
-    // it will not be unblocked by any movement of its external conditions.
+void EventLoop::killAction(Action* action) {
+  // The condition going away has already been removed, so this only gives up
+  // the interest held in the remaining ones.
+  setInterest(action, false);
 
-    // We then pass the set of all type-matching conditions, and the set of all
-    // "interesting" conditions to the condition manager.
+  if (!action->dead_) {
+    action->dead_ = true;
+    deadActions_.push_back(action->handle_);
+  }
+}
 
-    for (auto pair : conditionManagers_) {
-      // Find all conditions of the given type
-      std::vector<Condition*> conditionsWithType;
-      for (auto condition : conditions_) {
-        if (condition->type == pair.first) {
-          conditionsWithType.push_back(condition);
-        }
+void EventLoop::updateEligibility(Action* action) {
+  // An action is eligible if none of its internal conditions is holding it
+  // back. Only then are its external conditions interesting: if an action
+  // currently has an internal condition unmet, it will not be unblocked by
+  // any movement of its external conditions.
+  bool eligible = !action->dead_;
+  if (eligible) {
+    for (auto handle : action->conditions_) {
+      Condition* condition = conditions_.get(handle);
+      if (condition->type == ConditionType::Internal && !condition->eval()) {
+        eligible = false;
+        break;
       }
+    }
+  }
 
-      // Find all "interesting" conditions of the type
-      std::set<Condition*> interesting;
-      for (auto action : actions_) {
-        bool eligible = true;
-        for (auto condition : action->conditions_) {
-          if (!hasCondition(condition)) {
-            continue;
-          }
-
-          if (condition->type == ConditionType::Internal &&
-              !condition->eval()) {
-            eligible = false;
-            break;
-          }
-        }
-        if (eligible) {
-          for (auto condition : action->conditions_) {
-            if (!hasCondition(condition)) {
-              continue;
-            }
-
-            if (condition->type == pair.first) {
-              interesting.insert(condition);
-            }
-          }
-        }
-      }
-      pair.second->prepareConditions(
-          conditionsWithType,
-          std::vector<Condition*>(interesting.begin(), interesting.end()));
+  setInterest(action, eligible);
+}
+
+void EventLoop::setInterest(Action* action, bool interested) {
+  if (action->eligible_ == interested) {
+    return;
+  }
+
+  action->eligible_ = interested;
+  for (auto handle : action->conditions_) {
+    Condition* condition = conditions_.get(handle);
+    if (condition == nullptr || condition->type == ConditionType::Internal) {
+      continue;
     }
 
-    // Invoke actions that have all their conditions met
-    std::set<Action*> toInvoke;
+    if (interested) {
+      addInterest(condition);
+    } else {
+      removeInterest(condition);
+    }
+  }
+}
 
-    for (auto action : actions_) {
-      if (action->canInvoke()) {
-        toInvoke.insert(action);
-      }
+void EventLoop::addInterest(Condition* condition) {
+  if (condition->interest_++ == 0) {
+    ConditionManager* manager = getConditionManager(condition->type);
+    if (manager != nullptr) {
+      manager->addInterest(condition);
+    }
+  }
+}
+
+void EventLoop::removeInterest(Condition* condition) {
+  if (--condition->interest_ == 0) {
+    ConditionManager* manager = getConditionManager(condition->type);
+    if (manager != nullptr) {
+      manager->removeInterest(condition);
+    }
+  }
+}
+
+void EventLoop::purgeDeadActions() {
+  // Dead actions (i.e. actions that refer to at least one condition that
+  // doesn't exist anymore) never run again. Whatever is still around here was
+  // not cleaned up by its owner.
+  size_t purged = 0;
+  for (auto handle : deadActions_) {
+    if (actions_.contains(handle)) {
+      purged++;
+    }
+  }
+  deadActions_.clear();
+
+  if (purged > 0) {
+    LOG_E("Event") << "Purged " << std::to_string(purged)
+                   << " dead actions. This should ideally never happen."
+                   << std::endl;
+  }
+}
+
+bool EventLoop::resumeWaiters() {
+  bool resumed = false;
+
+  // Resumed coroutines can fire conditions in turn, whose waiters get resumed
+  // right away as well.
+  while (!readyWaiters_.empty()) {
+    ConditionWaiter* waiter = readyWaiters_.head;
+    Condition* condition = conditions_.get(waiter->condition_);
+    if (condition == nullptr) {
+      readyWaiters_.remove(waiter);
+      continue;
+    }
+
+    // Whatever fired the condition could have taken it back since, e.g. by
+    // popping from a FIFO it just pushed into.
+    removeWaiter(waiter);
+    if (!condition->eval()) {
+      addWaiter(waiter, condition);
+      continue;
+    }
+
+    stats_->resumedWaiters.accumulate(1);
+    resumed = true;
+    waiter->handle_.resume();
+  }
+
+  return resumed;
+}
+
+Time EventLoop::invokeActions(Time start) {
+  // Coroutines whose conditions fired since the last round, e.g. by the
+  // condition managers, go first.
+  if (resumeWaiters()) {
+    start = std::chrono::steady_clock::now();
+  }
+
+  // Only actions that were queued since the last round can possibly be ready.
+  // Anything queued while invoking is looked at in the next round.
+  for (auto handle : pendingActions_) {
+    Action* action = actions_.get(handle);
+    if (action != nullptr) {
+      action->queued_ = false;
+      invokingActions_[static_cast<size_t>(action->priority_)].push_back(
+          handle);
+    }
+  }
+  pendingActions_.clear();
+
+  for (size_t priority = 0; priority < kActionPriorities; priority++) {
+    start = invokeActions(invokingActions_[priority],
+                          priorityBudgets_[priority], start);
+  }
+
+  return start;
+}
+
+Time EventLoop::invokeActions(std::vector<ActionHandle>& handles,
+                              Duration budget, Time start) {
+  Time deadline = Time::max();
+  if (budget != Duration::max()) {
+    deadline = start + budget;
+  }
+
+  // Where the actions queued during this call start, and where the ones that
+  // ran out of budget start among them
+  size_t queued = pendingActions_.size();
+  size_t deferred = SIZE_MAX;
+
+  for (auto handle : handles) {
+    // Invoking some previous action in this round could have caused this
+    // action to be removed already, in which case the handle doesn't resolve
+    // anymore. Also firing an action could invalidate other actions. So we
+    // need to recheck.
+    Action* action = actions_.get(handle);
+    if (action == nullptr || !action->canInvoke()) {
+      continue;
+    }
+
+    if (start >= deadline) {
+      deferred = std::min(deferred, pendingActions_.size());
+      stats_->deferredActions.accumulate(1);
+      queueAction(action);
+      continue;
+    }
+
+    // Each action is timed from where the previous one ended, which saves a
+    // clock read per action at the cost of also counting the checks above.
+    // The action might be gone once it returns, its stats are not.
+    ActionStats* stats = action->stats_;
+    ActionStats* groupStats = action->groupStats_;
+    action->invoke();
+    Time end = std::chrono::steady_clock::now();
+    auto elapsed = end - start;
+    start = end;
+
+    if (stats != nullptr) {
+      stats->invocations.accumulate(1);
+      stats->time.accumulate(toMilliseconds(elapsed));
+    }
+    if (groupStats != nullptr) {
+      groupStats->invocations.accumulate(1);
+      groupStats->time.accumulate(toMilliseconds(elapsed));
+    }
+    if (elapsed > slowActionThreshold_) {
+      reportSlowAction(stats, elapsed);
+    }
+
+    // Coroutines waiting on what the action fired carry on before anything
+    // else runs. Their time is not counted towards the next action.
+    if (resumeWaiters()) {
+      start = std::chrono::steady_clock::now();
+    }
+
+    // An action that stays ready after running gets to run again in the next
+    // round, even if none of its conditions changed.
+    if (actions_.contains(handle)) {
+      queueAction(action);
+    }
+  }
+
+  // Whatever got deferred goes first in the next round, so that actions which
+  // stay ready cannot starve it.
+  if (deferred != SIZE_MAX) {
+    std::rotate(pendingActions_.begin() + queued,
+                pendingActions_.begin() + deferred, pendingActions_.end());
+  }
+
+  handles.clear();
+  return start;
+}
+
+void EventLoop::reportSlowAction(ActionStats* stats, Time::duration elapsed) {
+  stats_->slowActions.accumulate(1);
+  LOG_I("Event") << (stats != nullptr ? "Action " + stats->name
+                                      : std::string("An unnamed action"))
+                 << " took " << toMilliseconds(elapsed) << " ms to run."
+                 << std::endl;
+}
+
+Time EventLoop::getWaitDeadline() {
+  // Virtual time does not pass while we wait, so there is no point in it.
+  if (VirtualClock::getCurrentClock() != nullptr) {
+    return Time::min();
+  }
+
+  // Neither should anybody if some coroutine is ready to carry on.
+  if (!readyWaiters_.empty()) {
+    return Time::min();
+  }
+
+  // If some action is ready to go without any IO, nobody should block.
+  for (auto handle : pendingActions_) {
+    Action* action = actions_.get(handle);
+    if (action == nullptr || action->dead_) {
+      continue;
     }
 
-    for (auto actionToInvoke : toInvoke) {
-      // Invoking some previous action in this round could have caused this
-      // action to be removed already. So we need to recheck.
-      // Also firing an action could invalidate other actions. So we need to
-      // recheck that as well.
-      if (actions_.find(actionToInvoke) != actions_.end() &&
-          actionToInvoke->canInvoke()) {
-        actionToInvoke->invoke();
+    bool ready = true;
+    for (auto conditionHandle : action->conditions_) {
+      Condition* condition = conditions_.get(conditionHandle);
+      if (condition->type == ConditionType::IO || !condition->eval()) {
+        ready = false;
+        break;
       }
     }
+
+    if (ready) {
+      return Time::min();
+    }
   }
+
+  // Otherwise we can wait until some condition manager expects something to
+  // happen on its own (e.g. the next timer firing), or indefinitely for IO.
+  Time deadline = Time::max();
+  for (auto pair : conditionManagers_) {
+    deadline = std::min(deadline, pair.second->getNextDeadline());
+  }
+
+  return deadline;
+}
+
+void EventLoop::run() {
+  while (!stopped_) {
+    runOnce();
+  }
+}
+
+void EventLoop::stop() {
+  // Going through the task queue both wakes up a blocked loop and keeps
+  // stopped_ to the loop's own thread
+  post([this]() { stopped_ = true; });
+}
+
+void EventLoop::runOnce() {
+  iterationCount_++;
+  Time start = std::chrono::steady_clock::now();
+
+  // First we run all the preparers
+  //
+  // They must be run before the subsequent dead action purging, as some types
+  // of events (e.g. Trigger) are allowed to be dead, and the Trigger manager
+  // itself is supposed to purge those.
+  for (auto preparer : preparers_) {
+    preparer->prepare();
+  }
+
+  purgeDeadActions();
+
+  // Tell condition managers to prepare conditions they manage. For example,
+  // the IO condition manager might use select, poll, or epoll to resolve
+  // values for all IO conditions.
+
+  // Conditions are divided into two types: internal and external. External
+  // conditions are those related to external I/O. Internal conditions are
+  // those changed exclusively as a result of an Action.
+
+  // Condition managers only care about "interesting" external conditions.
+  // Whether a condition is interesting only changes when an action depending
+  // on it changes eligibility, which in turn can only happen to actions that
+  // have been queued since the last round.
+  for (auto handle : pendingActions_) {
+    Action* action = actions_.get(handle);
+    if (action != nullptr) {
+      updateEligibility(action);
+    }
+  }
+
+  // We then let the condition managers resolve their conditions, together
+  // with the deadline until which they are allowed to block.
+  Time deadline = (busyPoll_ ? Time::min() : getWaitDeadline());
+  Time prepared = std::chrono::steady_clock::now();
+
+  waited_ = Time::duration::zero();
+  for (auto pair : conditionManagers_) {
+    pair.second->prepareConditions(deadline);
+  }
+  Time polled = std::chrono::steady_clock::now();
+
+  // Invoke actions that have all their conditions met
+  Time invoked = invokeActions(polled);
+
+  stats_->iterations.accumulate(1);
+  stats_->preparing.accumulate(toMilliseconds(prepared - start));
+  stats_->waiting.accumulate(toMilliseconds(waited_));
+  stats_->polling.accumulate(toMilliseconds(polled - prepared - waited_));
+  stats_->invoking.accumulate(toMilliseconds(invoked - polled));
 }
 
 EventLoop* EventLoop::getCurrentLoop() {
   if (EventLoop::instance == nullptr) {
-    throw std::runtime_error("No current EventLoop exists.");
+    throw std::runtime_error("No current EventLoop exists on this thread.");
   }
 
   return EventLoop::instance;
@@ -1,24 +1,79 @@
 #pragma once
 
-#include <set>
+#include <event/Callback.h>
+#include <event/SlotMap.h>
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <string>
 #include <vector>
 
 namespace event {
 
+using Time = std::chrono::steady_clock::time_point;
+using Duration = std::chrono::milliseconds;
+
 enum ConditionType {
   Internal,
   IO,
   Signal,
 };
 
+// Ready actions get invoked in this order within an iteration, so that moving
+// packets never has to wait behind bookkeeping.
+enum class ActionPriority {
+  // Moving packets between the tunnel and the network
+  DataPlane,
+  // Sessions, handshakes and everything else that does not say otherwise
+  Control,
+  // Stats, reports and anything else that can wait for an iteration or two
+  Housekeeping,
+};
+
+static const size_t kActionPriorities = 3;
+
 class Action;
 class Condition;
+class ConditionWaiter;
+class TaskQueue;
+struct ActionStats;
+struct LoopStats;
+
+using ActionHandle = SlotMap<Action>::Handle;
+using ConditionHandle = SlotMap<Condition>::Handle;
+
+// Waiters are kept in intrusive lists, so that waiting and giving up on it
+// never allocate.
+struct WaiterList {
+  ConditionWaiter* head = nullptr;
+  ConditionWaiter* tail = nullptr;
+
+  bool empty() const { return head == nullptr; }
+  void push(ConditionWaiter* waiter);
+  void remove(ConditionWaiter* waiter);
+};
 
 class ConditionManager {
 public:
-  virtual void
-  prepareConditions(std::vector<Condition*> const& conditions,
-                    std::vector<Condition*> const& interesting) = 0;
+  // A condition is interesting if it could potentially unblock at least one
+  // action. The event loop keeps track of that incrementally, and tells the
+  // manager whenever a condition it manages starts or stops being interesting.
+  //
+  // A manager that destroys a condition while it is still interesting must
+  // forget about it on its own, as no removeInterest() will follow.
+  virtual void addInterest(Condition* condition) {}
+  virtual void removeInterest(Condition* condition) {}
+
+  // Resolves the values of the interesting conditions managed. A manager that
+  // blocks to wait for its conditions must not block beyond the given deadline.
+  virtual void prepareConditions(Time deadline) = 0;
+
+  // Returns the earliest time at which some condition managed could become
+  // true without any IO happening (e.g. a timer expiring).
+  virtual Time getNextDeadline() { return Time::max(); }
 };
 
 class EventLoopPreparer {
@@ -26,19 +81,84 @@ public:
   virtual void prepare() = 0;
 };
 
+// There is at most one event loop per thread. Actions, conditions and
+// condition managers belong to the loop of the thread that created them, and
+// must only be used from that thread.
 class EventLoop {
 public:
   EventLoop();
+  ~EventLoop();
 
+  // Runs iterations until stop() gets called
   void run();
-  void addAction(Action* action);
+  // Runs a single iteration of the event loop, blocking as run() would.
+  void runOnce();
+  // Makes run() return once the iteration it is in is done. Can be called from
+  // any thread, just like post().
+  void stop();
+  ActionHandle addAction(Action* action,
+                         std::vector<Condition*> const& conditions);
   void removeAction(Action* action);
-  void addCondition(Condition* condition);
-  bool hasCondition(Condition* condition);
+  ConditionHandle addCondition(Condition* condition);
   void removeCondition(Condition* condition);
+
+  // Return nullptr if the handle refers to something that was removed
+  Action* getAction(ActionHandle handle) const;
+  Condition* getCondition(ConditionHandle handle) const;
+  bool hasCondition(ConditionHandle handle) const;
+  void conditionChanged(Condition* condition);
+
+  // Resumes the waiter's coroutine once the condition holds. A waiter whose
+  // condition gets removed in the meantime is never resumed, and is left for
+  // its owner to destroy.
+  void addWaiter(ConditionWaiter* waiter, Condition* condition);
+  void removeWaiter(ConditionWaiter* waiter);
+
   void addConditionManager(ConditionManager* manager, ConditionType type);
   void addPreparer(EventLoopPreparer* preparer);
 
+  // Runs the given task on this loop's thread during one of its next
+  // iterations. Unlike everything else here, this can be called from any
+  // thread, as long as the loop outlives the call.
+  void post(Callback<void> task);
+
+  // Number of iterations run() has gone through so far.
+  size_t getIterationCount() const;
+
+  // Actions that became dead since the last iteration. Preparers get to clean
+  // up the ones they own before the event loop complains about the rest.
+  std::vector<ActionHandle> const& getDeadActions() const;
+
+  // Condition managers call these around the call they block in, so that the
+  // time spent waiting is not mistaken for work.
+  void willWait();
+  void didWait();
+
+  // Returns the stats shared by all actions with the given name or group
+  ActionStats* getActionStats(std::string const& name);
+
+  // Actions that run for longer than this get reported, as they hold up
+  // everything else on the loop.
+  void setSlowActionThreshold(Duration threshold);
+
+  // Limits how long actions of the given priority get to run per iteration.
+  // Once they ran over, the rest of them wait for the next iteration. As
+  // actions are never interrupted, a single one can still take longer.
+  void setPriorityBudget(ActionPriority priority, Duration budget);
+
+  // A busy-polling loop never blocks to wait for IO or timers, and keeps
+  // checking on them instead. This takes a core all to itself, and in return
+  // saves the time it takes to wake a blocked thread up.
+  void setBusyPoll(bool busyPoll);
+  bool isBusyPolling() const;
+
+  // Loops created from now on start out busy-polling. Unless firstCPU is
+  // negative, each of them also pins its thread to a CPU of its own, counting
+  // up from firstCPU through the CPUs the process may run on, and wrapping
+  // around once there are more loops than those.
+  static void setDefaultBusyPoll(bool busyPoll, int firstCPU = -1);
+
+  // Returns the event loop of the calling thread
   static EventLoop* getCurrentLoop();
 
 private:
@@ -48,11 +168,60 @@ private:
   EventLoop(EventLoop const&& move) = delete;
   EventLoop& operator=(EventLoop const&& move) = delete;
 
-  std::set<Action*> actions_;
-  std::set<Condition*> conditions_;
+  SlotMap<Action> actions_;
+  SlotMap<Condition> conditions_;
   std::vector<std::pair<ConditionType, ConditionManager*>> conditionManagers_;
   std::vector<EventLoopPreparer*> preparers_;
+  size_t iterationCount_ = 0;
+  bool stopped_ = false;
+
+  // Actions that need to be looked at in the next iteration, because one of
+  // their conditions changed or because they just ran. Handles of actions that
+  // get removed in the meantime simply stop resolving.
+  std::vector<ActionHandle> pendingActions_;
+  // What is being invoked in this round, by priority
+  std::array<std::vector<ActionHandle>, kActionPriorities> invokingActions_;
+  std::vector<ActionHandle> deadActions_;
+  // Waiters whose condition fired, to be resumed once whatever fired it is done
+  WaiterList readyWaiters_;
+
+  std::unique_ptr<TaskQueue> tasks_;
+
+  // Where the time goes, reported through the StatsManager
+  std::unique_ptr<LoopStats> stats_;
+  std::map<std::string, std::unique_ptr<ActionStats>> actionStats_;
+  Duration slowActionThreshold_;
+  std::array<Duration, kActionPriorities> priorityBudgets_;
+  Time waitStart_;
+  Time::duration waited_;
+  bool busyPoll_ = false;
+
+  static bool defaultBusyPoll_;
+  // The CPUs busy-polling loops get pinned to, in turns
+  static std::vector<int> busyPollCPUs_;
+  static std::atomic<int> busyPollLoops_;
+
+  ConditionManager* getConditionManager(ConditionType type);
+
+  void unsubscribe(Condition* condition, uint32_t position);
+  void queueAction(Action* action);
+  void killAction(Action* action);
+  void updateEligibility(Action* action);
+  void setInterest(Action* action, bool interested);
+  void addInterest(Condition* condition);
+  void removeInterest(Condition* condition);
+  void purgeDeadActions();
+  // Returns whether any waiter got resumed
+  bool resumeWaiters();
+  // Returns when the last action invoked returned
+  Time invokeActions(Time start);
+  Time invokeActions(std::vector<ActionHandle>& handles, Duration budget,
+                     Time start);
+  void reportSlowAction(ActionStats* stats, Time::duration elapsed);
+
+  Time getWaitDeadline();
 
-  static EventLoop* instance;
+  // Each thread can run its own event loop
+  static thread_local EventLoop* instance;
 };
 }
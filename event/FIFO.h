@@ -1,50 +1,194 @@
 #pragma once
 
+#include <common/MemoryAccount.h>
 #include <event/Condition.h>
 
+#include <stdint.h>
+
+#include <algorithm>
 #include <memory>
-#include <queue>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
 
 namespace event {
 
+// A bounded queue whose conditions tell whether there is room to push into
+// and something to pop from. Elements live in a ring of slots allocated
+// upfront, so pushing and popping never allocate.
+//
+// Besides pushing and popping one element at a time, elements can be moved in
+// and out in batches, produced in place into reserved slots, or consumed in
+// place through peek() and discard(). The conditions are only updated once per
+// batch.
+//
+// The FIFO can also be bounded by the bytes its elements hold, e.g. the
+// buffers of the packets in it, as told by their getFootprint(). Elements
+// without one only count for their slot.
 template <typename T> class FIFO {
 public:
+  // A contiguous run of elements in the FIFO
+  struct Span {
+    T* data;
+    size_t size;
+
+    T* begin() const { return data; }
+    T* end() const { return data + size; }
+  };
+
+  // The capacity gets rounded up to the next power of two.
   FIFO(std::size_t capacity)
-      : capacity_(capacity), queue_(), canPush_(new BaseCondition()),
+      : capacity_(roundUpCapacity(capacity)), slots_(new Slot[capacity_]),
+        footprints_(new size_t[capacity_]), canPush_(new BaseCondition()),
         canPop_(new BaseCondition()) {
     updateConditions();
   }
 
+  ~FIFO() { destroy(size()); }
+
   Condition* canPush() { return canPush_.get(); }
 
   Condition* canPop() { return canPop_.get(); }
 
+  size_t size() const { return tail_ - head_; }
+
+  size_t getCapacity() const { return capacity_; }
+
+  // The bytes held by the elements in the FIFO
+  size_t getBytes() const { return bytes_; }
+
+  // Stops taking more once the elements hold byteLimit bytes, or never with
+  // 0. As with a push, the last element let in can take the FIFO past the
+  // limit. The slots and the bytes held get charged to the given account.
+  void setByteBudget(size_t byteLimit, common::MemoryAccount* account) {
+    if (account_ != nullptr) {
+      account_->release(bytes_);
+    }
+    if (account != nullptr) {
+      account->charge(bytes_);
+    }
+
+    byteLimit_ = byteLimit;
+    account_ = account;
+    slotsCharge_ = common::MemoryCharge(
+        account, capacity_ * (sizeof(Slot) + sizeof(size_t)));
+    updateConditions();
+  }
+
   void push(T&& element) {
-    if (queue_.size() >= capacity_) {
+    if (size() >= capacity_) {
       throw std::runtime_error("Trying to push into a full FIFO.");
     }
 
-    queue_.push(std::move(element));
+    new (at(tail_)) T(std::move(element));
+    charge(tail_);
+    tail_++;
     updateConditions();
   }
 
   T pop() {
-    if (queue_.size() == 0) {
+    if (size() == 0) {
       throw std::runtime_error("Trying to pop from an empty FIFO.");
     }
 
-    T result(std::move(queue_.front()));
-    queue_.pop();
+    T result(std::move(*at(head_)));
+    destroy(1);
     updateConditions();
     return result;
   }
 
-  T const& front() {
-    if (queue_.size() == 0) {
+  T& front() {
+    if (size() == 0) {
       throw std::runtime_error("Trying to call front() on an empty FIFO.");
     }
 
-    return queue_.front();
+    return *at(head_);
+  }
+
+  // Moves elements in from the given range for as long as there is room, and
+  // returns how many were pushed.
+  template <typename Iterator> size_t pushBatch(Iterator first, Iterator last) {
+    size_t pushed = 0;
+    for (; first != last && size() < capacity_ && getByteRoom() > 0;
+         first++, pushed++) {
+      new (at(tail_)) T(std::move(*first));
+      charge(tail_);
+      tail_++;
+    }
+
+    updateConditions();
+    return pushed;
+  }
+
+  // Moves up to count elements out to the given output iterator, and returns
+  // how many were popped.
+  template <typename Iterator> size_t popBatch(Iterator output, size_t count) {
+    count = std::min(count, size());
+    for (size_t i = 0; i < count; i++) {
+      *output++ = std::move(*at(head_));
+      destroy(1);
+    }
+
+    updateConditions();
+    return count;
+  }
+
+  // Returns the elements at the front that are contiguous in memory, which is
+  // all of them unless they wrap around the end of the ring. Those can be
+  // worked on in place, and then be dropped with discard().
+  Span peek() {
+    size_t index = head_ & (capacity_ - 1);
+    return Span{at(head_), std::min(size(), capacity_ - index)};
+  }
+
+  // Drops count elements from the front
+  void discard(size_t count) {
+    if (count > size()) {
+      throw std::runtime_error("Trying to discard more than a FIFO holds.");
+    }
+
+    destroy(count);
+    updateConditions();
+  }
+
+  // How many more bytes the elements can hold before the FIFO stops taking
+  // them, which is unbounded without a byte limit.
+  size_t getByteRoom() const {
+    if (byteLimit_ == 0) {
+      return SIZE_MAX;
+    }
+    return byteLimit_ > bytes_ ? byteLimit_ - bytes_ : 0;
+  }
+
+  // Sets aside up to count of the free slots, and returns how many it got,
+  // which is none once the byte limit is reached. Those get filled with
+  // emplace(), which leaves the conditions alone until commit() is called.
+  size_t reserve(size_t count) {
+    reserved_ = (getByteRoom() > 0 ? std::min(count, capacity_ - size()) : 0);
+    return reserved_;
+  }
+
+  // The reserved slots left, which emplace() gives up on as soon as an
+  // element takes the FIFO to its byte limit, as a push would.
+  size_t getReserved() const { return reserved_; }
+
+  // Constructs an element in place in a reserved slot
+  template <typename... Args> T& emplace(Args&&... args) {
+    if (reserved_ == 0) {
+      throw std::runtime_error("Trying to emplace without a reserved slot.");
+    }
+
+    T* element = new (at(tail_)) T(std::forward<Args>(args)...);
+    charge(tail_);
+    tail_++;
+    reserved_ = (getByteRoom() > 0 ? reserved_ - 1 : 0);
+    return *element;
+  }
+
+  // Gives up on the slots still reserved, and updates the conditions
+  void commit() {
+    reserved_ = 0;
+    updateConditions();
   }
 
 private:
@@ -54,15 +198,71 @@ private:
   FIFO(FIFO&& move) = delete;
   FIFO& operator=(FIFO&& move) = delete;
 
+  using Slot = typename std::aligned_storage<sizeof(T), alignof(T)>::type;
+
   std::size_t capacity_;
-  std::queue<T> queue_;
+  std::unique_ptr<Slot[]> slots_;
+  // What each element held when it went in
+  std::unique_ptr<size_t[]> footprints_;
+  size_t bytes_ = 0;
+  size_t byteLimit_ = 0;
+  common::MemoryAccount* account_ = nullptr;
+  common::MemoryCharge slotsCharge_;
+
+  // Only ever go up, and get wrapped around when indexing into the slots
+  size_t head_ = 0;
+  size_t tail_ = 0;
+  size_t reserved_ = 0;
 
   std::unique_ptr<BaseCondition> canPush_;
   std::unique_ptr<BaseCondition> canPop_;
 
+  static std::size_t roundUpCapacity(std::size_t capacity) {
+    std::size_t result = 1;
+    while (result < capacity) {
+      result <<= 1;
+    }
+    return result;
+  }
+
+  T* at(size_t position) {
+    return reinterpret_cast<T*>(&slots_[position & (capacity_ - 1)]);
+  }
+
+  static size_t getFootprint(T const& element) {
+    if constexpr (requires { element.getFootprint(); }) {
+      return element.getFootprint();
+    } else {
+      return 0;
+    }
+  }
+
+  void charge(size_t position) {
+    size_t footprint = getFootprint(*at(position));
+    footprints_[position & (capacity_ - 1)] = footprint;
+    bytes_ += footprint;
+    if (account_ != nullptr) {
+      account_->charge(footprint);
+    }
+  }
+
+  void destroy(size_t count) {
+    for (size_t i = 0; i < count; i++) {
+      size_t footprint = footprints_[head_ & (capacity_ - 1)];
+      bytes_ -= footprint;
+      if (account_ != nullptr) {
+        account_->release(footprint);
+      }
+
+      at(head_)->~T();
+      head_++;
+    }
+  }
+
   void updateConditions() {
-    canPush_->set(queue_.size() < capacity_);
-    canPop_->set(queue_.size() > 0);
+    canPush_->set(size() < capacity_ &&
+                  (byteLimit_ == 0 || bytes_ < byteLimit_));
+    canPop_->set(size() > 0);
   }
 };
 }
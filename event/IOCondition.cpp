@@ -5,14 +5,19 @@
 #include <errno.h>
 #include <poll.h>
 #include <string.h>
+#include <unistd.h>
 
+#if LINUX
+#include <sys/epoll.h>
+#endif
+
+#include <algorithm>
+#include <climits>
 #include <iostream>
 #include <stdexcept>
 
 namespace event {
 
-static const int kIOPollTimeout = 1;
-
 #if LINUX
 const int kReadPollMask = POLLIN | POLLPRI | POLLRDHUP | POLLHUP;
 #else
@@ -21,12 +26,67 @@ const int kReadPollMask = POLLIN | POLLPRI | POLLHUP;
 
 const int kWritePollMask = POLLOUT;
 
-IOConditionManager::IOConditionManager() : conditions_() {
+#if LINUX
+static const size_t kEpollMaxEvents = 256;
+
+const int kReadEpollMask = EPOLLIN | EPOLLPRI | EPOLLRDHUP | EPOLLHUP;
+const int kWriteEpollMask = EPOLLOUT;
+
+/* static */ IOBackend IOConditionManager::defaultBackend_ = IOBackend::Epoll;
+#else
+/* static */ IOBackend IOConditionManager::defaultBackend_ = IOBackend::Poll;
+#endif
+
+static int getInterestMask(IOType type) {
+  return (type == IOType::Read ? 1 : 2);
+}
+
+// Converts a deadline into a poll()-style timeout in milliseconds. We round up
+// so that we never wake up before the deadline only to find nothing to do.
+static int getTimeoutUntil(Time deadline) {
+  if (deadline == Time::max()) {
+    return -1;
+  }
+
+  Time now = std::chrono::steady_clock::now();
+  if (deadline <= now) {
+    return 0;
+  }
+
+  auto timeout = std::chrono::duration_cast<Duration>(deadline - now);
+  if (now + timeout < deadline) {
+    timeout += Duration(1);
+  }
+
+  return static_cast<int>(std::min<Duration::rep>(timeout.count(), INT_MAX));
+}
+
+IOConditionManager::IOConditionManager()
+    : backend_(defaultBackend_), conditions_() {
+#if LINUX
+  if (backend_ == IOBackend::IOUring) {
+    backend_ = IOBackend::Epoll;
+  }
+
+  if (backend_ == IOBackend::Epoll) {
+    epollFd_ = epoll_create1(EPOLL_CLOEXEC);
+    checkUnixError(epollFd_, "creating the epoll instance");
+  }
+#endif
+
   EventLoop::getCurrentLoop()->addConditionManager(this, ConditionType::IO);
 }
 
+IOConditionManager::~IOConditionManager() {
+#if LINUX
+  if (epollFd_ >= 0) {
+    ::close(epollFd_);
+  }
+#endif
+}
+
 /* static */ IOConditionManager& IOConditionManager::getInstance() {
-  static IOConditionManager instance;
+  static thread_local IOConditionManager instance;
   return instance;
 }
 
@@ -39,33 +99,89 @@ IOConditionManager::IOConditionManager() : conditions_() {
 }
 
 /* static */ void IOConditionManager::close(int fd) {
-  getInstance().removeCondition(fd, IOType::Read);
-  getInstance().removeCondition(fd, IOType::Write);
+  getInstance().removeConditions(fd);
+}
+
+/* static */ void IOConditionManager::setBackend(IOBackend backend) {
+  IOConditionManager::defaultBackend_ = backend;
+}
+
+/* static */ IOBackend IOConditionManager::getBackend() {
+  return IOConditionManager::defaultBackend_;
 }
 
-void IOConditionManager::prepareConditions(
-    std::vector<Condition*> const& conditions,
-    std::vector<Condition*> const& interesting) {
-  // First reset all conditions
-  for (auto condition : conditions) {
-    static_cast<IOCondition*>(condition)->arm();
+void IOConditionManager::addInterest(Condition* condition) {
+  setInterest(static_cast<IOCondition*>(condition), true);
+}
+
+void IOConditionManager::removeInterest(Condition* condition) {
+  setInterest(static_cast<IOCondition*>(condition), false);
+}
+
+void IOConditionManager::prepareConditions(Time deadline) {
+  int timeout = getTimeoutUntil(deadline);
+
+  // Only the conditions fired in the last round can possibly be set, so those
+  // are the only ones we need to reset.
+  for (auto condition : firedConditions_) {
+    condition->arm();
   }
+  firedConditions_.clear();
+
+#if LINUX
+  if (backend_ == IOBackend::Epoll) {
+    epollConditions(timeout);
+    return;
+  }
+#endif
+
+  pollConditions(timeout);
+}
+
+void IOConditionManager::pollConditions(int timeout) {
+  for (auto fd : changedFds_) {
+    FileConditions& entry = conditions_[fd];
+    if (!entry.changed) {
+      continue;
+    }
+    entry.changed = false;
+
+    if (entry.interest != 0 && !entry.polled) {
+      polledFds_.push_back(fd);
+      entry.polled = true;
+    } else if (entry.interest == 0 && entry.polled) {
+      polledFds_.erase(std::find(polledFds_.begin(), polledFds_.end(), fd));
+      entry.polled = false;
+    }
+  }
+  changedFds_.clear();
 
   // Let's poll!
-  struct pollfd polls[interesting.size()];
-  for (size_t i = 0; i < interesting.size(); i++) {
-    IOCondition* condition = static_cast<IOCondition*>(interesting[i]);
-    polls[i].fd = condition->fd;
-    polls[i].events =
-        (condition->type == IOType::Read ? kReadPollMask : kWritePollMask);
+  struct pollfd polls[polledFds_.size()];
+  for (size_t i = 0; i < polledFds_.size(); i++) {
+    int interest = conditions_[polledFds_[i]].interest;
+    polls[i].fd = polledFds_[i];
+    polls[i].events = ((interest & getInterestMask(IOType::Read)) ? kReadPollMask
+                                                                  : 0) |
+                      ((interest & getInterestMask(IOType::Write))
+                           ? kWritePollMask
+                           : 0);
     polls[i].revents = 0;
   }
-  int ret = poll(polls, interesting.size(), kIOPollTimeout);
+  // Polling without a timeout is work rather than waiting
+  auto loop = timeout != 0 ? EventLoop::getCurrentLoop() : nullptr;
+  if (loop != nullptr) {
+    loop->willWait();
+  }
+  int ret = poll(polls, polledFds_.size(), timeout);
+  if (loop != nullptr) {
+    loop->didWait();
+  }
 
   if (ret < 0) {
     if (errno == EINTR) {
-      // We have probably been interrupted by signals set by another condition
-      // type. We should return and give the runloop a chance to proceed.
+      // We have been interrupted by a signal. We should return and give the
+      // runloop a chance to proceed.
       return;
     }
 
@@ -74,37 +190,190 @@ void IOConditionManager::prepareConditions(
   }
 
   // Enable connections according to poll result
-  for (size_t i = 0; i < interesting.size(); i++) {
+  for (size_t i = 0; i < polledFds_.size(); i++) {
     if (polls[i].revents & POLLNVAL) {
       throw std::runtime_error("Invalid file descriptor. Be sure to call "
                                "IOConditionManager::close(fd) before "
                                "close()-ing the file descriptor.");
     }
 
-    IOCondition* condition = static_cast<IOCondition*>(interesting[i]);
-    int mask =
-        (condition->type == IOType::Read ? kReadPollMask : kWritePollMask);
-    if (polls[i].revents & mask) {
-      condition->fire();
+    FileConditions& entry = conditions_[polls[i].fd];
+    if (polls[i].revents & polls[i].events & kReadPollMask) {
+      fire(entry.read.get());
+    }
+    if (polls[i].revents & polls[i].events & kWritePollMask) {
+      fire(entry.write.get());
+    }
+  }
+}
+
+#if LINUX
+void IOConditionManager::epollConditions(int timeout) {
+  // Only talk to the kernel about the fds whose interest actually changed
+  for (auto fd : changedFds_) {
+    FileConditions& entry = conditions_[fd];
+    if (entry.changed) {
+      entry.changed = false;
+      updateInterest(fd, entry);
+    }
+  }
+  changedFds_.clear();
+
+  // Let's wait!
+  struct epoll_event events[kEpollMaxEvents];
+  // Polling without a timeout is work rather than waiting
+  auto loop = timeout != 0 ? EventLoop::getCurrentLoop() : nullptr;
+  if (loop != nullptr) {
+    loop->willWait();
+  }
+  int ret = epoll_wait(epollFd_, events, kEpollMaxEvents, timeout);
+  if (loop != nullptr) {
+    loop->didWait();
+  }
+
+  if (ret < 0) {
+    if (errno == EINTR) {
+      // We have been interrupted by a signal. We should return and give the
+      // runloop a chance to proceed.
+      return;
+    }
+
+    throw std::runtime_error("Error encountered while epoll_wait()-ing: " +
+                             std::string(strerror(errno)));
+  }
+
+  // Fire exactly the conditions epoll reported
+  for (int i = 0; i < ret; i++) {
+    int fd = events[i].data.fd;
+    FileConditions& entry = conditions_[fd];
+
+    if (entry.registeredInterest == 0) {
+      // An fd without interest can still report errors and hang-ups. Nobody is
+      // going to consume those, so we stop watching it until someone cares.
+      epoll_ctl(epollFd_, EPOLL_CTL_DEL, fd, nullptr);
+      entry.registered = false;
+      continue;
+    }
+
+    int errorMask = EPOLLERR | EPOLLHUP;
+    if ((entry.registeredInterest & getInterestMask(IOType::Read)) &&
+        (events[i].events & (kReadEpollMask | errorMask))) {
+      fire(entry.read.get());
+    }
+    if ((entry.registeredInterest & getInterestMask(IOType::Write)) &&
+        (events[i].events & (kWriteEpollMask | errorMask))) {
+      fire(entry.write.get());
     }
   }
 }
 
+void IOConditionManager::updateInterest(int fd, FileConditions& entry) {
+  if (entry.interest == entry.registeredInterest &&
+      (entry.registered || entry.interest == 0)) {
+    return;
+  }
+
+  struct epoll_event event;
+  memset(&event, 0, sizeof(event));
+  event.events =
+      ((entry.interest & getInterestMask(IOType::Read)) ? kReadEpollMask : 0) |
+      ((entry.interest & getInterestMask(IOType::Write)) ? kWriteEpollMask : 0);
+  event.data.fd = fd;
+
+  int ret;
+  if (entry.registered) {
+    ret = epoll_ctl(epollFd_, EPOLL_CTL_MOD, fd, &event);
+    if (ret < 0 && errno == ENOENT) {
+      ret = epoll_ctl(epollFd_, EPOLL_CTL_ADD, fd, &event);
+    }
+  } else {
+    ret = epoll_ctl(epollFd_, EPOLL_CTL_ADD, fd, &event);
+    if (ret < 0 && errno == EEXIST) {
+      ret = epoll_ctl(epollFd_, EPOLL_CTL_MOD, fd, &event);
+    }
+  }
+
+  if (ret < 0 && errno == EBADF) {
+    throw std::runtime_error("Invalid file descriptor. Be sure to call "
+                             "IOConditionManager::close(fd) before "
+                             "close()-ing the file descriptor.");
+  }
+  checkUnixError(ret, "updating epoll interest");
+
+  entry.registered = true;
+  entry.registeredInterest = entry.interest;
+}
+#endif
+
+void IOConditionManager::setInterest(IOCondition* condition, bool interested) {
+  FileConditions& entry = conditions_[condition->fd];
+  if (interested) {
+    entry.interest |= getInterestMask(condition->type);
+  } else {
+    entry.interest &= ~getInterestMask(condition->type);
+  }
+
+  if (!entry.changed) {
+    entry.changed = true;
+    changedFds_.push_back(condition->fd);
+  }
+}
+
+void IOConditionManager::fire(IOCondition* condition) {
+  if (condition != nullptr) {
+    condition->fire();
+    firedConditions_.push_back(condition);
+  }
+}
+
 IOCondition* IOConditionManager::canDo(int fd, IOType type) {
-  auto existing = conditions_.find(std::make_pair(type, fd));
-  if (existing != conditions_.end()) {
-    return existing->second.get();
+  assertTrue(fd >= 0, "Waiting on an invalid file descriptor.");
+  if (size_t(fd) >= conditions_.size()) {
+    conditions_.resize(fd + 1);
   }
 
-  IOCondition* condition = new IOCondition(fd, type);
-  conditions_[std::make_pair(type, fd)].reset(condition);
-  return condition;
+  auto& condition =
+      (type == IOType::Read ? conditions_[fd].read : conditions_[fd].write);
+  if (!condition) {
+    condition.reset(new IOCondition(fd, type));
+  }
+
+  return condition.get();
 }
 
-void IOConditionManager::removeCondition(int fd, IOType type) {
-  auto existing = conditions_.find(std::make_pair(type, fd));
-  if (existing != conditions_.end()) {
-    conditions_.erase(existing);
+void IOConditionManager::removeConditions(int fd) {
+  if (fd < 0 || size_t(fd) >= conditions_.size()) {
+    return;
   }
+
+#if LINUX
+  if (conditions_[fd].registered) {
+    epoll_ctl(epollFd_, EPOLL_CTL_DEL, fd, nullptr);
+  }
+#endif
+
+  if (conditions_[fd].polled) {
+    polledFds_.erase(std::find(polledFds_.begin(), polledFds_.end(), fd));
+  }
+
+  for (auto it = firedConditions_.begin(); it != firedConditions_.end();) {
+    if ((*it)->fd == fd) {
+      it = firedConditions_.erase(it);
+    } else {
+      it++;
+    }
+  }
+
+  // Destroying the conditions can make actions give up their interest in the
+  // other condition of the same fd, so only reset the bookkeeping afterwards.
+  conditions_[fd].read.reset();
+  conditions_[fd].write.reset();
+
+  FileConditions& entry = conditions_[fd];
+  entry.interest = 0;
+  entry.changed = false;
+  entry.polled = false;
+  entry.registered = false;
+  entry.registeredInterest = 0;
 }
 }
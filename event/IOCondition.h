@@ -1,10 +1,11 @@
 #pragma once
 
+#include <common/Util.h>
 #include <event/Condition.h>
 #include <event/EventLoop.h>
 
-#include <map>
 #include <memory>
+#include <vector>
 
 namespace event {
 
@@ -13,6 +14,16 @@ enum IOType {
   Write,
 };
 
+enum IOBackend {
+  Poll,
+#if LINUX
+  Epoll,
+  // Waits for readiness with epoll, and has the data paths that support it do
+  // their IO through io_uring (see IORing).
+  IOUring,
+#endif
+};
+
 class IOCondition : public BaseCondition {
 public:
   IOCondition(int fd, IOType type)
@@ -28,12 +39,18 @@ public:
   static IOCondition* canWrite(int fd);
   static void close(int fd);
 
-  virtual void
-  prepareConditions(std::vector<Condition*> const& conditions,
-                    std::vector<Condition*> const& interesting) override;
+  // Selects the mechanism used to wait for IO readiness. Must be called before
+  // the first EventLoop is created.
+  static void setBackend(IOBackend backend);
+  static IOBackend getBackend();
+
+  virtual void addInterest(Condition* condition) override;
+  virtual void removeInterest(Condition* condition) override;
+  virtual void prepareConditions(Time deadline) override;
 
 private:
   IOConditionManager();
+  ~IOConditionManager();
 
   IOConditionManager(IOConditionManager const& copy) = delete;
   IOConditionManager& operator=(IOConditionManager const& copy) = delete;
@@ -41,11 +58,50 @@ private:
   IOConditionManager(IOConditionManager const&& move) = delete;
   IOConditionManager& operator=(IOConditionManager const&& move) = delete;
 
-  std::map<std::pair<IOType, int>, std::unique_ptr<IOCondition>> conditions_;
+  struct FileConditions {
+    std::unique_ptr<IOCondition> read;
+    std::unique_ptr<IOCondition> write;
+
+    // The IO types someone is interested in for this fd (see getInterestMask),
+    // and whether the fd is queued in changedFds_ for the backend to pick up.
+    int interest = 0;
+    bool changed = false;
+
+    // Used by the poll backend to track whether the fd is in polledFds_
+    bool polled = false;
+
+    // Used by the epoll backend to track the interest currently registered
+    // with the kernel for this fd.
+    bool registered = false;
+    int registeredInterest = 0;
+  };
+
+  static IOBackend defaultBackend_;
+
+  IOBackend backend_;
+  std::vector<FileConditions> conditions_;
+
+  // fds whose interest changed since the last round, and conditions fired in
+  // the last round. Only those need any work in the next round.
+  std::vector<int> changedFds_;
+  std::vector<IOCondition*> firedConditions_;
 
   static IOConditionManager& getInstance();
 
   IOCondition* canDo(int fd, IOType type);
-  void removeCondition(int fd, IOType type);
+  void removeConditions(int fd);
+  void setInterest(IOCondition* condition, bool interested);
+  void fire(IOCondition* condition);
+
+  std::vector<int> polledFds_;
+
+  void pollConditions(int timeout);
+
+#if LINUX
+  int epollFd_ = -1;
+
+  void epollConditions(int timeout);
+  void updateInterest(int fd, FileConditions& entry);
+#endif
 };
 }
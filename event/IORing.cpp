@@ -0,0 +1,447 @@
+#include "event/IORing.h"
+
+#include <event/IOCondition.h>
+
+#include <errno.h>
+#include <poll.h>
+#include <string.h>
+#include <unistd.h>
+
+#if LINUX && __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+#include <algorithm>
+#include <stdexcept>
+
+// Single issuer rings came with Linux 6.0. Older headers build without io_uring
+// support.
+#if defined(IORING_SETUP_SINGLE_ISSUER)
+#define HAS_IO_URING 1
+#endif
+
+namespace event {
+
+#if HAS_IO_URING
+
+static const uint32_t kIORingEntries = 256;
+
+static const uint64_t kIORingInternal = 0;
+
+static int enterRing(int fd, uint32_t toSubmit, uint32_t minComplete,
+                     uint32_t flags) {
+  return syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, nullptr,
+                 0);
+}
+
+template <typename T> static T* at(void* ring, uint32_t offset) {
+  return reinterpret_cast<T*>(static_cast<Byte*>(ring) + offset);
+}
+
+/* static */ IORing* IORing::getCurrentRing() {
+  static thread_local std::unique_ptr<IORing> instance;
+  static thread_local bool initialized = false;
+
+  if (!initialized) {
+    initialized = true;
+
+    if (IOConditionManager::getBackend() == IOBackend::IOUring) {
+      try {
+        instance.reset(new IORing());
+      } catch (std::exception const& ex) {
+        LOG_I("IORing") << "io_uring is unavailable (" << ex.what()
+                        << "), falling back to epoll." << std::endl;
+      }
+    }
+  }
+
+  return instance.get();
+}
+
+IORing::IORing() {
+  struct io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  // The ring is only ever used by the thread of its event loop
+  params.flags = IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_SUBMIT_ALL;
+
+  fd_ = syscall(__NR_io_uring_setup, kIORingEntries, &params);
+  checkUnixError(fd_, "setting up io_uring");
+
+  try {
+    mapRings(params);
+  } catch (...) {
+    unmapRings();
+    ::close(fd_);
+    throw;
+  }
+
+  // Completions are reaped in prepareConditions(). This only makes the IO wait
+  // return when there are some.
+  reaper_.reset(new Action({IOConditionManager::canRead(fd_)}));
+  reaper_->callback.setMethod<IORing, &IORing::reap>(this);
+  reaper_->setName("IORing::reap");
+  reaper_->setPriority(ActionPriority::DataPlane);
+
+  // The ring has no conditions of its own, it just needs to be prepared every
+  // round.
+  EventLoop::getCurrentLoop()->addConditionManager(this,
+                                                   ConditionType::Internal);
+
+  LOG_V("IORing") << "Set up io_uring with " << sqEntries_ << " entries."
+                  << std::endl;
+}
+
+IORing::~IORing() {
+  reaper_.reset();
+  IOConditionManager::close(fd_);
+  unmapRings();
+  ::close(fd_);
+}
+
+void IORing::mapRings(struct io_uring_params const& p) {
+  sqRingSize_ = p.sq_off.array + p.sq_entries * sizeof(uint32_t);
+  cqRingSize_ = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  if (p.features & IORING_FEAT_SINGLE_MMAP) {
+    sqRingSize_ = cqRingSize_ = std::max(sqRingSize_, cqRingSize_);
+  }
+
+  sqRing_ = mmap(nullptr, sqRingSize_, PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQ_RING);
+  if (sqRing_ == MAP_FAILED) {
+    sqRing_ = nullptr;
+    throwUnixError("mapping the io_uring submission queue");
+  }
+
+  if (p.features & IORING_FEAT_SINGLE_MMAP) {
+    cqRing_ = sqRing_;
+  } else {
+    cqRing_ = mmap(nullptr, cqRingSize_, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_CQ_RING);
+    if (cqRing_ == MAP_FAILED) {
+      cqRing_ = nullptr;
+      throwUnixError("mapping the io_uring completion queue");
+    }
+  }
+
+  sqesSize_ = p.sq_entries * sizeof(struct io_uring_sqe);
+  void* sqes = mmap(nullptr, sqesSize_, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQES);
+  if (sqes == MAP_FAILED) {
+    throwUnixError("mapping the io_uring submission entries");
+  }
+  sqes_ = static_cast<struct io_uring_sqe*>(sqes);
+
+  sqHead_ = at<uint32_t>(sqRing_, p.sq_off.head);
+  sqTail_ = at<uint32_t>(sqRing_, p.sq_off.tail);
+  sqFlags_ = at<uint32_t>(sqRing_, p.sq_off.flags);
+  sqMask_ = *at<uint32_t>(sqRing_, p.sq_off.ring_mask);
+  sqEntries_ = p.sq_entries;
+  cqHead_ = at<uint32_t>(cqRing_, p.cq_off.head);
+  cqTail_ = at<uint32_t>(cqRing_, p.cq_off.tail);
+  cqMask_ = *at<uint32_t>(cqRing_, p.cq_off.ring_mask);
+  cqes_ = at<struct io_uring_cqe>(cqRing_, p.cq_off.cqes);
+  sqLocalTail_ = *sqTail_;
+
+  // Submission entries always sit at the same index in the array
+  uint32_t* array = at<uint32_t>(sqRing_, p.sq_off.array);
+  for (uint32_t i = 0; i < sqEntries_; i++) {
+    array[i] = i;
+  }
+}
+
+void IORing::unmapRings() {
+  if (sqes_ != nullptr) {
+    munmap(sqes_, sqesSize_);
+  }
+  if (cqRing_ != nullptr && cqRing_ != sqRing_) {
+    munmap(cqRing_, cqRingSize_);
+  }
+  if (sqRing_ != nullptr) {
+    munmap(sqRing_, sqRingSize_);
+  }
+}
+
+void IORing::read(Operation* operation, int fd, std::unique_ptr<Buffer> buffer,
+                  Byte* data, size_t size) {
+  uint32_t index =
+      addRequest(operation, ReadRequest, fd, std::move(buffer), data, size);
+  submitRead(index);
+}
+
+void IORing::receive(Operation* operation, int fd,
+                     std::unique_ptr<Buffer> buffer, Byte* data, size_t size) {
+  uint32_t index =
+      addRequest(operation, ReceiveRequest, fd, std::move(buffer), data, size);
+  submitReceive(index);
+}
+
+void IORing::send(Operation* operation, int fd, std::unique_ptr<Buffer> buffer,
+                  Byte const* data, size_t size) {
+  uint32_t index = addRequest(operation, SendRequest, fd, std::move(buffer),
+                              const_cast<Byte*>(data), size);
+  submitSend(index);
+}
+
+void IORing::cancel(Operation* operation) {
+  for (uint32_t i = 0; i < requests_.size(); i++) {
+    Request& request = *requests_[i];
+    if (!request.inUse || request.operation != operation) {
+      continue;
+    }
+
+    // The request, and its buffer, are only done with once its completion
+    // comes in. Sends finish quickly enough on their own.
+    request.operation = nullptr;
+    if (request.type != SendRequest) {
+      struct io_uring_sqe* sqe = getSqe(kIORingInternal);
+      sqe->opcode = IORING_OP_ASYNC_CANCEL;
+      sqe->fd = -1;
+      sqe->addr = i + 1;
+      sqe->flags = IOSQE_CQE_SKIP_SUCCESS;
+    }
+  }
+}
+
+/* virtual */ void IORing::prepareConditions(Time deadline) /* override */ {
+  // We never block here, as the IO wait is woken up by completions already.
+  submit();
+  reap();
+}
+
+/* virtual */ Time IORing::getNextDeadline() /* override */ {
+  // Whatever got queued in the last round has to go out before anyone blocks
+  if (queued_ > 0 || *cqHead_ != __atomic_load_n(cqTail_, __ATOMIC_ACQUIRE)) {
+    return Time::min();
+  }
+
+  return Time::max();
+}
+
+uint32_t IORing::addRequest(Operation* operation, RequestType type, int fd,
+                            std::unique_ptr<Buffer> buffer, Byte* data,
+                            size_t size) {
+  uint32_t index;
+  if (!freeRequests_.empty()) {
+    index = freeRequests_.back();
+    freeRequests_.pop_back();
+  } else {
+    index = requests_.size();
+    requests_.emplace_back(new Request());
+  }
+
+  Request& request = *requests_[index];
+  request.operation = operation;
+  request.type = type;
+  request.fd = fd;
+  request.buffer = std::move(buffer);
+  request.data = data;
+  request.size = size;
+  request.inUse = true;
+  return index;
+}
+
+struct io_uring_sqe* IORing::getSqe(uint64_t userData) {
+  if (sqLocalTail_ - __atomic_load_n(sqHead_, __ATOMIC_ACQUIRE) ==
+      sqEntries_) {
+    submit();
+    assertTrue(sqLocalTail_ - __atomic_load_n(sqHead_, __ATOMIC_ACQUIRE) <
+                   sqEntries_,
+               "The io_uring submission queue is stuck.");
+  }
+
+  struct io_uring_sqe* sqe = &sqes_[sqLocalTail_ & sqMask_];
+  memset(sqe, 0, sizeof(*sqe));
+  sqe->user_data = userData;
+
+  sqLocalTail_++;
+  queued_++;
+  return sqe;
+}
+
+void IORing::submitPoll(int fd) {
+  // The poll and the IO linked to it have to go out in the same submission
+  if (sqLocalTail_ - __atomic_load_n(sqHead_, __ATOMIC_ACQUIRE) + 2 >
+      sqEntries_) {
+    submit();
+  }
+
+  struct io_uring_sqe* sqe = getSqe(kIORingInternal);
+  sqe->opcode = IORING_OP_POLL_ADD;
+  sqe->fd = fd;
+  sqe->poll32_events = POLLIN;
+  sqe->flags = IOSQE_IO_LINK | IOSQE_CQE_SKIP_SUCCESS;
+}
+
+void IORing::submitRead(uint32_t index) {
+  Request const& request = *requests_[index];
+
+  struct io_uring_sqe* sqe = getSqe(index + 1);
+  sqe->opcode = IORING_OP_READ;
+  sqe->fd = request.fd;
+  sqe->addr = reinterpret_cast<uint64_t>(request.data);
+  sqe->len = request.size;
+}
+
+void IORing::submitReceive(uint32_t index) {
+  Request& request = *requests_[index];
+
+  request.vector.iov_base = request.data;
+  request.vector.iov_len = request.size;
+  memset(&request.header, 0, sizeof(request.header));
+  request.header.msg_name = &request.source;
+  request.header.msg_namelen = sizeof(request.source);
+  request.header.msg_iov = &request.vector;
+  request.header.msg_iovlen = 1;
+
+  struct io_uring_sqe* sqe = getSqe(index + 1);
+  sqe->opcode = IORING_OP_RECVMSG;
+  sqe->fd = request.fd;
+  sqe->addr = reinterpret_cast<uint64_t>(&request.header);
+  sqe->len = 1;
+}
+
+void IORing::submitSend(uint32_t index) {
+  Request const& request = *requests_[index];
+
+  struct io_uring_sqe* sqe = getSqe(index + 1);
+  sqe->opcode = IORING_OP_SEND;
+  sqe->fd = request.fd;
+  sqe->addr = reinterpret_cast<uint64_t>(request.data);
+  sqe->len = request.size;
+}
+
+void IORing::submit() {
+  if (queued_ == 0) {
+    return;
+  }
+
+  __atomic_store_n(sqTail_, sqLocalTail_, __ATOMIC_RELEASE);
+
+  int ret = enterRing(fd_, queued_, 0, 0);
+  if (ret < 0 && (errno == EINTR || errno == EAGAIN || errno == EBUSY)) {
+    // The kernel is short on resources. Whatever is left gets submitted with
+    // the next round.
+    return;
+  }
+  checkUnixError(ret, "submitting to io_uring");
+
+  queued_ -= ret;
+}
+
+void IORing::reap() {
+  while (true) {
+    uint32_t head = *cqHead_;
+    uint32_t tail = __atomic_load_n(cqTail_, __ATOMIC_ACQUIRE);
+
+    for (; head != tail; head++) {
+      struct io_uring_cqe const& cqe = cqes_[head & cqMask_];
+      uint64_t userData = cqe.user_data;
+      int result = cqe.res;
+
+      // Let the kernel reuse the entry before handling it, as the handler
+      // might well be waiting for more.
+      __atomic_store_n(cqHead_, head + 1, __ATOMIC_RELEASE);
+      handle(userData, result);
+    }
+
+    // Completions that did not fit into the queue wait in the kernel until we
+    // ask for them.
+    if (!(__atomic_load_n(sqFlags_, __ATOMIC_ACQUIRE) &
+          IORING_SQ_CQ_OVERFLOW)) {
+      break;
+    }
+
+    int ret = enterRing(fd_, 0, 0, IORING_ENTER_GETEVENTS);
+    if (ret < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+      throwUnixError("flushing io_uring completions");
+    }
+  }
+}
+
+void IORing::handle(uint64_t userData, int result) {
+  if (userData == kIORingInternal) {
+    if (result < 0 && result != -ENOENT && result != -EALREADY) {
+      LOG_V("IORing") << "Internal operation failed: " << strerror(-result)
+                      << std::endl;
+    }
+    return;
+  }
+
+  uint32_t index = userData - 1;
+  Request& request = *requests_[index];
+
+  if (result == -EAGAIN && request.type != SendRequest &&
+      request.operation != nullptr) {
+    // Older kernels hand O_NONBLOCK reads back to us instead of waiting
+    submitPoll(request.fd);
+    if (request.type == ReadRequest) {
+      submitRead(index);
+    } else {
+      submitReceive(index);
+    }
+    return;
+  }
+
+  Completion completion;
+  completion.type = (request.type == SendRequest ? IOType::Write : IOType::Read);
+  completion.result = result;
+  completion.buffer = std::move(request.buffer);
+  completion.source = nullptr;
+  completion.sourceLength = 0;
+
+  if (request.type == ReceiveRequest && result >= 0) {
+    completion.source = reinterpret_cast<struct sockaddr*>(&request.source);
+    completion.sourceLength = request.header.msg_namelen;
+  }
+
+  // The request only gets reused once the operation is done with the source
+  // of the datagram, while queueing more IO from here leaves it in place.
+  Operation* operation = request.operation;
+  request.operation = nullptr;
+  if (operation != nullptr) {
+    operation->complete(completion);
+  }
+
+  requests_[index]->inUse = false;
+  freeRequests_.push_back(index);
+}
+
+#else
+
+/* static */ IORing* IORing::getCurrentRing() { return nullptr; }
+
+IORing::IORing() { unreachable("io_uring is not supported."); }
+IORing::~IORing() {}
+
+void IORing::mapRings(struct io_uring_params const& params) {}
+void IORing::unmapRings() {}
+
+void IORing::read(Operation* operation, int fd, std::unique_ptr<Buffer> buffer,
+                  Byte* data, size_t size) {
+  unreachable("io_uring is not supported.");
+}
+
+void IORing::receive(Operation* operation, int fd,
+                     std::unique_ptr<Buffer> buffer, Byte* data, size_t size) {
+  unreachable("io_uring is not supported.");
+}
+
+void IORing::send(Operation* operation, int fd, std::unique_ptr<Buffer> buffer,
+                  Byte const* data, size_t size) {
+  unreachable("io_uring is not supported.");
+}
+
+void IORing::cancel(Operation* operation) {
+  unreachable("io_uring is not supported.");
+}
+
+/* virtual */ void IORing::prepareConditions(Time deadline) /* override */ {}
+
+/* virtual */ Time IORing::getNextDeadline() /* override */ {
+  return Time::max();
+}
+
+#endif
+}
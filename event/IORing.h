@@ -0,0 +1,152 @@
+#pragma once
+
+#include <common/Util.h>
+#include <event/Action.h>
+#include <event/EventLoop.h>
+#include <event/IOCondition.h>
+
+#include <stdint.h>
+#include <sys/socket.h>
+
+#include <memory>
+#include <vector>
+
+struct io_uring_params;
+struct io_uring_sqe;
+struct io_uring_cqe;
+
+namespace event {
+
+// Does IO through io_uring on behalf of the data paths that support it, so
+// that a whole loop turn worth of reads, receives and sends costs a single
+// syscall instead of one each. Operations queued while actions run are
+// submitted together before the next IO wait, and completions are delivered
+// while the event loop prepares its conditions.
+//
+// IO happens straight in the buffers of whoever asks for it, e.g. the pooled
+// buffer of a packet, so that nothing gets copied on the way. The ring holds on
+// to each buffer for as long as the kernel might touch it, which can be past
+// cancel(), and hands it back with the completion.
+class IORing : ConditionManager {
+public:
+  // Owns the memory some IO happens in. Freed by the ring if the operation it
+  // was given for got cancelled.
+  class Buffer {
+  public:
+    virtual ~Buffer() {}
+  };
+
+  struct Completion {
+    // Read for reads and receives, Write for sends
+    IOType type;
+    // What the equivalent syscall would have returned, or a negated errno
+    int result;
+    // The buffer given for the IO, with whatever was read or received in it
+    std::unique_ptr<Buffer> buffer;
+    // The source of a received datagram
+    struct sockaddr* source;
+    socklen_t sourceLength;
+  };
+
+  class Operation {
+  public:
+    // Takes the buffer back, or leaves it to be freed
+    virtual void complete(Completion& completion) = 0;
+  };
+
+  // Returns the ring of the current thread, or nullptr if the io_uring backend
+  // is not selected or the kernel does not support it (Linux 6.0 is needed).
+  static IORing* getCurrentRing();
+
+  // Reads up to size bytes from fd into data, which lies within the buffer. A
+  // read that would block is retried once the fd becomes readable.
+  void read(Operation* operation, int fd, std::unique_ptr<Buffer> buffer,
+            Byte* data, size_t size);
+  // Receives a single datagram from fd, just like read().
+  void receive(Operation* operation, int fd, std::unique_ptr<Buffer> buffer,
+               Byte* data, size_t size);
+  // Sends size bytes of data, which lies within the buffer.
+  void send(Operation* operation, int fd, std::unique_ptr<Buffer> buffer,
+            Byte const* data, size_t size);
+  // Gives up on everything outstanding for the given operation, which does not
+  // get completed anymore. Must be called before an operation is destroyed.
+  void cancel(Operation* operation);
+
+  virtual void prepareConditions(Time deadline) override;
+  virtual Time getNextDeadline() override;
+
+  ~IORing();
+
+private:
+  IORing();
+
+  IORing(IORing const& copy) = delete;
+  IORing& operator=(IORing const& copy) = delete;
+
+  IORing(IORing&& move) = delete;
+  IORing& operator=(IORing&& move) = delete;
+
+  int fd_ = -1;
+
+  // Memory shared with the kernel
+  void* sqRing_ = nullptr;
+  size_t sqRingSize_ = 0;
+  void* cqRing_ = nullptr;
+  size_t cqRingSize_ = 0;
+  struct io_uring_sqe* sqes_ = nullptr;
+  size_t sqesSize_ = 0;
+
+  uint32_t* sqHead_;
+  uint32_t* sqTail_;
+  uint32_t* sqFlags_;
+  uint32_t sqMask_;
+  uint32_t sqEntries_;
+  uint32_t* cqHead_;
+  uint32_t* cqTail_;
+  uint32_t cqMask_;
+  struct io_uring_cqe* cqes_;
+
+  // Entries written to the submission queue but not yet handed to the kernel
+  uint32_t sqLocalTail_ = 0;
+  uint32_t queued_ = 0;
+
+  enum RequestType { ReadRequest, ReceiveRequest, SendRequest };
+
+  // Requests stay where they are while the kernel works on them, as it writes
+  // back the source of received datagrams.
+  struct Request {
+    Operation* operation;
+    RequestType type;
+    int fd;
+    std::unique_ptr<Buffer> buffer;
+    Byte* data;
+    size_t size;
+    bool inUse;
+
+    struct msghdr header;
+    struct iovec vector;
+    struct sockaddr_storage source;
+  };
+
+  std::vector<std::unique_ptr<Request>> requests_;
+  std::vector<uint32_t> freeRequests_;
+
+  std::unique_ptr<Action> reaper_;
+
+  void mapRings(struct io_uring_params const& params);
+  void unmapRings();
+
+  uint32_t addRequest(Operation* operation, RequestType type, int fd,
+                      std::unique_ptr<Buffer> buffer, Byte* data, size_t size);
+  struct io_uring_sqe* getSqe(uint64_t userData);
+  // Makes the next entry wait for fd to be readable
+  void submitPoll(int fd);
+  void submitRead(uint32_t index);
+  void submitReceive(uint32_t index);
+  void submitSend(uint32_t index);
+
+  void submit();
+  void reap();
+  void handle(uint64_t userData, int result);
+};
+}
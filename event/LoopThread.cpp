@@ -0,0 +1,46 @@
+#include "event/LoopThread.h"
+
+#include <event/Action.h>
+#include <event/Timer.h>
+#include <stats/StatsManager.h>
+
+#include <chrono>
+#include <future>
+
+namespace event {
+
+using namespace std::chrono_literals;
+
+static const Duration kLoopThreadStatsInterval = 1s;
+
+LoopThread::LoopThread() {
+  // Work can only be posted once the loop exists
+  std::promise<EventLoop*> started;
+  auto loop = started.get_future();
+
+  thread_ = std::thread([started = std::move(started)]() mutable {
+    EventLoop loop;
+
+    Timer statsTimer(kLoopThreadStatsInterval);
+    Action statsPublisher({statsTimer.didFire()});
+    statsPublisher.callback = [&statsTimer]() {
+      stats::StatsManager::publish();
+      statsTimer.extend(kLoopThreadStatsInterval);
+    };
+    statsPublisher.setName("LoopThread::doPublishStats");
+    statsPublisher.setPriority(ActionPriority::Housekeeping);
+
+    started.set_value(&loop);
+    loop.run();
+  });
+
+  loop_ = loop.get();
+}
+
+LoopThread::~LoopThread() {
+  loop_->stop();
+  thread_.join();
+}
+
+EventLoop* LoopThread::getLoop() const { return loop_; }
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <event/EventLoop.h>
+
+#include <thread>
+
+namespace event {
+
+// Runs an event loop on a thread of its own, for as long as this lives. Work
+// gets handed to the loop with post(). The thread publishes its stats
+// periodically, so that they make it into whatever the collecting thread
+// reports.
+class LoopThread {
+public:
+  LoopThread();
+  // Stops the loop once everything posted to it so far ran, and waits for the
+  // thread to be done.
+  ~LoopThread();
+
+  EventLoop* getLoop() const;
+
+private:
+  LoopThread(LoopThread const& copy) = delete;
+  LoopThread& operator=(LoopThread const& copy) = delete;
+
+  LoopThread(LoopThread&& move) = delete;
+  LoopThread& operator=(LoopThread&& move) = delete;
+
+  std::thread thread_;
+  EventLoop* loop_ = nullptr;
+};
+}
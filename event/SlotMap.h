@@ -0,0 +1,109 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+namespace event {
+
+// A registry of pointers addressed by generation-tagged handles. Values are
+// kept densely packed, so iterating over them walks contiguous memory, and a
+// handle is resolved with an array index plus a compare. Handles to erased
+// values never resolve again, even if their slot gets reused.
+template <typename T> class SlotMap {
+public:
+  struct Handle {
+    uint32_t index = 0;
+    // Generation 0 is never handed out, so a default handle is always invalid.
+    uint32_t generation = 0;
+
+    bool operator==(Handle const& other) const {
+      return index == other.index && generation == other.generation;
+    }
+    bool operator!=(Handle const& other) const { return !(*this == other); }
+  };
+
+  SlotMap() {}
+
+  Handle insert(T* value) {
+    uint32_t index;
+    if (freeHead_ != kNoSlot) {
+      index = freeHead_;
+      freeHead_ = slots_[index].position;
+    } else {
+      index = static_cast<uint32_t>(slots_.size());
+      slots_.push_back(Slot{1, 0});
+    }
+
+    slots_[index].position = static_cast<uint32_t>(values_.size());
+    values_.push_back(value);
+    owners_.push_back(index);
+
+    return Handle{index, slots_[index].generation};
+  }
+
+  void erase(Handle handle) {
+    if (get(handle) == nullptr) {
+      return;
+    }
+
+    // Move the last value into the hole to keep the values dense
+    Slot& slot = slots_[handle.index];
+    uint32_t last = owners_.back();
+    values_[slot.position] = values_.back();
+    owners_[slot.position] = last;
+    slots_[last].position = slot.position;
+    values_.pop_back();
+    owners_.pop_back();
+
+    // Invalidate outstanding handles and put the slot up for reuse
+    if (++slot.generation == 0) {
+      slot.generation = 1;
+    }
+    slot.position = freeHead_;
+    freeHead_ = handle.index;
+  }
+
+  T* get(Handle handle) const {
+    if (handle.index >= slots_.size()) {
+      return nullptr;
+    }
+
+    // Erasing bumps the generation of a slot, and a free slot's generation is
+    // never handed out before the slot gets used again.
+    Slot const& slot = slots_[handle.index];
+    if (slot.generation != handle.generation) {
+      return nullptr;
+    }
+
+    return values_[slot.position];
+  }
+
+  bool contains(Handle handle) const { return get(handle) != nullptr; }
+
+  size_t size() const { return values_.size(); }
+
+  typename std::vector<T*>::const_iterator begin() const {
+    return values_.begin();
+  }
+  typename std::vector<T*>::const_iterator end() const { return values_.end(); }
+
+private:
+  SlotMap(SlotMap const& copy) = delete;
+  SlotMap& operator=(SlotMap const& copy) = delete;
+
+  static const uint32_t kNoSlot = UINT32_MAX;
+
+  struct Slot {
+    uint32_t generation;
+    // Index into values_ while in use, next free slot otherwise
+    uint32_t position;
+  };
+
+  std::vector<Slot> slots_;
+  std::vector<T*> values_;
+  std::vector<uint32_t> owners_;
+  uint32_t freeHead_ = kNoSlot;
+};
+}
@@ -0,0 +1,111 @@
+#include "event/TaskQueue.h"
+
+#include <common/Util.h>
+#include <event/IOCondition.h>
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#if LINUX
+#include <sys/eventfd.h>
+#endif
+
+namespace event {
+
+TaskQueue::TaskQueue() {
+#if LINUX
+  readFd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  checkUnixError(readFd_, "creating a task queue eventfd");
+  writeFd_ = readFd_;
+#else
+  int fds[2];
+  checkUnixError(pipe(fds), "creating a task queue pipe");
+  for (int fd : fds) {
+    checkUnixError(fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK),
+                   "setting O_NONBLOCK on a task queue pipe");
+  }
+  readFd_ = fds[0];
+  writeFd_ = fds[1];
+#endif
+
+  runner_.reset(new Action({IOConditionManager::canRead(readFd_)}));
+  runner_->callback.setMethod<TaskQueue, &TaskQueue::doRun>(this);
+  runner_->setName("TaskQueue::doRun");
+}
+
+TaskQueue::~TaskQueue() {
+  runner_.reset();
+  IOConditionManager::close(readFd_);
+  close(readFd_);
+  if (writeFd_ != readFd_) {
+    close(writeFd_);
+  }
+
+  Task* task = head_.exchange(nullptr);
+  while (task != nullptr) {
+    Task* next = task->next;
+    delete task;
+    task = next;
+  }
+}
+
+void TaskQueue::post(Callback<void> callback) {
+  Task* task = new Task{std::move(callback), head_.load()};
+  while (!head_.compare_exchange_weak(task->next, task)) {
+  }
+
+  if (!wakePending_.exchange(true)) {
+    wake();
+  }
+}
+
+void TaskQueue::wake() {
+#if LINUX
+  uint64_t value = 1;
+  int ret = write(writeFd_, &value, sizeof(value));
+#else
+  // A full pipe is just as good a wake-up call
+  Byte value = 0;
+  int ret = write(writeFd_, &value, sizeof(value));
+#endif
+  checkRetryableError(ret, "waking up an event loop");
+}
+
+void TaskQueue::doRun() {
+  // The wake-up has to be consumed before anyone can wake us up again, or we
+  // could swallow the wake-up for a task we are not going to take.
+#if LINUX
+  uint64_t value;
+  int ret = read(readFd_, &value, sizeof(value));
+  checkRetryableError(ret, "draining a task queue eventfd");
+#else
+  Byte buffer[64];
+  while (true) {
+    int ret = read(readFd_, buffer, sizeof(buffer));
+    if (!checkRetryableError(ret, "draining a task queue pipe") ||
+        ret < sizeof(buffer)) {
+      break;
+    }
+  }
+#endif
+  wakePending_.store(false);
+
+  // Tasks posted from here on, including by the tasks themselves, make it
+  // into the next batch.
+  Task* task = head_.exchange(nullptr);
+  Task* batch = nullptr;
+  while (task != nullptr) {
+    Task* next = task->next;
+    task->next = batch;
+    batch = task;
+    task = next;
+  }
+
+  while (batch != nullptr) {
+    std::unique_ptr<Task> current(batch);
+    batch = batch->next;
+    current->callback.invoke();
+  }
+}
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <event/Action.h>
+#include <event/Callback.h>
+
+#include <atomic>
+#include <memory>
+
+namespace event {
+
+// Hands tasks to an event loop from any thread. Tasks run on the loop's thread
+// in the order they were posted, in one batch per loop iteration.
+//
+// Posting is lock-free: tasks get pushed onto an atomic list, and only the
+// first post since the last batch pays for waking the loop up through an
+// eventfd (a pipe on OS X).
+class TaskQueue {
+public:
+  // Must be created on the thread of the loop that runs the tasks
+  TaskQueue();
+  ~TaskQueue();
+
+  // Can be called from any thread
+  void post(Callback<void> callback);
+
+private:
+  TaskQueue(TaskQueue const& copy) = delete;
+  TaskQueue& operator=(TaskQueue const& copy) = delete;
+
+  TaskQueue(TaskQueue&& move) = delete;
+  TaskQueue& operator=(TaskQueue&& move) = delete;
+
+  struct Task {
+    Callback<void> callback;
+    Task* next;
+  };
+
+  // Most recently posted first
+  std::atomic<Task*> head_{nullptr};
+  // Whether the loop has been woken up since it last took the tasks
+  std::atomic<bool> wakePending_{false};
+
+  // The same fd with an eventfd
+  int readFd_ = -1;
+  int writeFd_ = -1;
+  std::unique_ptr<Action> runner_;
+
+  void wake();
+  void doRun();
+};
+}
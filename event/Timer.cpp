@@ -1,12 +1,17 @@
 #include "event/Timer.h"
 
 #include <common/Util.h>
+#include <event/Action.h>
+#include <event/IOCondition.h>
+#include <event/VirtualClock.h>
 
-#include <sys/time.h>
+#if LINUX
+#include <sys/timerfd.h>
+#include <unistd.h>
+#endif
 
 #include <algorithm>
 #include <iostream>
-#include <set>
 #include <stdexcept>
 #include <utility>
 
@@ -17,153 +22,209 @@ using namespace std::chrono_literals;
 class TimerManager : ConditionManager {
 public:
   static TimerManager& getInstance();
-  static void setTimeout(Time target, BaseCondition* condition);
-  static void removeTimeout(BaseCondition* condition);
+  static void setTimeout(Time target, TimerWheel::Entry* entry);
+  static void removeTimeout(TimerWheel::Entry* entry);
+  static void switchClock(Time from, Time to);
 
-  virtual void prepareConditions(std::vector<Condition*> const& conditions,
-                                 std::vector<Condition*> const& interesting);
+  virtual void prepareConditions(Time deadline) override;
+  virtual Time getNextDeadline() override;
 
 private:
   TimerManager();
+  ~TimerManager();
 
-  typedef std::pair<Time, BaseCondition*> TimeoutTrigger;
+  Time origin_;
+  TimerWheel wheel_;
 
-  std::vector<TimeoutTrigger> targets_;
-  std::unique_ptr<Time> currentTarget_;
-  bool currentTargetFired_ = false;
+  TimerWheel::Tick toTick(Time time, bool roundUp) const;
+  Time toTime(TimerWheel::Tick tick) const;
 
-  static void handleSignal(int sig, siginfo_t* si, void* uc);
-
-  void sortTargets();
-  void updateTimer(Time now);
-  void fireUntilTarget();
+#if LINUX
+  // On Linux the wheel is driven by a timerfd that the IO wait watches, so the
+  // event loop wakes up right at our next tick.
+  int timerFd_ = -1;
+  TimerWheel::Tick armedTick_ = TimerWheel::kNever;
+  std::unique_ptr<Action> drainer_;
+
+  void armTimer(TimerWheel::Tick tick);
+  void doDrain();
+#endif
 };
 
+TimerManager::TimerManager()
+    : origin_(Timer::getTime()), wheel_(0) {
 #if LINUX
-const int kTimerManagerSignal = SIGRTMIN;
+  timerFd_ = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  checkUnixError(timerFd_, "creating the timer fd");
+
+  // Expired timers are fired in prepareConditions(). All this action needs to
+  // do is to consume the timerfd's readiness.
+  drainer_.reset(new Action({IOConditionManager::canRead(timerFd_)}));
+  drainer_->callback.setMethod<TimerManager, &TimerManager::doDrain>(this);
+  drainer_->setName("TimerManager::doDrain");
 #endif
 
-TimerManager::TimerManager() {
-  struct sigaction sa;
-  sa.sa_flags = SA_SIGINFO;
-  sa.sa_sigaction = &TimerManager::handleSignal;
-  sigemptyset(&sa.sa_mask);
-
   EventLoop::getCurrentLoop()->addConditionManager(this, Signal);
+}
 
-  // Bind the timer singal handler
-  if (sigaction(SIGALRM, &sa, NULL) < 0) {
-    throw std::runtime_error("Cannot bind timer signal handler.");
-  }
+TimerManager::~TimerManager() {
+#if LINUX
+  drainer_.reset();
+  IOConditionManager::close(timerFd_);
+  close(timerFd_);
+#endif
 }
 
 TimerManager& TimerManager::getInstance() {
-  static TimerManager instance;
+  static thread_local TimerManager instance;
   return instance;
 }
 
 /* virtual */ void
-TimerManager::prepareConditions(std::vector<Condition*> const& conditions,
-                                std::vector<Condition*> const& interesting) {
-  if (!currentTargetFired_) {
-    return;
-  }
+TimerManager::prepareConditions(Time deadline) /* override */ {
+  wheel_.advance(toTick(Timer::getTime(), false));
 
-  Time now = Timer::getTime();
-  Time target = std::max(now, *currentTarget_);
-  while (!targets_.empty() && targets_.back().first <= target) {
-    TimeoutTrigger fired = targets_.back();
-    targets_.pop_back();
-    fired.second->fire();
-  }
-  currentTarget_.reset();
-  currentTargetFired_ = false;
-  updateTimer(now);
+#if LINUX
+  armTimer(wheel_.getNextTick());
+#endif
 }
 
-void TimerManager::sortTargets() {
-  std::sort(targets_.begin(), targets_.end(), std::greater<TimeoutTrigger>());
+/* virtual */ Time TimerManager::getNextDeadline() /* override */ {
+#if LINUX
+  // The timerfd takes care of waking the loop up.
+  return Time::max();
+#else
+  return toTime(wheel_.getNextTick());
+#endif
 }
 
 /* static */ void TimerManager::setTimeout(Time target,
-                                           BaseCondition* condition) {
-  auto existing =
-      std::find_if(getInstance().targets_.begin(), getInstance().targets_.end(),
-                   [condition](TimeoutTrigger const& trigger) {
-                     return trigger.second == condition;
-                   });
-
-  if (existing == getInstance().targets_.end()) {
-    getInstance().targets_.emplace_back(target, condition);
-  } else {
-    existing->first = target;
+                                           TimerWheel::Entry* entry) {
+  auto& instance = getInstance();
+  instance.wheel_.schedule(entry, instance.toTick(target, true));
+
+#if LINUX
+  // Only ever bring the timerfd forward here. Letting it fire early is fine,
+  // as prepareConditions() re-arms it for the real next tick anyway.
+  TimerWheel::Tick next = instance.wheel_.getNextTick();
+  if (next < instance.armedTick_) {
+    instance.armTimer(next);
   }
+#endif
+}
 
-  Time now = Timer::getTime();
-  getInstance().sortTargets();
-  getInstance().updateTimer(now);
+/* static */ void TimerManager::removeTimeout(TimerWheel::Entry* entry) {
+  getInstance().wheel_.cancel(entry);
 }
 
-/* static */ void TimerManager::removeTimeout(BaseCondition* condition) {
-  auto existing =
-      std::find_if(getInstance().targets_.begin(), getInstance().targets_.end(),
-                   [condition](TimeoutTrigger const& trigger) {
-                     return trigger.second == condition;
-                   });
+/* static */ void TimerManager::switchClock(Time from, Time to) {
+  // Moving the origin along with the clock makes the wheel's ticks carry on
+  // from where they were, so that pending timers keep their remaining time.
+  auto& instance = getInstance();
+  instance.origin_ += to - from;
 
-  if (existing != getInstance().targets_.end()) {
-    getInstance().targets_.erase(existing);
-  }
+#if LINUX
+  instance.armTimer(instance.wheel_.getNextTick());
+#endif
 }
 
-Time Timer::getTime() { return std::chrono::steady_clock::now(); }
+TimerWheel::Tick TimerManager::toTick(Time time, bool roundUp) const {
+  if (time <= origin_) {
+    return 0;
+  }
 
-Duration Timer::getEpochTimeInMilliseconds() {
-  return std::chrono::duration_cast<Duration>(getTime().time_since_epoch());
+  auto elapsed = time - origin_;
+  auto ticks = std::chrono::duration_cast<Duration>(elapsed);
+  if (roundUp && ticks < elapsed) {
+    ticks += 1ms;
+  }
+
+  return ticks.count();
 }
 
-void TimerManager::handleSignal(int sig, siginfo_t* si, void* uc) {
-  getInstance().currentTargetFired_ = true;
+Time TimerManager::toTime(TimerWheel::Tick tick) const {
+  if (tick == TimerWheel::kNever) {
+    return Time::max();
+  }
+
+  return origin_ + Duration(tick);
 }
 
-void TimerManager::updateTimer(Time now) {
-  if (targets_.empty()) {
-    return;
+#if LINUX
+void TimerManager::armTimer(TimerWheel::Tick tick) {
+  if (VirtualClock::getCurrentClock() != nullptr) {
+    // The timerfd runs on real time, so it has nothing to say about virtual
+    // time. The wheel gets advanced on every iteration anyway.
+    tick = TimerWheel::kNever;
   }
 
-  if (!!currentTarget_ && targets_.back().first >= *currentTarget_) {
-    // The current timer will still fire before our earliest event.
-    // We don't have to change a thing.
+  if (tick == armedTick_) {
     return;
   }
 
-  Duration timeout =
-      std::max(std::chrono::milliseconds(1),
-               std::chrono::duration_cast<std::chrono::milliseconds>(
-                   targets_.back().first - now));
+  struct itimerspec spec;
+  spec.it_interval.tv_sec = 0;
+  spec.it_interval.tv_nsec = 0;
 
-  struct itimerval its;
-  its.it_value.tv_sec = timeout / 1s;
-  its.it_value.tv_usec =
-      std::chrono::duration_cast<std::chrono::microseconds>(timeout % 1s)
-          .count();
-  its.it_interval.tv_sec = 0;
-  its.it_interval.tv_usec = 0;
+  if (tick == TimerWheel::kNever) {
+    // Disarms the timer
+    spec.it_value.tv_sec = 0;
+    spec.it_value.tv_nsec = 0;
+  } else {
+    auto target = toTime(tick).time_since_epoch();
+    auto seconds = std::chrono::duration_cast<std::chrono::seconds>(target);
+    spec.it_value.tv_sec = seconds.count();
+    spec.it_value.tv_nsec =
+        std::chrono::duration_cast<std::chrono::nanoseconds>(target - seconds)
+            .count();
+
+    if (spec.it_value.tv_sec == 0 && spec.it_value.tv_nsec == 0) {
+      // A zero value would disarm the timer instead.
+      spec.it_value.tv_nsec = 1;
+    }
+  }
 
-  int ret = setitimer(ITIMER_REAL, &its, NULL);
-  assertTrue(ret == 0, "Cannot set timer.");
+  int ret = timerfd_settime(timerFd_, TFD_TIMER_ABSTIME, &spec, NULL);
+  checkUnixError(ret, "arming the timer fd");
 
-  currentTarget_.reset(new Time(now + timeout));
+  armedTick_ = tick;
 }
 
-Timer::Timer() : didFire_(new BaseCondition()) {}
+void TimerManager::doDrain() {
+  uint64_t expirations;
+  int ret = read(timerFd_, &expirations, sizeof(expirations));
+  checkRetryableError(ret, "reading the timer fd");
+}
+#endif
+
+Time Timer::getTime() {
+  VirtualClock* clock = VirtualClock::getCurrentClock();
+  if (clock != nullptr) {
+    return clock->now();
+  }
+
+  return std::chrono::steady_clock::now();
+}
+
+/* static */ void Timer::switchClock(Time from, Time to) {
+  TimerManager::switchClock(from, to);
+}
+
+Duration Timer::getEpochTimeInMilliseconds() {
+  return std::chrono::duration_cast<Duration>(getTime().time_since_epoch());
+}
+
+Timer::Timer() : didFire_(new BaseCondition()) {
+  entry_.condition = didFire_.get();
+}
 
 Timer::Timer(Duration timeout)
     : didFire_(new BaseCondition(ConditionType::Signal)) {
+  entry_.condition = didFire_.get();
   reset(timeout);
 }
 
-Timer::~Timer() { TimerManager::removeTimeout(didFire_.get()); }
+Timer::~Timer() { TimerManager::removeTimeout(&entry_); }
 
 Condition* Timer::didFire() { return didFire_.get(); }
 
@@ -173,12 +234,12 @@ void Timer::reset(Duration timeout) {
   reset();
   Time now = getTime();
   target_ = now + timeout;
-  TimerManager::setTimeout(target_, didFire_.get());
+  TimerManager::setTimeout(target_, &entry_);
 }
 
 void Timer::extend(Duration timeout) {
   reset();
   target_ += timeout;
-  TimerManager::setTimeout(target_, didFire_.get());
+  TimerManager::setTimeout(target_, &entry_);
 }
 }
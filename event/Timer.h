@@ -1,8 +1,8 @@
 #pragma once
 
 #include <event/Condition.h>
+#include <event/TimerWheel.h>
 
-#include <signal.h>
 #include <stdint.h>
 #include <time.h>
 
@@ -12,9 +12,6 @@
 
 namespace event {
 
-using Time = std::chrono::steady_clock::time_point;
-using Duration = std::chrono::milliseconds;
-
 class Timer {
 public:
   Timer();
@@ -31,7 +28,20 @@ public:
   static Duration getEpochTimeInMilliseconds();
 
 private:
+  friend class VirtualClock;
+
+  Timer(Timer const& copy) = delete;
+  Timer& operator=(Timer const& copy) = delete;
+
+  Timer(Timer&& move) = delete;
+  Timer& operator=(Timer&& move) = delete;
+
+  // Keeps timers going where they were when the clock jumps from one time to
+  // another, i.e. when a virtual clock comes or goes.
+  static void switchClock(Time from, Time to);
+
   Time target_;
   std::unique_ptr<BaseCondition> didFire_;
+  TimerWheel::Entry entry_;
 };
 }
@@ -0,0 +1,196 @@
+#include "event/TimerWheel.h"
+
+#include <algorithm>
+
+namespace event {
+
+/* static */ const TimerWheel::Tick TimerWheel::kNever;
+
+TimerWheel::TimerWheel(Tick now /* = 0 */) : current_(now) {
+  for (auto& head : slots_) {
+    head.prev = head.next = &head;
+  }
+
+  for (auto& bitmap : occupied_) {
+    bitmap = 0;
+  }
+}
+
+TimerWheel::~TimerWheel() {
+  // Detach the remaining entries so that their owners don't try to unlink
+  // themselves from a wheel that is gone.
+  for (uint16_t slot = 0; slot <= kTimerWheelDueSlot; slot++) {
+    Entry* head = &slots_[slot];
+    while (head->next != head) {
+      unlink(head->next);
+    }
+  }
+}
+
+void TimerWheel::schedule(Entry* entry, Tick expiry) {
+  if (entry->isScheduled()) {
+    unlink(entry);
+  }
+
+  entry->expiry = expiry;
+  place(entry);
+}
+
+void TimerWheel::cancel(Entry* entry) {
+  if (entry->isScheduled()) {
+    unlink(entry);
+  }
+}
+
+size_t TimerWheel::advance(Tick now) {
+  size_t fired = fireSlot(kTimerWheelDueSlot);
+
+  while (current_ < now) {
+    // Skip straight to the next tick that has anything to do.
+    Tick next = getNextEventTick();
+    if (next > now) {
+      current_ = now;
+      break;
+    }
+
+    current_ = next;
+
+    // Each time a level wraps around, the matching slot of the level above
+    // gets redistributed into the levels below.
+    for (size_t level = 1; level < kTimerWheelLevels; level++) {
+      Tick mask = (Tick(1) << (level * kTimerWheelSlotBits)) - 1;
+      if ((current_ & mask) != 0) {
+        break;
+      }
+
+      cascade(level, (current_ >> (level * kTimerWheelSlotBits)) &
+                         (kTimerWheelSlots - 1));
+    }
+
+    fired += fireSlot(current_ & (kTimerWheelSlots - 1));
+    fired += fireSlot(kTimerWheelDueSlot);
+  }
+
+  return fired;
+}
+
+TimerWheel::Tick TimerWheel::getNextTick() const {
+  if (slots_[kTimerWheelDueSlot].next != &slots_[kTimerWheelDueSlot]) {
+    return current_;
+  }
+
+  return getNextEventTick();
+}
+
+TimerWheel::Tick TimerWheel::getNextEventTick() const {
+  Tick best = kNever;
+
+  for (size_t level = 0; level < kTimerWheelLevels; level++) {
+    if (occupied_[level] == 0) {
+      continue;
+    }
+
+    // Find the first occupied slot after the current one, going around.
+    size_t shift = level * kTimerWheelSlotBits;
+    size_t start = ((current_ >> shift) + 1) & (kTimerWheelSlots - 1);
+    uint64_t rotated = (occupied_[level] >> start) |
+                       (occupied_[level] << ((kTimerWheelSlots - start) &
+                                             (kTimerWheelSlots - 1)));
+    size_t index = (start + __builtin_ctzll(rotated)) & (kTimerWheelSlots - 1);
+
+    // That slot is visited at the first tick after now where the digit of this
+    // level equals the slot index and all lower digits are zero.
+    size_t span = shift + kTimerWheelSlotBits;
+    Tick tick = ((current_ >> span) << span) + (Tick(index) << shift);
+    if (tick <= current_) {
+      tick += Tick(1) << span;
+    }
+
+    best = std::min(best, tick);
+  }
+
+  return best;
+}
+
+void TimerWheel::place(Entry* entry) {
+  if (entry->expiry <= current_) {
+    link(kTimerWheelDueSlot, entry);
+    return;
+  }
+
+  Tick expiry = entry->expiry;
+  Tick delta = expiry - current_;
+
+  size_t level = 0;
+  while (level < kTimerWheelLevels - 1 &&
+         delta >= (Tick(1) << ((level + 1) * kTimerWheelSlotBits))) {
+    level++;
+  }
+
+  // Entries beyond the reach of the top level are parked at its far end, and
+  // get placed again once the wheel gets there.
+  Tick reach = Tick(1) << (kTimerWheelLevels * kTimerWheelSlotBits);
+  if (delta >= reach) {
+    expiry = current_ + reach - 1;
+  }
+
+  size_t index =
+      (expiry >> (level * kTimerWheelSlotBits)) & (kTimerWheelSlots - 1);
+  link(level * kTimerWheelSlots + index, entry);
+}
+
+void TimerWheel::link(uint16_t slot, Entry* entry) {
+  Entry* head = &slots_[slot];
+
+  entry->slot = slot;
+  entry->prev = head->prev;
+  entry->next = head;
+  head->prev->next = entry;
+  head->prev = entry;
+
+  if (slot != kTimerWheelDueSlot) {
+    occupied_[slot / kTimerWheelSlots] |= uint64_t(1)
+                                          << (slot % kTimerWheelSlots);
+  }
+
+  size_++;
+}
+
+void TimerWheel::unlink(Entry* entry) {
+  entry->prev->next = entry->next;
+  entry->next->prev = entry->prev;
+
+  Entry* head = &slots_[entry->slot];
+  if (entry->slot != kTimerWheelDueSlot && head->next == head) {
+    occupied_[entry->slot / kTimerWheelSlots] &=
+        ~(uint64_t(1) << (entry->slot % kTimerWheelSlots));
+  }
+
+  entry->prev = entry->next = nullptr;
+  size_--;
+}
+
+void TimerWheel::cascade(size_t level, size_t index) {
+  Entry* head = &slots_[level * kTimerWheelSlots + index];
+
+  while (head->next != head) {
+    Entry* entry = head->next;
+    unlink(entry);
+    place(entry);
+  }
+}
+
+size_t TimerWheel::fireSlot(uint16_t slot) {
+  Entry* head = &slots_[slot];
+  size_t fired = 0;
+
+  while (head->next != head) {
+    Entry* entry = head->next;
+    unlink(entry);
+    entry->condition->fire();
+    fired++;
+  }
+
+  return fired;
+}
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <event/Condition.h>
+
+#include <stdint.h>
+
+namespace event {
+
+// A hierarchical timing wheel with millisecond ticks. Scheduling, rescheduling
+// and cancelling an entry are all O(1), and expired entries get their
+// condition fired when the wheel is advanced past their expiry.
+//
+// The wheel has kTimerWheelLevels levels of 64 slots each. An entry lives in
+// the lowest level whose span covers its distance from the current tick, and
+// is cascaded down to lower levels as the wheel turns towards its expiry.
+class TimerWheel {
+public:
+  using Tick = uint64_t;
+
+  static const Tick kNever = UINT64_MAX;
+
+  struct Entry {
+  public:
+    Entry() {}
+
+    Tick expiry = 0;
+    BaseCondition* condition = nullptr;
+
+    bool isScheduled() const { return prev != nullptr; }
+
+  private:
+    Entry(Entry const& copy) = delete;
+    Entry& operator=(Entry const& copy) = delete;
+
+    Entry* prev = nullptr;
+    Entry* next = nullptr;
+    uint16_t slot = 0;
+
+    friend class TimerWheel;
+  };
+
+  TimerWheel(Tick now = 0);
+  ~TimerWheel();
+
+  void schedule(Entry* entry, Tick expiry);
+  void cancel(Entry* entry);
+
+  // Moves the wheel forward to the given tick, firing all entries expiring at
+  // or before it. Returns the number of entries fired.
+  size_t advance(Tick now);
+
+  // Returns the earliest tick at which advance() would have work to do, which
+  // is either an expiry or a cascade. Returns kNever if the wheel is empty.
+  Tick getNextTick() const;
+
+  Tick getCurrentTick() const { return current_; }
+  size_t size() const { return size_; }
+
+private:
+  TimerWheel(TimerWheel const& copy) = delete;
+  TimerWheel& operator=(TimerWheel const& copy) = delete;
+
+  TimerWheel(TimerWheel&& move) = delete;
+  TimerWheel& operator=(TimerWheel&& move) = delete;
+
+  static const size_t kTimerWheelLevels = 6;
+  static const size_t kTimerWheelSlotBits = 6;
+  static const size_t kTimerWheelSlots = 1 << kTimerWheelSlotBits;
+  static const uint16_t kTimerWheelDueSlot = kTimerWheelLevels * kTimerWheelSlots;
+
+  // Circular lists with sentinel heads. The extra last slot holds entries that
+  // are already due.
+  Entry slots_[kTimerWheelLevels * kTimerWheelSlots + 1];
+  uint64_t occupied_[kTimerWheelLevels];
+
+  Tick current_;
+  size_t size_ = 0;
+
+  void place(Entry* entry);
+  void link(uint16_t slot, Entry* entry);
+  void unlink(Entry* entry);
+
+  void cascade(size_t level, size_t index);
+  size_t fireSlot(uint16_t slot);
+  Tick getNextEventTick() const;
+};
+}
@@ -2,58 +2,98 @@
 
 #include <common/Util.h>
 
-#include <algorithm>
-
 namespace event {
 
 Trigger::Trigger() { EventLoop::getCurrentLoop()->addPreparer(this); }
 
-/* static */ void Trigger::arm(std::vector<event::Condition*> conditions,
-                               std::function<void(void)> callback) {
+/* static */ void Trigger::arm(std::initializer_list<event::Condition*> conditions,
+                               Callback<void> callback,
+                               ActionPriority priority) {
   auto& instance = Trigger::getInstance();
-  auto action = std::make_unique<Action>(conditions);
-  auto actionPtr = action.get();
-
-  action->callback = [callback, actionPtr, &instance]() {
-    callback();
-    auto it = std::find_if(instance.triggerActions_.begin(),
-                           instance.triggerActions_.end(),
-                           [actionPtr](std::unique_ptr<Action> const& action) {
-                             return action.get() == actionPtr;
-                           });
-    assertTrue(it != instance.triggerActions_.end(),
-               "Cannot find trigger action to remove.");
-    instance.triggerActions_.erase(it);
-  };
-
-  instance.triggerActions_.push_back(std::move(action));
+  Slot* slot = instance.acquire();
+  slot->callback = std::move(callback);
+  instance.attach(slot, conditions, priority);
 }
 
-/* static */ void Trigger::perform(std::function<void(void)> callback) {
-  Trigger::arm({}, [callback]() { callback(); });
+/* static */ void Trigger::perform(Callback<void> callback,
+                                   ActionPriority priority) {
+  Trigger::arm({}, std::move(callback), priority);
 }
 
 /* static */ void Trigger::performIn(event::Duration delay,
-                                     std::function<void(void)> callback) {
-  auto timer = std::make_shared<event::Timer>(delay);
-
-  // We explicitly capture timer by copying here because we need to keep timer
-  // alive as long as the trigger.
-  Trigger::arm({timer->didFire()}, [timer, callback]() { callback(); });
+                                     Callback<void> callback,
+                                     ActionPriority priority) {
+  auto& instance = Trigger::getInstance();
+  Slot* slot = instance.acquire();
+  if (slot->timer == nullptr) {
+    slot->timer.reset(new Timer());
+  }
+  slot->timer->reset(delay);
+  slot->callback = std::move(callback);
+  instance.attach(slot, {slot->timer->didFire()}, priority);
 }
 
 /* virtual */ void Trigger::prepare() /*override */ {
-  for (auto it = triggerActions_.begin(); it != triggerActions_.end();) {
-    if ((*it)->isDead()) {
-      it = triggerActions_.erase(it);
-    } else {
-      it++;
+  auto loop = EventLoop::getCurrentLoop();
+  for (auto handle : loop->getDeadActions()) {
+    if (handle.index >= slotsByAction_.size()) {
+      continue;
+    }
+
+    // The handle could also be that of an action the slot was attached as
+    // before, or of some other action that reused the index since.
+    Slot* slot = slotsByAction_[handle.index];
+    if (slot != nullptr && slot->action.getHandle() == handle) {
+      release(slot);
     }
   }
 }
 
 /* static */ Trigger& Trigger::getInstance() {
-  static Trigger instance;
+  static thread_local Trigger instance;
   return instance;
 }
+
+Trigger::Slot* Trigger::acquire() {
+  if (freeSlots_.empty()) {
+    slots_.emplace_back(new Slot());
+    Slot* slot = slots_.back().get();
+    slot->action.callback.setMethod<Slot, &Slot::fire>(slot);
+    slot->action.setName("Trigger");
+    return slot;
+  }
+
+  Slot* slot = freeSlots_.back();
+  freeSlots_.pop_back();
+  return slot;
+}
+
+void Trigger::attach(Slot* slot,
+                     std::initializer_list<event::Condition*> conditions,
+                     ActionPriority priority) {
+  conditions_.assign(conditions);
+  slot->action.setPriority(priority);
+  slot->action.attach(conditions_);
+
+  auto index = slot->action.getHandle().index;
+  if (index >= slotsByAction_.size()) {
+    slotsByAction_.resize(index + 1, nullptr);
+  }
+  slotsByAction_[index] = slot;
+}
+
+void Trigger::release(Slot* slot) {
+  slotsByAction_[slot->action.getHandle().index] = nullptr;
+  slot->action.detach();
+  slot->callback = Callback<void>();
+  freeSlots_.push_back(slot);
+}
+
+void Trigger::Slot::fire() {
+  // The slot is released before the callback runs, so that the callback can
+  // arm the very same slot again.
+  Callback<void> callback = std::move(this->callback);
+  Trigger::getInstance().release(this);
+  callback.invoke();
+}
 };
@@ -1,28 +1,34 @@
 #pragma once
 
 #include <event/Action.h>
+#include <event/Callback.h>
 #include <event/Condition.h>
 #include <event/Timer.h>
 
-#include <functional>
+#include <initializer_list>
 #include <memory>
 #include <vector>
 
 namespace event {
 
+// One-shot actions that clean up after themselves. Triggers are pooled, so
+// arming, firing and removing one are constant time and, once the pool has
+// grown to the number of triggers outstanding at a time, do not allocate.
 class Trigger : EventLoopPreparer {
 public:
   // Arm a callback to be called when the given conditions fire. The trigger
   // would self-destruct once the conditions fire. It will also self-destruct
-  // if some of the conditions it depends on is already removed from the event
-  // loop.
-  static void arm(std::vector<event::Condition*> conditions,
-                  std::function<void(void)> callback);
+  // if some of the conditions it depends on gets removed from the event loop
+  // before that.
+  static void arm(std::initializer_list<event::Condition*> conditions,
+                  Callback<void> callback,
+                  ActionPriority priority = ActionPriority::Control);
 
-  static void perform(std::function<void(void)> callback);
+  static void perform(Callback<void> callback,
+                      ActionPriority priority = ActionPriority::Control);
 
-  static void performIn(event::Duration delay,
-                        std::function<void(void)> callback);
+  static void performIn(event::Duration delay, Callback<void> callback,
+                        ActionPriority priority = ActionPriority::Control);
 
   virtual void prepare() override;
 
@@ -30,6 +36,25 @@ private:
   Trigger();
   static Trigger& getInstance();
 
-  std::vector<std::unique_ptr<Action>> triggerActions_;
+  struct Slot {
+    Action action;
+    Callback<void> callback;
+    // Created the first time the slot is used by performIn()
+    std::unique_ptr<Timer> timer;
+
+    void fire();
+  };
+
+  std::vector<std::unique_ptr<Slot>> slots_;
+  std::vector<Slot*> freeSlots_;
+  // The slot each armed action belongs to, indexed by its handle's index
+  std::vector<Slot*> slotsByAction_;
+  // Reused to pass conditions on to the actions
+  std::vector<Condition*> conditions_;
+
+  Slot* acquire();
+  void attach(Slot* slot, std::initializer_list<event::Condition*> conditions,
+              ActionPriority priority);
+  void release(Slot* slot);
 };
 }
@@ -0,0 +1,27 @@
+#include "event/VirtualClock.h"
+
+#include <event/Timer.h>
+
+#include <stdexcept>
+
+namespace event {
+
+thread_local VirtualClock* VirtualClock::instance = nullptr;
+
+VirtualClock::VirtualClock() : now_(Timer::getTime()), previous_(instance) {
+  instance = this;
+}
+
+VirtualClock::~VirtualClock() {
+  instance = previous_;
+  Timer::switchClock(now_, Timer::getTime());
+}
+
+void VirtualClock::advance(Duration duration) {
+  if (duration < Duration::zero()) {
+    throw std::logic_error("Trying to move a virtual clock backwards.");
+  }
+
+  now_ += duration;
+}
+}
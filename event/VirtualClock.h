@@ -0,0 +1,37 @@
+#pragma once
+
+#include <event/EventLoop.h>
+
+namespace event {
+
+// Stands in for the steady clock on the current thread for as long as it
+// lives, so that timers can be driven deterministically, e.g. by benchmarks.
+// It starts out at the current time, and only moves when advanced.
+//
+// Time cannot move while the event loop is waiting for IO, so the loop never
+// blocks while a virtual clock is in place. Timers still pending when it goes
+// away carry on with the time they had left on the real clock.
+class VirtualClock {
+public:
+  VirtualClock();
+  ~VirtualClock();
+
+  Time now() const { return now_; }
+  void advance(Duration duration);
+
+  // Returns null unless a virtual clock is in place on this thread
+  static VirtualClock* getCurrentClock() { return instance; }
+
+private:
+  VirtualClock(VirtualClock const& copy) = delete;
+  VirtualClock& operator=(VirtualClock const& copy) = delete;
+
+  VirtualClock(VirtualClock&& move) = delete;
+  VirtualClock& operator=(VirtualClock&& move) = delete;
+
+  static thread_local VirtualClock* instance;
+
+  Time now_;
+  VirtualClock* previous_;
+};
+}
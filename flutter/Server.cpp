@@ -66,6 +66,7 @@ Server::Server(ServerConfig config) {
 
   acceptor_.reset(new event::Action({socket_->canAccept()}));
   acceptor_->callback.setMethod<Server, &Server::doAccept>(this);
+  acceptor_->setName("Server::doAccept");
 
   stats::StatsManager::subscribe([this](auto const& data) {
     for (auto const& session : sessions_) {
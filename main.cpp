@@ -1,20 +1,25 @@
 #include <cxxopts/cxxopts.hpp>
 
 #include <common/Configerator.h>
+#include <common/MemoryAccount.h>
 #include <common/Notebook.h>
 #include <common/Util.h>
 #include <event/EventLoop.h>
+#include <event/IOCondition.h>
 #include <event/Timer.h>
 #include <event/Trigger.h>
 #include <flutter/Server.h>
 #include <networking/IPTables.h>
 #include <networking/InterfaceConfig.h>
+#include <networking/UDPSocket.h>
+#include <stats/GaugeStat.h>
 #include <stats/StatsManager.h>
 #include <stun/Client.h>
 #include <stun/Server.h>
 
 #include <unistd.h>
 
+#include <algorithm>
 #include <iostream>
 #include <memory>
 #include <regex>
@@ -119,6 +124,14 @@ void setupAndParseOptions(int argc, char* argv[]) {
                         "can also give a numeric frequency in "
                         "milliseconds.",
       cxxopts::value<int>()->implicit_value("1000")->default_value("1000"), "");
+  options.add_option("", "", "io-backend",
+                     "Mechanism to do IO with (poll, epoll or io_uring).",
+                     cxxopts::value<std::string>(), "");
+  options.add_option("", "", "busy-poll",
+                     "Spin instead of sleeping while waiting for IO, trading "
+                     "CPU time for latency. You can also give a CPU number to "
+                     "pin event loops to, one CPU each from there on.",
+                     cxxopts::value<int>()->implicit_value("-1"), "");
   options.add_option("", "v", "verbose", "Log more verbosely.",
                      cxxopts::value<bool>(), "");
   options.add_option("", "h", "help", "Print help and usage info.",
@@ -143,6 +156,26 @@ void setupAndParseOptions(int argc, char* argv[]) {
   } else {
     common::Logger::getDefault("").setLoggingThreshold(common::LogLevel::INFO);
   }
+
+  if (options.count("io-backend")) {
+    auto backend = options["io-backend"].as<std::string>();
+    if (backend == "poll") {
+      event::IOConditionManager::setBackend(event::IOBackend::Poll);
+#if LINUX
+    } else if (backend == "epoll") {
+      event::IOConditionManager::setBackend(event::IOBackend::Epoll);
+    } else if (backend == "io_uring") {
+      event::IOConditionManager::setBackend(event::IOBackend::IOUring);
+#endif
+    } else {
+      std::cout << "Unsupported IO backend: " << backend << std::endl;
+      exit(1);
+    }
+  }
+
+  if (options.count("busy-poll")) {
+    event::EventLoop::setDefaultBusyPoll(true, options["busy-poll"].as<int>());
+  }
 }
 
 auto parseSubnets(std::string const& key) {
@@ -180,20 +213,61 @@ std::map<std::string, size_t> parseQuotaTable() {
   return raw;
 }
 
+DataBudget parseDataBudget() {
+  return DataBudget{
+      common::Configerator::get<size_t>("data_budget_packets",
+                                        kDefaultDataBudget.packets),
+      common::Configerator::get<size_t>("data_budget_bytes",
+                                        kDefaultDataBudget.bytes)};
+}
+
+QueueBudget parseQueueBudget() {
+  return QueueBudget{
+      common::Configerator::get<size_t>("data_pipe_queue_bytes",
+                                        kDefaultQueueBudget.dataPipeBytes),
+      common::Configerator::get<size_t>("messenger_queue_bytes",
+                                        kDefaultQueueBudget.messengerBytes)};
+}
+
+size_t parseTunnelQueues() {
+  return std::max(common::Configerator::get<size_t>("tunnel_queues", 1),
+                  size_t(1));
+}
+
+size_t parsePaddingTo() {
+  auto paddingTo = common::Configerator::get<size_t>("padding_to", 0);
+  if (paddingTo > stun::kMaxPaddingTo) {
+    LOG_I("Main") << "padding_to is too large, using " << stun::kMaxPaddingTo
+                  << " instead." << std::endl;
+    return stun::kMaxPaddingTo;
+  }
+  return paddingTo;
+}
+
 void setupServer() {
+  // Past this, sessions drop incoming packets instead of buffering them
+  common::MemoryAccount::getGlobal()->setLimit(
+      common::Configerator::get<size_t>("memory_limit", 0) * 1024 *
+      1024 /* MB -> Bytes */);
+
   auto config =
       ServerConfig{kServerPort,
                    networking::SubnetAddress{
                        common::Configerator::get<std::string>("address_pool")},
                    common::Configerator::get<bool>("encryption", true),
                    common::Configerator::get<std::string>("secret", ""),
-                   common::Configerator::get<size_t>("padding_to", 0),
+                   parsePaddingTo(),
                    common::Configerator::get<bool>("compression", false),
                    std::chrono::seconds(common::Configerator::get<size_t>(
                        "data_pipe_rotate_interval", 0)),
                    common::Configerator::get<bool>("authentication", false),
                    parseQuotaTable(),
-                   parseStaticHosts()};
+                   parseStaticHosts(),
+                   common::Configerator::get<size_t>("worker_threads", 0),
+                   parseDataBudget(),
+                   parseQueueBudget(),
+                   parseTunnelQueues(),
+                   common::Configerator::get<bool>("tunnel_offload", false)};
 
   server = std::make_unique<stun::Server>(config);
 }
@@ -205,12 +279,16 @@ void setupClient() {
       SocketAddress(common::Configerator::getString("server"), kServerPort),
       common::Configerator::get<bool>("encryption", true),
       common::Configerator::get<std::string>("secret", ""),
-      common::Configerator::get<size_t>("padding_to", 0),
+      parsePaddingTo(),
       std::chrono::seconds(
           common::Configerator::get<size_t>("data_pipe_rotate_interval", 0)),
       common::Configerator::get<std::string>("user", ""),
       parseSubnets("forward_subnets"),
-      parseSubnets("excluded_subnets")};
+      parseSubnets("excluded_subnets"),
+      parseDataBudget(),
+      parseQueueBudget(),
+      parseTunnelQueues(),
+      common::Configerator::get<bool>("tunnel_offload", false)};
 
   client.reset(new stun::Client(config));
 }
@@ -263,11 +341,21 @@ int main(int argc, char* argv[]) {
     stats::StatsManager::collect();
     statsTimer->extend(statsDumpInerval);
   };
+  statsDumper->setPriority(event::ActionPriority::Housekeeping);
 
   stats::StatsManager::subscribe([](auto const& data) {
     stats::StatsManager::dump(LOG_V("Stats"), data);
   });
 
+  // What all the sessions buffer, on top of each session's own gauge
+  stats::GaugeStat statMemory("Memory", "buffered_bytes", []() {
+    return common::MemoryAccount::getGlobal()->getBytes();
+  });
+
+  // Data pipes let the kernel move datagrams in bulk where it can
+  networking::UDPSocket::setDefaultOffload(
+      common::Configerator::get<bool>("udp_offload", true));
+
   setupFlutterServer();
 
   std::string role = common::Configerator::getString("role");
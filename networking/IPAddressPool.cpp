@@ -119,6 +119,8 @@ IPAddressPool::IPAddressPool(SubnetAddress const& subnet) : subnet_(subnet) {
 }
 
 IPAddress IPAddressPool::acquire() {
+  std::lock_guard<std::mutex> lock(mutex_);
+
   if (!reusables_.empty()) {
     auto addr = reusables_.front();
     reusables_.pop();
@@ -138,6 +140,8 @@ IPAddress IPAddressPool::acquire() {
 }
 
 void IPAddressPool::release(IPAddress const& addr) {
+  std::lock_guard<std::mutex> lock(mutex_);
+
   auto found = reserved_.find(addr);
   assertTrue(found == reserved_.end(),
              "Reserved address " + addr.toString() +
@@ -147,6 +151,8 @@ void IPAddressPool::release(IPAddress const& addr) {
 }
 
 void IPAddressPool::reserve(IPAddress const& addr) {
+  std::lock_guard<std::mutex> lock(mutex_);
+
   assertTrue(subnet_.contains(addr),
              "Trying to reserve out-of-pool address: " + addr.toString());
 
@@ -6,6 +6,7 @@
 
 #include <array>
 #include <iostream>
+#include <mutex>
 #include <queue>
 #include <set>
 #include <string>
@@ -62,6 +63,7 @@ private:
 void to_json(json& j, SubnetAddress const& addr);
 void from_json(json const& j, SubnetAddress& addr);
 
+// Safe to use from multiple threads
 class IPAddressPool {
 public:
   IPAddressPool(SubnetAddress const& subnet);
@@ -71,6 +73,8 @@ public:
   void reserve(IPAddress const& addr);
 
 private:
+  std::mutex mutex_;
+
   SubnetAddress subnet_;
   IPAddress nextAddr_;
 
@@ -31,6 +31,7 @@ public:
           {{"start", event::Timer::getEpochTimeInMilliseconds().count()}}));
       beatTimer_->extend(kMessengerHeartBeatInterval);
     };
+    beater_->setName("Heartbeater::beat");
 
     // Sets up missed heartbeat disconnection
     event::Trigger::arm({missedTimer_->didFire()}, [this]() {
@@ -80,7 +81,9 @@ public:
         receiver_(new event::Action(
             {socket_->canRead(), messenger->outboundQ->canPush()})) {
     sender_->callback.setMethod<Transporter, &Transporter::doSend>(this);
+    sender_->setName("Transporter::doSend");
     receiver_->callback.setMethod<Transporter, &Transporter::doReceive>(this);
+    receiver_->setName("Transporter::doReceive");
   }
 
   std::vector<std::unique_ptr<crypto::Encryptor>> encryptors_;
@@ -112,7 +115,7 @@ public:
       for (auto decryptor = encryptors_.rbegin();
            decryptor != encryptors_.rend(); decryptor++) {
         payloadLen =
-            (*decryptor)->decrypt(message.data, payloadLen, kMessageSize);
+            (*decryptor)->decrypt(message.data, payloadLen, message.capacity);
       }
       message.size = payloadLen;
 
@@ -212,6 +215,13 @@ void Messenger::addHandler(std::string messageType,
   handlers_[messageType] = handler;
 }
 
+void Messenger::setMemoryAccount(common::MemoryAccount* memory,
+                                 size_t queueBytes) {
+  outboundQ->setByteBudget(queueBytes, memory);
+  receiveBufferMemory_ =
+      common::MemoryCharge(memory, kMessengerReceiveBufferSize);
+}
+
 event::Condition* Messenger::didDisconnect() const {
   return didDisconnect_.get();
 }
@@ -5,6 +5,7 @@
 #include <networking/Packet.h>
 #include <networking/TCPSocket.h>
 
+#include <common/MemoryAccount.h>
 #include <common/Util.h>
 #include <crypto/Encryptor.h>
 #include <event/FIFO.h>
@@ -75,6 +76,9 @@ public:
   void addHandler(std::string messageType,
                   std::function<Message(Message const&)> handler);
   event::Condition* didDisconnect() const;
+  // Charges the outbound queue and the receive buffer to the given account,
+  // and has the queue push back once it holds queueBytes.
+  void setMemoryAccount(common::MemoryAccount* memory, size_t queueBytes);
 
 private:
   Messenger(Messenger const& copy) = delete;
@@ -91,6 +95,7 @@ private:
   std::unique_ptr<Heartbeater> heartbeater_;
 
   std::unique_ptr<event::BaseCondition> didDisconnect_;
+  common::MemoryCharge receiveBufferMemory_;
 
   void disconnect();
 };
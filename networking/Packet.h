@@ -1,43 +1,106 @@
 #pragma once
 
 #include <common/Util.h>
+#include <networking/PacketPool.h>
 
 #include <string.h>
 #include <unistd.h>
 
+#include <stdexcept>
 #include <vector>
 
 namespace networking {
 
+// Packets keep this much room in front of their data, so that headers can be
+// prepended in place.
+static const size_t kPacketHeadroom = 64;
+
+// Packets on the data path all come in one size class, so that a single
+// pooled buffer can carry a packet from the tunnel to the UDP socket and back:
+// an MTU's worth of payload, plus tailroom for whatever the encryptors append.
+static const size_t kDataPathBufferSize = 2048;
+static const size_t kDataPathPacketSize = kDataPathBufferSize - kPacketHeadroom;
+
+// Owns a buffer from the PacketPool, which gets handed back when the packet is
+// destroyed. Filling a packet from another one swaps their buffers.
+//
+// The buffer is laid out as
+//
+//   | headroom | data: size bytes | tailroom |
+//              <-------- capacity --------->
+//
+// where capacity is whatever the size class leaves after the headroom, so it
+// can be more than what the packet was asked to hold.
 struct Packet {
   size_t capacity;
   size_t size;
   Byte* data;
+  // Non-zero for a TCP super-packet of a tunnel with offloads, which gets cut
+  // into segments of this much payload on its way out, see TunnelOffload.h
+  size_t segmentSize = 0;
+
+  Packet(size_t capacity, size_t headroom = kPacketHeadroom) : size(0) {
+    bufferSize_ = PacketPool::getBufferSize(headroom + capacity);
+    buffer_ = PacketPool::acquire(bufferSize_);
+    data = buffer_ + headroom;
+    this->capacity = bufferSize_ - headroom;
+  }
+
+  ~Packet() { PacketPool::release(buffer_, bufferSize_); }
 
-  Packet(size_t capacity) : capacity(capacity), size(0) {
-    data = new Byte[capacity];
+  Packet(Packet&& move)
+      : capacity(move.capacity), size(move.size), data(move.data),
+        segmentSize(move.segmentSize), buffer_(move.buffer_),
+        bufferSize_(move.bufferSize_) {
+    move.data = nullptr;
+    move.buffer_ = nullptr;
   }
 
-  ~Packet() {
-    if (data != nullptr) {
-      delete[] data;
+  // The bytes the packet holds on to, which is its whole buffer
+  size_t getFootprint() const { return buffer_ != nullptr ? bufferSize_ : 0; }
+
+  size_t headroom() const { return data - buffer_; }
+  size_t tailroom() const { return capacity - size; }
+
+  // Grows the data by count bytes at the front, out of the headroom, and
+  // returns where they start.
+  Byte* prepend(size_t count) {
+    if (count > headroom()) {
+      throw std::length_error("Not enough headroom to prepend to a packet.");
     }
+    data -= count;
+    size += count;
+    capacity += count;
+    return data;
   }
 
-  Packet(Packet&& move) : capacity(move.capacity), size(move.size) {
-    data = move.data;
-    move.data = nullptr;
+  // Drops count bytes from the front of the data, into the headroom
+  void strip(size_t count) {
+    if (count > size) {
+      throw std::length_error("Trying to strip more than a packet holds.");
+    }
+    data += count;
+    size -= count;
+    capacity -= count;
   }
 
   void fill(Byte* buffer, size_t size) {
+    if (size > capacity) {
+      throw std::length_error("Packet is too small to be filled.");
+    }
     this->size = size;
+    segmentSize = 0;
     memcpy(data, buffer, size);
+    PacketPool::countCopied(size);
   }
 
   void fill(Packet packet) {
     std::swap(this->size, packet.size);
     std::swap(this->capacity, packet.capacity);
     std::swap(this->data, packet.data);
+    std::swap(this->segmentSize, packet.segmentSize);
+    std::swap(this->buffer_, packet.buffer_);
+    std::swap(this->bufferSize_, packet.bufferSize_);
   }
 
   template <typename T> void pack(T const& obj) {
@@ -53,5 +116,8 @@ struct Packet {
 private:
   Packet(Packet const& copy) = delete;
   Packet& operator=(Packet const& copy) = delete;
+
+  Byte* buffer_;
+  size_t bufferSize_;
 };
 }
@@ -0,0 +1,138 @@
+#include "networking/PacketPool.h"
+
+#include <stats/RateStat.h>
+#include <stats/RatioStat.h>
+
+namespace networking {
+
+// Buffers are rounded up to the next power of two, from 64 bytes to 1 MiB
+static const size_t kSmallestSizeClassBits = 6;
+static const size_t kPacketSizeClasses = 15;
+// How much each free list holds on to, e.g. 4096 buffers of 2 KiB
+static const size_t kMaxPooledBytesPerClass = 8 << 20;
+
+namespace {
+
+struct FreeBuffer {
+  FreeBuffer* next;
+};
+
+struct PacketFreeLists {
+  PacketFreeLists()
+      : acquired("PacketPool", "acquired"),
+        heapAllocs("PacketPool", "heap_allocs"),
+        heapFrees("PacketPool", "heap_frees"),
+        copiesPerByte("PacketPool", "copies_per_byte") {}
+
+  ~PacketFreeLists();
+
+  FreeBuffer* heads[kPacketSizeClasses] = {};
+  size_t counts[kPacketSizeClasses] = {};
+
+  stats::RateStat acquired;
+  // Should stay at zero once the data path reached its steady state
+  stats::RateStat heapAllocs;
+  stats::RateStat heapFrees;
+  stats::RatioStat copiesPerByte;
+};
+
+// Packets can outlive the pool of their thread, e.g. when they are held by
+// other thread locals, in which case they go straight to the heap.
+thread_local bool poolDestroyed = false;
+
+PacketFreeLists::~PacketFreeLists() {
+  for (auto head : heads) {
+    while (head != nullptr) {
+      FreeBuffer* next = head->next;
+      delete[] reinterpret_cast<Byte*>(head);
+      head = next;
+    }
+  }
+  poolDestroyed = true;
+}
+
+PacketFreeLists* getFreeLists() {
+  if (poolDestroyed) {
+    return nullptr;
+  }
+  static thread_local PacketFreeLists freeLists;
+  return &freeLists;
+}
+
+size_t getSizeClass(size_t capacity) {
+  size_t sizeClass = 0;
+  while ((size_t(1) << (sizeClass + kSmallestSizeClassBits)) < capacity) {
+    sizeClass++;
+  }
+  return sizeClass;
+}
+
+size_t getClassSize(size_t sizeClass) {
+  return size_t(1) << (sizeClass + kSmallestSizeClassBits);
+}
+}
+
+/* static */ size_t PacketPool::getBufferSize(size_t capacity) {
+  size_t sizeClass = getSizeClass(capacity);
+  return sizeClass < kPacketSizeClasses ? getClassSize(sizeClass) : capacity;
+}
+
+/* static */ Byte* PacketPool::acquire(size_t capacity) {
+  size_t sizeClass = getSizeClass(capacity);
+  PacketFreeLists* freeLists = getFreeLists();
+  if (freeLists == nullptr || sizeClass >= kPacketSizeClasses) {
+    return new Byte[capacity];
+  }
+
+  freeLists->acquired.accumulate(1);
+  FreeBuffer*& head = freeLists->heads[sizeClass];
+  if (head == nullptr) {
+    freeLists->heapAllocs.accumulate(1);
+    return new Byte[getClassSize(sizeClass)];
+  }
+
+  FreeBuffer* buffer = head;
+  head = buffer->next;
+  freeLists->counts[sizeClass]--;
+  return reinterpret_cast<Byte*>(buffer);
+}
+
+/* static */ void PacketPool::release(Byte* buffer, size_t capacity) {
+  if (buffer == nullptr) {
+    return;
+  }
+
+  size_t sizeClass = getSizeClass(capacity);
+  PacketFreeLists* freeLists = getFreeLists();
+  if (freeLists == nullptr || sizeClass >= kPacketSizeClasses) {
+    delete[] buffer;
+    return;
+  }
+
+  if (freeLists->counts[sizeClass] * getClassSize(sizeClass) >=
+      kMaxPooledBytesPerClass) {
+    freeLists->heapFrees.accumulate(1);
+    delete[] buffer;
+    return;
+  }
+
+  FreeBuffer* freed = reinterpret_cast<FreeBuffer*>(buffer);
+  freed->next = freeLists->heads[sizeClass];
+  freeLists->heads[sizeClass] = freed;
+  freeLists->counts[sizeClass]++;
+}
+
+/* static */ void PacketPool::countCopied(size_t bytes) {
+  PacketFreeLists* freeLists = getFreeLists();
+  if (freeLists != nullptr) {
+    freeLists->copiesPerByte.accumulate(bytes, 0);
+  }
+}
+
+/* static */ void PacketPool::countForwarded(size_t bytes) {
+  PacketFreeLists* freeLists = getFreeLists();
+  if (freeLists != nullptr) {
+    freeLists->copiesPerByte.accumulate(0, bytes);
+  }
+}
+}
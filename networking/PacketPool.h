@@ -0,0 +1,33 @@
+#pragma once
+
+#include <common/Util.h>
+
+#include <unistd.h>
+
+namespace networking {
+
+// Packet buffers come from per-thread free lists, one per power-of-two size
+// class, so that packets flowing through the data path only allocate until
+// the pool has warmed up. Each free list keeps a bounded number of bytes, and
+// buffers beyond that, or larger than the largest class, go back to the heap.
+//
+// How often the heap gets hit shows up under the "PacketPool" stats.
+class PacketPool {
+public:
+  // Rounds the capacity up to its size class, which is how much room a buffer
+  // of that capacity actually has.
+  static size_t getBufferSize(size_t capacity);
+  // Returns a buffer of at least the given capacity
+  static Byte* acquire(size_t capacity);
+  // Takes back a buffer from acquire(), given the same capacity. Buffers go to
+  // the pool of the thread releasing them.
+  static void release(Byte* buffer, size_t capacity);
+
+  // Account for the bytes copied from one buffer to another, and the bytes
+  // forwarded between the tunnel and the data pipes. Their ratio shows as
+  // "PacketPool"/"copies_per_byte", which stays close to zero as long as
+  // packets keep to their buffers all the way through.
+  static void countCopied(size_t bytes);
+  static void countForwarded(size_t bytes);
+};
+}
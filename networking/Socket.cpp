@@ -3,6 +3,7 @@
 #include <common/Util.h>
 #include <event/IOCondition.h>
 
+#include <errno.h>
 #include <fcntl.h>
 #include <signal.h>
 #include <string.h>
@@ -37,6 +38,12 @@ Socket::Socket(SocketType type, int fd, SocketAddress peerAddr)
   setNonblock();
 }
 
+Socket::~Socket() {
+  if (fd_.fd >= 0) {
+    event::IOConditionManager::close(fd_.fd);
+  }
+}
+
 SocketAddress Socket::getPeerAddress() const {
   assertTrue(bound_ || connected_,
              "Calling getPeerAddress() on a unbound and unconnected socket.");
@@ -175,4 +182,15 @@ event::Condition* Socket::canRead() const {
 event::Condition* Socket::canWrite() const {
   return event::IOConditionManager::canWrite(fd_.fd);
 }
+
+void Socket::setBusyPoll(std::chrono::microseconds duration) {
+#if LINUX
+  int value = static_cast<int>(duration.count());
+  int ret = setsockopt(fd_.fd, SOL_SOCKET, SO_BUSY_POLL, &value, sizeof(value));
+  if (ret < 0) {
+    LOG_I("Socket") << "Cannot enable SO_BUSY_POLL: " << strerror(errno)
+                    << std::endl;
+  }
+#endif
+}
 }
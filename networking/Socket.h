@@ -5,6 +5,7 @@
 #include <event/Condition.h>
 #include <networking/SocketAddress.h>
 
+#include <chrono>
 #include <memory>
 
 namespace networking {
@@ -21,6 +22,7 @@ class Socket {
 public:
   Socket(SocketType type);
   Socket(SocketType type, int fd, SocketAddress peerAddr);
+  ~Socket();
 
   Socket(Socket&& move) = default;
   Socket& operator=(Socket&& move) = default;
@@ -34,6 +36,12 @@ public:
   event::Condition* canRead() const;
   event::Condition* canWrite() const;
 
+  // Lets the kernel spin on the device queue for up to the given time when a
+  // read would otherwise come up empty (SO_BUSY_POLL). This is best effort, as
+  // it is Linux only and raising it beyond net.core.busy_read needs
+  // CAP_NET_ADMIN.
+  void setBusyPoll(std::chrono::microseconds duration);
+
 protected:
   SocketType type_;
   common::FileDescriptor fd_;
@@ -42,11 +50,12 @@ protected:
   // TODO: UGLY AS HELL!!
   std::unique_ptr<SocketAddress> peerAddr_;
 
+  void checkSocketException(int ret, int err);
+
 private:
   Socket(Socket const& copy) = delete;
   Socket& operator=(Socket const& copy) = delete;
 
   void setNonblock();
-  void checkSocketException(int ret, int err);
 };
 }
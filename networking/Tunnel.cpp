@@ -2,11 +2,14 @@
 
 #include <common/Util.h>
 #include <event/IOCondition.h>
+#include <event/IORing.h>
+#include <networking/TunnelOffload.h>
 
 #include <fcntl.h>
 #include <string.h>
 #include <sys/ioctl.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
 #if OSX
@@ -19,9 +22,126 @@
 #include <stdio.h>
 #endif
 
+#include <deque>
+
 namespace networking {
 
-Tunnel::Tunnel() {
+static const size_t kTunnelRingReads = 32;
+
+#if LINUX
+// As struct virtio_net_hdr, which <linux/virtio_net.h> does not let C++ have
+struct VirtioNetHeader {
+  uint8_t flags;
+  uint8_t gsoType;
+  uint16_t headerSize;
+  uint16_t gsoSize;
+  uint16_t checksumStart;
+  uint16_t checksumOffset;
+};
+
+static const uint8_t kVirtioNeedsChecksum = 1;
+static const uint8_t kVirtioGSONone = 0;
+static const uint8_t kVirtioGSOTCPv4 = 1;
+static const uint8_t kVirtioGSOTCPv6 = 4;
+static const uint8_t kVirtioGSOECN = 0x80;
+#endif
+
+namespace {
+
+// Lends the buffer of a packet to the ring
+struct RingPacket : public event::IORing::Buffer {
+  RingPacket() {}
+
+  TunnelPacket packet;
+};
+}
+
+// Keeps reads outstanding on the tunnel, straight into the buffers of the
+// packets they bring in. A read is only put back once its packet has been
+// taken, so packets pile up in the tunnel rather than here when nobody takes
+// them.
+class Tunnel::RingReader : public event::IORing::Operation {
+public:
+  RingReader(event::IORing* ring, int fd)
+      : ring_(ring), fd_(fd), canRead_(new event::BaseCondition()) {}
+
+  ~RingReader() { ring_->cancel(this); }
+
+  event::Condition* canRead() {
+    // Reading starts once somebody is interested
+    if (!started_) {
+      started_ = true;
+      for (size_t i = 0; i < kTunnelRingReads; i++) {
+        submitRead();
+      }
+    }
+
+    return canRead_.get();
+  }
+
+  bool read(TunnelPacket& packet) {
+    if (packets_.empty()) {
+      if (error_ != 0) {
+        errno = error_;
+        throwUnixError("reading from the tunnel through io_uring");
+      }
+      if (closed_) {
+        throw TunnelClosedException("File descriptor is closed while reading.");
+      }
+      return false;
+    }
+
+    packet.fill(std::move(packets_.front()));
+    packets_.pop_front();
+    canRead_->set(!packets_.empty() || error_ != 0 || closed_);
+
+    submitRead();
+    return true;
+  }
+
+  virtual void complete(event::IORing::Completion& completion) override {
+    if (completion.result > 0) {
+      auto& packet = static_cast<RingPacket&>(*completion.buffer).packet;
+      assertTrue(size_t(completion.result) < packet.capacity,
+                 "Tunnel packet read buffer is too small.");
+
+      packet.size = completion.result;
+      packets_.push_back(std::move(packet));
+    } else if (completion.result == 0) {
+      closed_ = true;
+    } else if (completion.result != -EINTR) {
+      error_ = -completion.result;
+    } else {
+      submitRead();
+      return;
+    }
+
+    canRead_->fire();
+  }
+
+private:
+  event::IORing* ring_;
+  int fd_;
+  bool started_ = false;
+  bool closed_ = false;
+  int error_ = 0;
+
+  std::deque<TunnelPacket> packets_;
+  std::unique_ptr<event::BaseCondition> canRead_;
+
+  void submitRead() {
+    auto buffer = std::make_unique<RingPacket>();
+    Byte* data = buffer->packet.data;
+    size_t capacity = buffer->packet.capacity;
+    ring_->read(this, fd_, std::move(buffer), data, capacity);
+  }
+};
+
+Tunnel::Tunnel() : Tunnel("", false, false) {}
+
+Tunnel::Tunnel(std::string const& attachTo, bool multiQueue, bool offload) {
+  auto ring = event::IORing::getCurrentRing();
+
 #if OSX
   int fd = socket(PF_SYSTEM, SOCK_DGRAM, SYSPROTO_CONTROL);
   checkUnixError(fd, "opening utun");
@@ -52,21 +172,76 @@ Tunnel::Tunnel() {
 
   struct ifreq ifr;
   memset(&ifr, 0, sizeof(ifr));
-  ifr.ifr_flags = IFF_TUN;
+  // The ring reads into packets of the data path's size
+  offload = (offload && ring == nullptr);
+  ifr.ifr_flags = IFF_TUN | (multiQueue ? IFF_MULTI_QUEUE : 0) |
+                  (offload ? IFF_VNET_HDR : 0);
+  strncpy(ifr.ifr_name, attachTo.c_str(), IFNAMSIZ - 1);
   int ret = ioctl(fd, TUNSETIFF, (void*)&ifr);
   checkUnixError(ret, "doing TUNSETIFF");
 
   deviceName = ifr.ifr_ifrn.ifrn_name;
+
+  if (offload) {
+    // Without these, frames still come with a virtio_net_hdr, just never one
+    // asking for segmentation or a checksum.
+    ret = ioctl(fd, TUNSETOFFLOAD, TUN_F_CSUM | TUN_F_TSO4 | TUN_F_TSO6);
+    if (ret < 0) {
+      LOG_I("Tunnel") << "Cannot turn on offloads: " << strerror(errno)
+                      << std::endl;
+    }
+    offloadBuffer_.reset(new TunnelPacket(kTunnelOffloadBufferSize, 0));
+  }
 #endif
 
   ret = fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK, 0);
   checkUnixError(ret, "setting O_NONBLOCK for Tunnel");
 
   fd_ = common::FileDescriptor{fd};
+
+  if (ring != nullptr) {
+    ringReader_.reset(new RingReader(ring, fd));
+  }
+
   LOG_V("Tunnel") << "Opened successfully as " << deviceName << std::endl;
 }
 
+/* static */ Tunnel Tunnel::open(size_t queues, bool offload) {
+#if LINUX
+  if (queues > 1) {
+    Tunnel tunnel("", true, offload);
+    tunnel.queueCount_ = queues;
+    return tunnel;
+  }
+#endif
+
+  return Tunnel("", false, offload);
+}
+
+/* static */ Tunnel Tunnel::attachQueue(std::string const& deviceName,
+                                        bool offload) {
+  return Tunnel(deviceName, true, offload);
+}
+
+bool Tunnel::hasOffload() const { return !!offloadBuffer_; }
+
+size_t Tunnel::getQueueCount() const { return queueCount_; }
+
+Tunnel::Tunnel(Tunnel&& move) = default;
+
+Tunnel::~Tunnel() {
+  ringReader_.reset();
+
+  if (fd_.fd >= 0) {
+    event::IOConditionManager::close(fd_.fd);
+  }
+}
+
 event::Condition* Tunnel::canRead() const {
+  if (!!ringReader_) {
+    return ringReader_->canRead();
+  }
+
   return event::IOConditionManager::canRead(fd_.fd);
 }
 
@@ -75,6 +250,14 @@ event::Condition* Tunnel::canWrite() const {
 }
 
 bool Tunnel::read(TunnelPacket& packet) {
+  if (!!ringReader_) {
+    return ringReader_->read(packet);
+  }
+
+  if (!!offloadBuffer_) {
+    return readOffloaded(packet);
+  }
+
   size_t read = fd_.atomicRead(packet.data, packet.capacity);
   if (read == 0) {
     return false;
@@ -97,6 +280,10 @@ bool Tunnel::read(TunnelPacket& packet) {
 }
 
 bool Tunnel::write(TunnelPacket packet) {
+  if (!!offloadBuffer_) {
+    return writeOffloaded(std::move(packet));
+  }
+
 #if OSX
   // OSX tunnel has header 0x00 0x00 0x00 0x02, whereas Linux tunnel has header
   // 0x00 0x00 0x08 0x00. Here we do the translation.
@@ -110,4 +297,96 @@ bool Tunnel::write(TunnelPacket packet) {
 
   return fd_.atomicWrite(packet.data, packet.size);
 }
+
+bool Tunnel::readOffloaded(TunnelPacket& packet) {
+#if LINUX
+  // Frames come in as | packet information | virtio_net_hdr | IP packet |.
+  // They get read into the packet, with the virtio_net_hdr in its headroom,
+  // and whatever does not fit spills over into the offload buffer, right where
+  // it would have been had the frame been read there.
+  VirtioNetHeader header;
+  TunnelPacket& overflow = *offloadBuffer_;
+  packet.size = 0;
+  packet.segmentSize = 0;
+  packet.prepend(sizeof(header));
+
+  struct iovec iov[2];
+  iov[0].iov_base = packet.data;
+  iov[0].iov_len = packet.capacity;
+  iov[1].iov_base = overflow.data + packet.capacity;
+  iov[1].iov_len = overflow.capacity - packet.capacity;
+
+  int ret = ::readv(fd_.fd, iov, 2);
+  if (ret == 0) {
+    throw TunnelClosedException("Tunnel is closed while reading.");
+  }
+  if (!checkRetryableError(ret, "reading a tunnel frame")) {
+    packet.size = sizeof(header);
+    packet.strip(sizeof(header));
+    return false;
+  }
+
+  size_t read = ret;
+  assertTrue(read >= kTunnelFrameHeaderSize + sizeof(header),
+             "Tunnel frame is too short for its virtio_net_hdr.");
+
+  // Super-packets go on in the offload buffer, which only takes copying the
+  // front of the frame
+  bool spilled = (read > packet.capacity);
+  TunnelPacket& frame = (spilled ? overflow : packet);
+  if (spilled) {
+    memcpy(overflow.data, packet.data, packet.capacity);
+    PacketPool::countCopied(packet.capacity);
+  }
+  frame.size = read;
+
+  // The packet information takes the place of the virtio_net_hdr
+  memcpy(&header, frame.data + kTunnelFrameHeaderSize, sizeof(header));
+  memmove(frame.data + sizeof(header), frame.data, kTunnelFrameHeaderSize);
+  frame.strip(sizeof(header));
+  frame.segmentSize = 0;
+
+  if ((header.gsoType & ~kVirtioGSOECN) != kVirtioGSONone) {
+    frame.segmentSize = header.gsoSize;
+  } else if ((header.flags & kVirtioNeedsChecksum) != 0) {
+    finishChecksum(frame, header.checksumStart, header.checksumOffset);
+  }
+
+  if (spilled) {
+    packet.fill(std::move(overflow));
+    offloadBuffer_.reset(new TunnelPacket(kTunnelOffloadBufferSize, 0));
+  }
+  return true;
+#else
+  return false;
+#endif
+}
+
+bool Tunnel::writeOffloaded(TunnelPacket packet) {
+#if LINUX
+  VirtioNetHeader header;
+  memset(&header, 0, sizeof(header));
+
+  if (packet.segmentSize != 0) {
+    SegmentationHeader segmentation = getSegmentationHeader(packet);
+    header.flags = kVirtioNeedsChecksum;
+    header.gsoType =
+        (segmentation.isIPv6 ? kVirtioGSOTCPv6 : kVirtioGSOTCPv4);
+    header.headerSize = segmentation.headerSize;
+    header.gsoSize = packet.segmentSize;
+    header.checksumStart = segmentation.checksumStart;
+    header.checksumOffset = segmentation.checksumOffset;
+  }
+
+  // Frames go out as | packet information | virtio_net_hdr | IP packet |, with
+  // the header in the headroom.
+  Byte* frame = packet.prepend(sizeof(header));
+  memmove(frame, frame + sizeof(header), kTunnelFrameHeaderSize);
+  memcpy(frame + kTunnelFrameHeaderSize, &header, sizeof(header));
+
+  return fd_.atomicWrite(packet.data, packet.size);
+#else
+  return false;
+#endif
+}
 }
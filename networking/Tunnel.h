@@ -7,6 +7,7 @@
 
 #include <stdio.h>
 
+#include <memory>
 #include <string>
 
 namespace networking {
@@ -16,17 +17,45 @@ using TunnelClosedException = common::FileDescriptor::ClosedException;
 static const unsigned int kTunnelEthernetMTU = 1444;
 static const int kTunnelBufferSize = 2000;
 
-const size_t kTunnelPacketSize = 2048;
+const size_t kTunnelPacketSize = kDataPathPacketSize;
 
 struct TunnelPacket : public Packet {
 public:
   TunnelPacket() : Packet(kTunnelPacketSize) {}
+  TunnelPacket(size_t capacity, size_t headroom)
+      : Packet(capacity, headroom) {}
+  // Takes over the buffer of a packet further along the data path
+  explicit TunnelPacket(Packet&& packet) : Packet(std::move(packet)) {}
 };
 
+// A tunnel device, or one of its queues. Each queue of a tunnel has a file
+// descriptor of its own, across which the kernel spreads outgoing flows by
+// their hash, so that every queue can be read by somebody else. Packets can be
+// written to any of them.
+//
+// With offloads (IFF_VNET_HDR), the kernel leaves TCP segmentation and
+// checksums to us: reads can return super-packets of up to 64 KiB with a
+// segmentSize, see TunnelOffload.h, and writes can take them. Packets are
+// read straight into the given one, and only those too large for the data
+// path get handed out in a buffer of their own.
 class Tunnel {
 public:
   Tunnel();
-  Tunnel(Tunnel&& move) = default;
+  Tunnel(Tunnel&& move);
+  ~Tunnel();
+
+  // Opens the first queue of a new tunnel meant to have the given number of
+  // queues. On platforms without multi-queue tunnels, there is always just the
+  // one. Offloads are only available on Linux, and not with io_uring.
+  static Tunnel open(size_t queues, bool offload = false);
+
+  // Opens another queue of a tunnel. Like the first one, the queue belongs to
+  // the thread that opens it.
+  static Tunnel attachQueue(std::string const& deviceName, bool offload);
+
+  bool hasOffload() const;
+  // The number of queues the tunnel was opened for, counting this one
+  size_t getQueueCount() const;
 
   std::string deviceName;
 
@@ -40,6 +69,21 @@ private:
   Tunnel(const Tunnel&) = delete;
   Tunnel& operator=(const Tunnel&) = delete;
 
+  // Attaches another queue to the named device if one is given
+  Tunnel(std::string const& attachTo, bool multiQueue, bool offload);
+
   common::FileDescriptor fd_;
+  size_t queueCount_ = 1;
+
+  // Reads through io_uring when it is in use
+  class RingReader;
+  std::unique_ptr<RingReader> ringReader_;
+
+  // Where reads too large for the data path spill over with offloads, as they
+  // can be of any size up to 64 KiB
+  std::unique_ptr<TunnelPacket> offloadBuffer_;
+
+  bool readOffloaded(TunnelPacket& packet);
+  bool writeOffloaded(TunnelPacket packet);
 };
 };
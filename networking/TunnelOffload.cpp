@@ -0,0 +1,355 @@
+#include "networking/TunnelOffload.h"
+
+#include <common/Util.h>
+
+#include <string.h>
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace networking {
+
+static const Byte kIPProtocolTCP = 6;
+static const size_t kIPv4MinHeaderSize = 20;
+static const size_t kIPv6HeaderSize = 40;
+static const size_t kTCPMinHeaderSize = 20;
+static const size_t kTCPChecksumOffset = 16;
+static const size_t kIPMaxPacketSize = 65535;
+
+static const Byte kTCPFlagFIN = 0x01;
+static const Byte kTCPFlagPSH = 0x08;
+static const Byte kTCPFlagACK = 0x10;
+static const Byte kTCPFlagCWR = 0x80;
+
+namespace {
+
+// Where the headers of a TCP frame are
+struct TCPFrame {
+  bool isIPv6;
+  Byte* ip;
+  size_t ipSize;
+  size_t ipHeaderSize;
+  Byte* tcp;
+  size_t tcpHeaderSize;
+  size_t payloadSize;
+};
+
+uint16_t read16(Byte const* data) { return (data[0] << 8) | data[1]; }
+
+void write16(Byte* data, uint16_t value) {
+  data[0] = value >> 8;
+  data[1] = value & 0xff;
+}
+
+uint32_t read32(Byte const* data) {
+  return (uint32_t(read16(data)) << 16) | read16(data + 2);
+}
+
+void write32(Byte* data, uint32_t value) {
+  write16(data, value >> 16);
+  write16(data + 2, value & 0xffff);
+}
+
+uint64_t addToSum(uint64_t sum, Byte const* data, size_t size) {
+  size_t i = 0;
+  for (; i + 1 < size; i += 2) {
+    sum += read16(data + i);
+  }
+  if (i < size) {
+    sum += data[i] << 8;
+  }
+  return sum;
+}
+
+uint16_t fold(uint64_t sum) {
+  while ((sum >> 16) != 0) {
+    sum = (sum & 0xffff) + (sum >> 16);
+  }
+  return sum;
+}
+
+bool parseTCPFrame(Packet const& frame, TCPFrame& result) {
+  if (frame.size < kTunnelFrameHeaderSize + kIPv4MinHeaderSize) {
+    return false;
+  }
+
+  result.ip = frame.data + kTunnelFrameHeaderSize;
+  result.ipSize = frame.size - kTunnelFrameHeaderSize;
+  Byte* ip = result.ip;
+
+  if ((ip[0] >> 4) == 4) {
+    result.isIPv6 = false;
+    result.ipHeaderSize = (ip[0] & 0x0f) * 4;
+    // Fragments are left alone
+    if (result.ipHeaderSize < kIPv4MinHeaderSize ||
+        result.ipSize < result.ipHeaderSize || ip[9] != kIPProtocolTCP ||
+        read16(ip + 2) != result.ipSize || (read16(ip + 6) & 0x3fff) != 0) {
+      return false;
+    }
+  } else if ((ip[0] >> 4) == 6) {
+    result.isIPv6 = true;
+    result.ipHeaderSize = kIPv6HeaderSize;
+    // So are packets with extension headers
+    if (result.ipSize < kIPv6HeaderSize || ip[6] != kIPProtocolTCP ||
+        read16(ip + 4) + kIPv6HeaderSize != result.ipSize) {
+      return false;
+    }
+  } else {
+    return false;
+  }
+
+  if (result.ipSize < result.ipHeaderSize + kTCPMinHeaderSize) {
+    return false;
+  }
+
+  result.tcp = ip + result.ipHeaderSize;
+  result.tcpHeaderSize = (result.tcp[12] >> 4) * 4;
+  if (result.tcpHeaderSize < kTCPMinHeaderSize ||
+      result.ipSize < result.ipHeaderSize + result.tcpHeaderSize) {
+    return false;
+  }
+
+  result.payloadSize =
+      result.ipSize - result.ipHeaderSize - result.tcpHeaderSize;
+  return true;
+}
+
+// The sum over the pseudo header TCP checksums start from
+uint64_t getPseudoHeaderSum(TCPFrame const& frame) {
+  size_t tcpSize = frame.ipSize - frame.ipHeaderSize;
+  uint64_t sum = kIPProtocolTCP + (tcpSize >> 16) + (tcpSize & 0xffff);
+  if (frame.isIPv6) {
+    return addToSum(sum, frame.ip + 8, 32);
+  }
+  return addToSum(sum, frame.ip + 12, 8);
+}
+
+void updateIPHeader(TCPFrame const& frame) {
+  if (frame.isIPv6) {
+    write16(frame.ip + 4, frame.ipSize - kIPv6HeaderSize);
+    return;
+  }
+
+  write16(frame.ip + 2, frame.ipSize);
+  write16(frame.ip + 10, 0);
+  write16(frame.ip + 10, ~fold(addToSum(0, frame.ip, frame.ipHeaderSize)));
+}
+}
+
+void finishChecksum(Packet& frame, size_t start, size_t offset) {
+  Byte* ip = frame.data + kTunnelFrameHeaderSize;
+  size_t ipSize = frame.size - kTunnelFrameHeaderSize;
+  if (start + offset + 2 > ipSize) {
+    throw std::length_error("Checksum lies beyond the end of the packet.");
+  }
+
+  // The checksum field holds the sum over the pseudo header already
+  write16(ip + start + offset, ~fold(addToSum(0, ip + start, ipSize - start)));
+}
+
+size_t countSegments(Packet const& frame) {
+  TCPFrame tcpFrame;
+  if (frame.segmentSize == 0 || !parseTCPFrame(frame, tcpFrame)) {
+    return 0;
+  }
+
+  return std::max<size_t>(
+      1, (tcpFrame.payloadSize + frame.segmentSize - 1) / frame.segmentSize);
+}
+
+void segmentFrame(Packet const& frame, size_t index, Packet& segment) {
+  TCPFrame source;
+  assertTrue(parseTCPFrame(frame, source), "Segmenting a non-TCP packet.");
+
+  size_t headerSize = kTunnelFrameHeaderSize + source.ipHeaderSize +
+                      source.tcpHeaderSize;
+  size_t offset = index * frame.segmentSize;
+  size_t payloadSize = std::min(frame.segmentSize, source.payloadSize - offset);
+  bool isLast = (offset + payloadSize == source.payloadSize);
+
+  if (headerSize + payloadSize > segment.capacity) {
+    throw std::length_error("Packet is too small to hold a segment.");
+  }
+
+  memcpy(segment.data, frame.data, headerSize);
+  memcpy(segment.data + headerSize, frame.data + headerSize + offset,
+         payloadSize);
+  segment.size = headerSize + payloadSize;
+  segment.segmentSize = 0;
+  PacketPool::countCopied(segment.size);
+
+  TCPFrame result = source;
+  result.ip = segment.data + kTunnelFrameHeaderSize;
+  result.ipSize = source.ipHeaderSize + source.tcpHeaderSize + payloadSize;
+  result.tcp = result.ip + source.ipHeaderSize;
+  result.payloadSize = payloadSize;
+
+  // Each segment is a datagram of its own
+  if (!result.isIPv6) {
+    write16(result.ip + 4, read16(result.ip + 4) + index);
+  }
+  updateIPHeader(result);
+
+  write32(result.tcp + 4, read32(result.tcp + 4) + offset);
+  if (!isLast) {
+    result.tcp[13] &= ~(kTCPFlagFIN | kTCPFlagPSH);
+  }
+  if (index != 0) {
+    result.tcp[13] &= ~kTCPFlagCWR;
+  }
+
+  write16(result.tcp + kTCPChecksumOffset, 0);
+  write16(result.tcp + kTCPChecksumOffset,
+          ~fold(addToSum(getPseudoHeaderSum(result), result.tcp,
+                         result.ipSize - result.ipHeaderSize)));
+}
+
+SegmentationHeader getSegmentationHeader(Packet const& frame) {
+  TCPFrame tcpFrame;
+  assertTrue(parseTCPFrame(frame, tcpFrame),
+             "Writing a super-packet that is not TCP.");
+
+  return SegmentationHeader{tcpFrame.isIPv6,
+                            tcpFrame.ipHeaderSize + tcpFrame.tcpHeaderSize,
+                            tcpFrame.ipHeaderSize, kTCPChecksumOffset};
+}
+
+bool TCPCoalescer::add(Packet& frame) {
+  TCPFrame tcpFrame;
+  if (!parseTCPFrame(frame, tcpFrame) || tcpFrame.payloadSize == 0) {
+    return false;
+  }
+
+  Byte flags = tcpFrame.tcp[13];
+  if ((flags & ~(kTCPFlagACK | kTCPFlagPSH)) != 0 ||
+      (flags & kTCPFlagACK) == 0) {
+    return false;
+  }
+  if (!tcpFrame.isIPv6 && (read16(tcpFrame.ip + 6) & 0x4000) == 0) {
+    return false;
+  }
+
+  // The tunnel takes merged segments on trust, so they have to be intact
+  uint64_t sum = addToSum(getPseudoHeaderSum(tcpFrame), tcpFrame.tcp,
+                          tcpFrame.ipSize - tcpFrame.ipHeaderSize);
+  if (fold(sum) != 0xffff) {
+    return false;
+  }
+
+  uint32_t sequence = read32(tcpFrame.tcp + 4);
+
+  if (!held_) {
+    held_.reset(new Packet(std::move(frame)));
+    segmentSize_ = tcpFrame.payloadSize;
+    segmentCount_ = 1;
+    isFinal_ = ((flags & kTCPFlagPSH) != 0);
+    nextSequence_ = sequence + tcpFrame.payloadSize;
+    return true;
+  }
+
+  if (!continues(frame) || sequence != nextSequence_) {
+    return false;
+  }
+
+  // Segments get copied behind the first one, in a buffer large enough
+  if (segmentCount_ == 1) {
+    std::unique_ptr<Packet> superPacket(
+        new Packet(kTunnelOffloadBufferSize - kPacketHeadroom));
+    superPacket->fill(held_->data, held_->size);
+    held_ = std::move(superPacket);
+  }
+
+  Byte* payload = tcpFrame.tcp + tcpFrame.tcpHeaderSize;
+  memcpy(held_->data + held_->size, payload, tcpFrame.payloadSize);
+  held_->size += tcpFrame.payloadSize;
+  PacketPool::countCopied(tcpFrame.payloadSize);
+
+  // Keeps the held headers consistent, for continues() to parse them
+  TCPFrame heldFrame;
+  heldFrame.ip = held_->data + kTunnelFrameHeaderSize;
+  heldFrame.ipSize = held_->size - kTunnelFrameHeaderSize;
+  heldFrame.isIPv6 = tcpFrame.isIPv6;
+  heldFrame.ipHeaderSize = tcpFrame.ipHeaderSize;
+  heldFrame.tcp = heldFrame.ip + heldFrame.ipHeaderSize;
+  updateIPHeader(heldFrame);
+  if ((flags & kTCPFlagPSH) != 0) {
+    heldFrame.tcp[13] |= kTCPFlagPSH;
+  }
+
+  // Only the last segment can be short or pushed
+  isFinal_ = ((flags & kTCPFlagPSH) != 0 || tcpFrame.payloadSize < segmentSize_);
+  segmentCount_++;
+  nextSequence_ += tcpFrame.payloadSize;
+  return true;
+}
+
+bool TCPCoalescer::continues(Packet const& frame) const {
+  TCPFrame held, next;
+  if (isFinal_ || !parseTCPFrame(*held_, held) ||
+      !parseTCPFrame(frame, next)) {
+    return false;
+  }
+
+  // The first frame gets moved to a larger buffer once it is merged with
+  size_t capacity = segmentCount_ == 1
+                        ? kTunnelOffloadBufferSize - kPacketHeadroom
+                        : held_->capacity;
+  if (next.payloadSize > segmentSize_ ||
+      held_->size + next.payloadSize > capacity ||
+      held.ipSize + next.payloadSize > kIPMaxPacketSize) {
+    return false;
+  }
+
+  if (held.isIPv6 != next.isIPv6 || held.ipHeaderSize != next.ipHeaderSize ||
+      held.tcpHeaderSize != next.tcpHeaderSize) {
+    return false;
+  }
+
+  // Same addresses, and the same TOS and TTL, or traffic class, flow label
+  // and hop limit
+  if (held.isIPv6) {
+    if (memcmp(held.ip, next.ip, 4) != 0 || held.ip[7] != next.ip[7] ||
+        memcmp(held.ip + 8, next.ip + 8, 32) != 0) {
+      return false;
+    }
+  } else {
+    if (held.ip[1] != next.ip[1] || held.ip[8] != next.ip[8] ||
+        memcmp(held.ip + 12, next.ip + 12, 8) != 0) {
+      return false;
+    }
+  }
+
+  // Same ports, acknowledgement, flags bar PSH, window and options
+  return memcmp(held.tcp, next.tcp, 4) == 0 &&
+         memcmp(held.tcp + 8, next.tcp + 8, 5) == 0 &&
+         (held.tcp[13] | kTCPFlagPSH) == (next.tcp[13] | kTCPFlagPSH) &&
+         memcmp(held.tcp + 14, next.tcp + 14, 2) == 0 &&
+         memcmp(held.tcp + 18, next.tcp + 18, held.tcpHeaderSize - 18) == 0;
+}
+
+Packet TCPCoalescer::take() {
+  assertTrue(!!held_, "Nothing to take from the TCPCoalescer.");
+
+  Packet result(std::move(*held_));
+  held_.reset();
+
+  if (segmentCount_ > 1) {
+    TCPFrame tcpFrame;
+    tcpFrame.ip = result.data + kTunnelFrameHeaderSize;
+    tcpFrame.ipSize = result.size - kTunnelFrameHeaderSize;
+    tcpFrame.isIPv6 = ((tcpFrame.ip[0] >> 4) == 6);
+    tcpFrame.ipHeaderSize =
+        tcpFrame.isIPv6 ? kIPv6HeaderSize : (tcpFrame.ip[0] & 0x0f) * 4;
+    tcpFrame.tcp = tcpFrame.ip + tcpFrame.ipHeaderSize;
+    updateIPHeader(tcpFrame);
+
+    // Left for the kernel to finish, as it would find it after GRO
+    write16(tcpFrame.tcp + kTCPChecksumOffset,
+            fold(getPseudoHeaderSum(tcpFrame)));
+    result.segmentSize = segmentSize_;
+  }
+
+  segmentCount_ = 0;
+  return result;
+}
+}
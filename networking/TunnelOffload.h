@@ -0,0 +1,67 @@
+#pragma once
+
+#include <networking/Packet.h>
+
+#include <stdint.h>
+#include <unistd.h>
+
+#include <memory>
+
+namespace networking {
+
+// Tunnel frames carry the packet information header in front of the IP packet
+static const size_t kTunnelFrameHeaderSize = 4;
+// Room for the largest super-packet a tunnel with offloads reads or writes
+static const size_t kTunnelOffloadBufferSize = 65536;
+
+// With offloads, the kernel leaves the checksum of a packet to be filled in by
+// whoever sends it on, as the one's complement sum of everything from start,
+// stored at start + offset. Both count from the start of the IP packet.
+void finishChecksum(Packet& frame, size_t start, size_t offset);
+
+// Cuts a TCP super-packet, i.e. a frame with a segmentSize, into frames
+// carrying segmentSize bytes of its payload each, or less for the last one.
+// Each gets headers and checksums of its own. Returns 0 for anything that is
+// not a TCP packet over IPv4 or IPv6.
+size_t countSegments(Packet const& frame);
+void segmentFrame(Packet const& frame, size_t index, Packet& segment);
+
+// What a tunnel with offloads needs to know to take a super-packet written
+// to it, as in struct virtio_net_hdr.
+struct SegmentationHeader {
+  bool isIPv6;
+  size_t headerSize;
+  size_t checksumStart;
+  size_t checksumOffset;
+};
+
+SegmentationHeader getSegmentationHeader(Packet const& frame);
+
+// Merges consecutive segments of a TCP stream, as they come out of the data
+// pipes, back into super-packets, so that the tunnel takes them in one write.
+// Only segments with valid checksums, no flags other than ACK and PSH, and
+// headers that differ in nothing but their sequence numbers get merged.
+class TCPCoalescer {
+public:
+  // Takes the frame if it can start or continue a super-packet, in which case
+  // the frame can be let go of. Otherwise, whatever was merged so far has to
+  // be taken out before trying again.
+  bool add(Packet& frame);
+
+  bool isEmpty() const { return !held_; }
+
+  // Hands out what was merged, which is the frame itself if only one was
+  // added, or a super-packet with a segmentSize.
+  Packet take();
+
+private:
+  std::unique_ptr<Packet> held_;
+  // Payload of every segment but the last
+  size_t segmentSize_ = 0;
+  size_t segmentCount_ = 0;
+  bool isFinal_ = false;
+  uint32_t nextSequence_ = 0;
+
+  bool continues(Packet const& frame) const;
+};
+}
@@ -1,8 +1,251 @@
 #include "networking/UDPSocket.h"
 
+#include <event/Action.h>
+#include <event/IORing.h>
+#include <stats/RateStat.h>
+#include <stats/RatioStat.h>
+
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#include <sys/socket.h>
+
+#include <algorithm>
+#include <deque>
+
 namespace networking {
 
-void UDPSocket::write(UDPPacket packet) {
+static const size_t kUDPRingReceives = 32;
+static const size_t kUDPRingSendWindow = 64;
+
+#if LINUX
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+#ifndef UDP_GRO
+#define UDP_GRO 104
+#endif
+
+// What one UDP_SEGMENT send or UDP_GRO receive carries at most
+static const size_t kUDPMaxOffloadBytes = 65507;
+#endif
+
+namespace {
+
+struct UDPBatchStats {
+  UDPBatchStats()
+      : receive("UDPSocket", "recv_batch"), send("UDPSocket", "send_batch"),
+        groSegments("UDPSocket", "gro_segments"),
+        gsoSegments("UDPSocket", "gso_segments") {}
+
+  stats::RatioStat receive;
+  stats::RatioStat send;
+  stats::RatioStat groSegments;
+  stats::RatioStat gsoSegments;
+};
+
+UDPBatchStats& getBatchStats() {
+  static thread_local UDPBatchStats batchStats;
+  return batchStats;
+}
+
+// Lends the buffer of a packet to the ring
+struct RingPacket : public event::IORing::Buffer {
+  explicit RingPacket(UDPPacket&& packet) : packet(std::move(packet)) {}
+
+  UDPPacket packet;
+};
+}
+
+// Keeps a few receives outstanding on the socket, and queues sends to go out
+// together with the rest of the loop turn's IO. Datagrams are received into and
+// sent from the buffers of their packets. A receive is only put back once its
+// datagram has been read, so datagrams pile up in the socket rather than here
+// when nobody reads them, and get dropped there once its buffer is full.
+class UDPSocket::RingChannel : public event::IORing::Operation {
+public:
+  RingChannel(event::IORing* ring, int fd)
+      : ring_(ring), fd_(fd), canRead_(new event::BaseCondition()),
+        canWrite_(new event::BaseCondition()) {
+    canWrite_->fire();
+  }
+
+  ~RingChannel() { ring_->cancel(this); }
+
+  // The source of the first datagram received
+  std::unique_ptr<SocketAddress> firstSource;
+
+  event::Condition* canRead() {
+    // Receiving starts once somebody is interested, by which time the socket
+    // is bound or connected.
+    if (!receiving_) {
+      receiving_ = true;
+      for (size_t i = 0; i < kUDPRingReceives; i++) {
+        receive();
+      }
+    }
+
+    return canRead_.get();
+  }
+
+  event::Condition* canWrite() { return canWrite_.get(); }
+
+  int takeError() {
+    int error = error_;
+    error_ = 0;
+    return error;
+  }
+
+  bool read(UDPPacket& packet) {
+    if (packets_.empty()) {
+      return false;
+    }
+
+    packet.fill(std::move(packets_.front()));
+    packets_.pop_front();
+    canRead_->set(!packets_.empty());
+
+    receive();
+    return true;
+  }
+
+  void send(UDPPacket&& packet) {
+    Byte* data = packet.data;
+    size_t size = packet.size;
+    ring_->send(this, fd_, std::make_unique<RingPacket>(std::move(packet)),
+                data, size);
+    sending_++;
+    canWrite_->set(sending_ < kUDPRingSendWindow);
+  }
+
+  // Every receive holds on to a packet, whether its datagram came in or not
+  size_t getFootprint() const {
+    return receiving_ ? kUDPRingReceives *
+                            PacketPool::getBufferSize(kPacketHeadroom +
+                                                      kUDPPacketSize)
+                      : 0;
+  }
+
+  virtual void complete(event::IORing::Completion& completion) override {
+    if (completion.type == event::IOType::Write) {
+      sending_--;
+      canWrite_->set(sending_ < kUDPRingSendWindow);
+    } else if (completion.result >= 0) {
+      if (!firstSource && completion.source != nullptr) {
+        firstSource.reset(new SocketAddress());
+        memcpy(firstSource->asSocketAddress(), completion.source,
+               completion.sourceLength);
+      }
+
+      auto& packet = static_cast<RingPacket&>(*completion.buffer).packet;
+      assertTrue(size_t(completion.result) < packet.capacity,
+                 "UDPPacket size too small.");
+      packet.size = completion.result;
+      packets_.push_back(std::move(packet));
+      canRead_->fire();
+      return;
+    } else if (completion.result == -EINTR) {
+      receive();
+      return;
+    }
+
+    // Errors are reported with the next read or write, just like the socket
+    // would do. The socket gets closed then, so failed receives are not put
+    // back.
+    if (completion.result < 0 && completion.result != -EINTR) {
+      if (error_ == 0) {
+        error_ = -completion.result;
+      }
+      canRead_->fire();
+    }
+  }
+
+private:
+  event::IORing* ring_;
+  int fd_;
+  bool receiving_ = false;
+  size_t sending_ = 0;
+  int error_ = 0;
+
+  std::deque<UDPPacket> packets_;
+  std::unique_ptr<event::BaseCondition> canRead_;
+  std::unique_ptr<event::BaseCondition> canWrite_;
+
+  void receive() {
+    auto buffer = std::make_unique<RingPacket>(UDPPacket());
+    Byte* data = buffer->packet.data;
+    size_t capacity = buffer->packet.capacity;
+    ring_->receive(this, fd_, std::move(buffer), data, capacity);
+  }
+};
+
+// Coalesced datagrams land in a buffer of their own, from which they are read
+// a few at a time. Whatever is left in there does not show on the socket, so
+// readers wait on canRead() instead, which holds until a read finds both the
+// buffer and the socket empty. Only then does the socket itself get watched
+// again.
+class UDPSocket::GROChannel {
+public:
+  GROChannel(event::Condition* socketCanRead, size_t bufferSize)
+      : buffer(bufferSize, 0), canRead_(new event::BaseCondition()),
+        isDrained_(new event::BaseCondition()) {
+    isDrained_->fire();
+
+    watcher_.reset(new event::Action({socketCanRead, isDrained_.get()}));
+    watcher_->callback.setMethod<GROChannel, &GROChannel::doWatch>(this);
+    watcher_->setName("UDPSocket::GROChannel::doWatch");
+    watcher_->setPriority(event::ActionPriority::DataPlane);
+  }
+
+  Packet buffer;
+  // The unread datagrams are at [offset, size) of the buffer
+  size_t offset = 0;
+  size_t segmentSize = 0;
+
+  bool isEmpty() const { return offset >= buffer.size; }
+
+  event::Condition* canRead() { return canRead_.get(); }
+
+  void setDrained(bool drained) {
+    canRead_->set(!drained);
+    isDrained_->set(drained);
+  }
+
+private:
+  std::unique_ptr<event::BaseCondition> canRead_;
+  std::unique_ptr<event::BaseCondition> isDrained_;
+  std::unique_ptr<event::Action> watcher_;
+
+  void doWatch() { setDrained(false); }
+};
+
+/* static */ bool UDPSocket::defaultOffload_ = false;
+
+UDPSocket::UDPSocket() : UDPSocket(Socket(UDP)) {}
+
+UDPSocket::UDPSocket(Socket&& socket) : Socket(std::move(socket)) {
+  assertTrue(type_ == UDP, "UDPSocket made out of a TCP socket.");
+
+  auto ring = event::IORing::getCurrentRing();
+  if (ring != nullptr) {
+    ringChannel_.reset(new RingChannel(ring, fd_.fd));
+  } else if (defaultOffload_) {
+    enableOffload();
+  }
+}
+
+UDPSocket::UDPSocket(UDPSocket&& move) = default;
+UDPSocket& UDPSocket::operator=(UDPSocket&& move) = default;
+
+UDPSocket::~UDPSocket() {}
+
+void UDPSocket::write(UDPPacket&& packet) {
+  if (!!ringChannel_) {
+    assertTrue(connected_, "Socket::write() called on a unconnected socket.");
+    checkRingError("sending a UDP packet");
+    ringChannel_->send(std::move(packet));
+    return;
+  }
+
   size_t written = Socket::write(packet.data, packet.size);
 
   if (written < packet.size) {
@@ -11,10 +254,291 @@ void UDPSocket::write(UDPPacket packet) {
 }
 
 bool UDPSocket::read(UDPPacket& packet) {
+  // Once datagrams come in coalesced, they can only be read in bulk
+  if (!!groChannel_) {
+    return readBatch(&packet, 1) > 0;
+  }
+
+  if (!!ringChannel_) {
+    checkRingError("receiving a UDP packet");
+    if (!ringChannel_->read(packet)) {
+      return false;
+    }
+
+    // Like a plain read, the first datagram decides who we talk to
+    if (!peerAddr_ && !!ringChannel_->firstSource) {
+      connect(*ringChannel_->firstSource);
+    }
+
+    return (packet.size > 0);
+  }
+
   size_t read = Socket::read(packet.data, packet.capacity);
   assertTrue(read < packet.capacity, "UDPPacket size too small.");
   packet.size = read;
 
   return (read > 0);
 }
+
+size_t UDPSocket::readBatch(UDPPacket* packets, size_t count) {
+  count = std::min(count, kUDPBatchSize);
+
+#if LINUX
+  if (!!groChannel_) {
+    return readCoalesced(packets, count);
+  }
+
+  // Until the first datagram decides who we talk to, reads go through read()
+  if (!ringChannel_ && !!peerAddr_ && count > 1) {
+    mmsghdr messages[kUDPBatchSize];
+    iovec vectors[kUDPBatchSize];
+    memset(messages, 0, sizeof(mmsghdr) * count);
+    for (size_t i = 0; i < count; i++) {
+      vectors[i].iov_base = packets[i].data;
+      vectors[i].iov_len = packets[i].capacity;
+      messages[i].msg_hdr.msg_iov = &vectors[i];
+      messages[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    int ret = recvmmsg(fd_.fd, messages, count, MSG_DONTWAIT, nullptr);
+    checkSocketException(ret, errno);
+    if (!checkRetryableError(ret, "receiving UDP packets")) {
+      return 0;
+    }
+
+    for (int i = 0; i < ret; i++) {
+      assertTrue(messages[i].msg_len < packets[i].capacity,
+                 "UDPPacket size too small.");
+      packets[i].size = messages[i].msg_len;
+    }
+
+    getBatchStats().receive.accumulate(ret, 1);
+    return ret;
+  }
+#endif
+
+  size_t read = 0;
+  while (read < count && this->read(packets[read])) {
+    read++;
+  }
+
+  if (!ringChannel_) {
+    getBatchStats().receive.accumulate(read, read);
+  }
+  return read;
+}
+
+size_t UDPSocket::writeBatch(UDPPacket* packets, size_t count) {
+  count = std::min(count, kUDPBatchSize);
+
+#if LINUX
+  if (!ringChannel_ && count > 1) {
+    assertTrue(connected_, "Socket::write() called on a unconnected socket.");
+
+    // Each message is either a single datagram, or with GSO a run of datagrams
+    // of the same size, save for the last one which can be shorter.
+    mmsghdr messages[kUDPBatchSize];
+    iovec vectors[kUDPBatchSize];
+    Byte controls[kUDPBatchSize][CMSG_SPACE(sizeof(uint16_t))];
+    size_t firstPackets[kUDPBatchSize + 1];
+    size_t messageCount = 0;
+
+    memset(messages, 0, sizeof(mmsghdr) * count);
+    for (size_t i = 0; i < count;) {
+      size_t first = i;
+      size_t segmentSize = packets[i].size;
+      size_t bytes = 0;
+
+      do {
+        vectors[i].iov_base = packets[i].data;
+        vectors[i].iov_len = packets[i].size;
+        bytes += packets[i].size;
+        i++;
+      } while (gsoEnabled_ && i < count && segmentSize > 0 &&
+               packets[i - 1].size == segmentSize &&
+               packets[i].size <= segmentSize &&
+               bytes + packets[i].size <= kUDPMaxOffloadBytes);
+
+      msghdr& header = messages[messageCount].msg_hdr;
+      header.msg_iov = &vectors[first];
+      header.msg_iovlen = i - first;
+      if (i - first > 1) {
+        header.msg_control = controls[messageCount];
+        header.msg_controllen = sizeof(controls[messageCount]);
+        cmsghdr* control = CMSG_FIRSTHDR(&header);
+        control->cmsg_level = SOL_UDP;
+        control->cmsg_type = UDP_SEGMENT;
+        control->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+        uint16_t size = segmentSize;
+        memcpy(CMSG_DATA(control), &size, sizeof(size));
+      }
+
+      firstPackets[messageCount++] = first;
+    }
+    firstPackets[messageCount] = count;
+
+    int ret = sendmmsg(fd_.fd, messages, messageCount, MSG_DONTWAIT);
+    int err = errno;
+
+    // Segments larger than the path MTU, or devices without checksum offload,
+    // only show up once we try.
+    if (ret < 0 && gsoEnabled_ && (err == EINVAL || err == EIO)) {
+      LOG_I("Socket") << "Turning off UDP GSO: " << strerror(err)
+                      << std::endl;
+      gsoEnabled_ = false;
+      return writeBatch(packets, count);
+    }
+
+    checkSocketException(ret, err);
+    errno = err;
+    if (!checkRetryableError(ret, "sending UDP packets")) {
+      return 0;
+    }
+
+    size_t sent = firstPackets[ret];
+    getBatchStats().send.accumulate(sent, 1);
+    if (gsoEnabled_) {
+      getBatchStats().gsoSegments.accumulate(sent, ret);
+    }
+    return sent;
+  }
+#endif
+
+  for (size_t i = 0; i < count; i++) {
+    write(std::move(packets[i]));
+  }
+
+  if (!ringChannel_) {
+    getBatchStats().send.accumulate(count, count);
+  }
+  return count;
+}
+
+/* static */ void UDPSocket::setDefaultOffload(bool offload) {
+  defaultOffload_ = offload;
+}
+
+size_t UDPSocket::getFootprint() const {
+  if (!!ringChannel_) {
+    return ringChannel_->getFootprint();
+  }
+
+  return !!groChannel_ ? groChannel_->buffer.getFootprint() : 0;
+}
+
+void UDPSocket::enableOffload() {
+#if LINUX
+  // Both only take if the kernel knows about them, 4.18 and 5.0 respectively
+  int segmentSize = 0;
+  gsoEnabled_ = (setsockopt(fd_.fd, SOL_UDP, UDP_SEGMENT, &segmentSize,
+                            sizeof(segmentSize)) == 0);
+
+  int on = 1;
+  if (setsockopt(fd_.fd, SOL_UDP, UDP_GRO, &on, sizeof(on)) == 0) {
+    groChannel_.reset(new GROChannel(Socket::canRead(), kUDPMaxOffloadBytes));
+  }
+
+  LOG_V("Socket") << "UDP GSO is " << (gsoEnabled_ ? "on" : "off")
+                  << ", GRO is " << (!!groChannel_ ? "on" : "off")
+                  << std::endl;
+#endif
+}
+
+size_t UDPSocket::readCoalesced(UDPPacket* packets, size_t count) {
+#if LINUX
+  GROChannel& channel = *groChannel_;
+
+  // Datagrams left over from the last buffer go first
+  if (channel.isEmpty()) {
+    SocketAddress source;
+    iovec vector;
+    vector.iov_base = channel.buffer.data;
+    vector.iov_len = channel.buffer.capacity;
+    Byte control[CMSG_SPACE(sizeof(int))];
+
+    msghdr header;
+    memset(&header, 0, sizeof(header));
+    header.msg_name = source.asSocketAddress();
+    header.msg_namelen = source.getStorageLength();
+    header.msg_iov = &vector;
+    header.msg_iovlen = 1;
+    header.msg_control = control;
+    header.msg_controllen = sizeof(control);
+
+    int ret = recvmsg(fd_.fd, &header, MSG_DONTWAIT);
+    int err = errno;
+    checkSocketException(ret, err);
+    errno = err;
+    if (!checkRetryableError(ret, "receiving UDP packets") || ret == 0) {
+      channel.setDrained(true);
+      return 0;
+    }
+
+    // Like a plain read, the first datagram decides who we talk to
+    if (!peerAddr_) {
+      connect(source);
+    }
+
+    // Without the control message, the buffer holds a single datagram
+    channel.buffer.size = ret;
+    channel.offset = 0;
+    channel.segmentSize = ret;
+    for (cmsghdr* message = CMSG_FIRSTHDR(&header); message != nullptr;
+         message = CMSG_NXTHDR(&header, message)) {
+      if (message->cmsg_level == SOL_UDP && message->cmsg_type == UDP_GRO) {
+        int size;
+        memcpy(&size, CMSG_DATA(message), sizeof(size));
+        channel.segmentSize = size;
+      }
+    }
+
+    size_t segments = (ret + channel.segmentSize - 1) / channel.segmentSize;
+    getBatchStats().receive.accumulate(segments, 1);
+    getBatchStats().groSegments.accumulate(segments, 1);
+  }
+
+  // Packets own whole buffers of their own, so each datagram gets copied out
+  size_t read = 0;
+  while (read < count && !channel.isEmpty()) {
+    size_t size =
+        std::min(channel.segmentSize, channel.buffer.size - channel.offset);
+    assertTrue(size < packets[read].capacity, "UDPPacket size too small.");
+    packets[read++].fill(channel.buffer.data + channel.offset, size);
+    channel.offset += size;
+  }
+
+  return read;
+#else
+  return 0;
+#endif
+}
+
+event::Condition* UDPSocket::canRead() const {
+  if (!!ringChannel_) {
+    return ringChannel_->canRead();
+  }
+
+  if (!!groChannel_) {
+    return groChannel_->canRead();
+  }
+
+  return Socket::canRead();
+}
+
+event::Condition* UDPSocket::canWrite() const {
+  if (!!ringChannel_) {
+    return ringChannel_->canWrite();
+  }
+
+  return Socket::canWrite();
+}
+
+void UDPSocket::checkRingError(std::string const& action) {
+  int error = ringChannel_->takeError();
+  if (error != 0) {
+    checkSocketException(-1, error);
+    errno = error;
+    throwUnixError(action);
+  }
+}
 }
@@ -3,20 +3,80 @@
 #include <networking/Packet.h>
 #include <networking/Socket.h>
 
+#include <memory>
+
 namespace networking {
 
-static const size_t kUDPPacketSize = 2048;
+static const size_t kUDPPacketSize = kDataPathPacketSize;
+// The most datagrams moved by a single readBatch() or writeBatch(), which is
+// also the most the kernel coalesces into one buffer
+static const size_t kUDPBatchSize = 64;
 
 class UDPPacket : public Packet {
 public:
   UDPPacket() : Packet(kUDPPacketSize) {}
+  // Takes over the buffer of a packet further along the data path
+  explicit UDPPacket(Packet&& packet) : Packet(std::move(packet)) {}
 };
 
 class UDPSocket : public Socket {
 public:
-  UDPSocket() : Socket(UDP) {}
+  UDPSocket();
+  // Takes over a UDP socket that was bound or connected elsewhere, e.g. on
+  // another thread. Everything else here belongs to the thread that creates
+  // the UDPSocket.
+  explicit UDPSocket(Socket&& socket);
+  UDPSocket(UDPSocket&& move);
+  UDPSocket& operator=(UDPSocket&& move);
+  ~UDPSocket();
 
-  void write(UDPPacket packet);
+  void write(UDPPacket&& packet);
   bool read(UDPPacket& packet);
+
+  // Like read() and write(), but for up to kUDPBatchSize datagrams at once,
+  // which takes a single recvmmsg() or sendmmsg() on Linux. readBatch() fills
+  // the given packets, which keep their buffers, and returns how many it read.
+  // writeBatch() leaves the packets to the caller, and returns how many went
+  // out; the rest found no room in the socket buffer, and are dropped just like
+  // write() would drop them.
+  //
+  // The number of datagrams per call shows as "UDPSocket"/"recv_batch" and
+  // "UDPSocket"/"send_batch".
+  size_t readBatch(UDPPacket* packets, size_t count);
+  size_t writeBatch(UDPPacket* packets, size_t count);
+
+  // Sockets created from now on let the kernel move datagrams in bulk where it
+  // supports that, which is off with io_uring. On send, runs of datagrams of
+  // the same size go out as one buffer (UDP_SEGMENT). On receive, datagrams
+  // from the same peer come in coalesced (UDP_GRO), and get split back up into
+  // packets. Datagrams per buffer show as "UDPSocket"/"gso_segments" and
+  // "UDPSocket"/"gro_segments".
+  //
+  // Datagrams of a coalesced buffer that do not fit into the packets given are
+  // kept for the next read() or readBatch().
+  static void setDefaultOffload(bool offload);
+
+  // The bytes the socket holds on to for receiving
+  size_t getFootprint() const;
+
+  event::Condition* canRead() const;
+  event::Condition* canWrite() const;
+
+private:
+  // Sends and receives through io_uring when it is in use
+  class RingChannel;
+  std::unique_ptr<RingChannel> ringChannel_;
+
+  // Holds on to coalesced datagrams until they are all read
+  class GROChannel;
+  std::unique_ptr<GROChannel> groChannel_;
+
+  static bool defaultOffload_;
+  bool gsoEnabled_ = false;
+
+  void enableOffload();
+  size_t readCoalesced(UDPPacket* packets, size_t count);
+
+  void checkRingError(std::string const& action);
 };
 }
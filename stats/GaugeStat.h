@@ -0,0 +1,20 @@
+#pragma once
+
+#include <stats/StatsManager.h>
+
+namespace stats {
+
+// Reports how much of something there is right now, e.g. the bytes held in
+// buffers, as read through the given function whenever stats get collected.
+class GaugeStat : StatBase {
+public:
+  GaugeStat(std::string entity, std::string metric,
+            std::function<double()> read)
+      : StatBase(entity, metric), read_(read) {}
+
+private:
+  std::function<double()> read_;
+
+  virtual double collect() override { return read_(); }
+};
+}
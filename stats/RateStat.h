@@ -18,5 +18,7 @@ private:
     value_ = 0.0;
     return result;
   }
+
+  virtual bool isAdditive() const override { return true; }
 };
 }
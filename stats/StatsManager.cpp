@@ -2,21 +2,30 @@
 
 namespace stats {
 
-/* static */ size_t StatBase::seq_ = 0;
+/* static */ std::atomic<size_t> StatBase::seq_(0);
 
 StatBase::StatBase(std::string entity, std::string metric,
                    Prefix prefix /* = Prefix::None */)
     : entity_(entity), metric_(metric) {
-  id_ = StatBase::seq_;
-  StatBase::seq_++;
+  id_ = StatBase::seq_++;
   prefix_ = prefix;
   StatsManager::addStat(this);
 }
 
 StatBase::~StatBase() { StatsManager::removeStat(this); }
 
+/* static */ std::mutex StatsManager::publishedMutex_;
+/* static */ std::map<StatsManager*,
+                      std::map<StatsManager::StatKey, StatsManager::Sample>>
+    StatsManager::published_;
+
+StatsManager::~StatsManager() {
+  std::lock_guard<std::mutex> lock(publishedMutex_);
+  published_.erase(this);
+}
+
 /* static */ StatsManager& StatsManager::getInstance() {
-  static StatsManager instance;
+  static thread_local StatsManager instance;
   return instance;
 }
 
@@ -27,4 +36,75 @@ StatBase::~StatBase() { StatsManager::removeStat(this); }
 /* static */ void StatsManager::removeStat(StatBase* stat) {
   getInstance().stats_.erase(stat);
 }
+
+/* static */ void StatsManager::collect() {
+  auto samples = std::map<StatKey, Sample>{};
+  getInstance().collectInto(samples);
+
+  {
+    std::lock_guard<std::mutex> lock(publishedMutex_);
+    for (auto& thread : published_) {
+      auto& published = thread.second;
+      for (auto it = published.begin(); it != published.end();) {
+        merge(samples, it->first, it->second);
+
+        // Additive samples are consumed, while the others stay around as the
+        // latest known value until the publishing thread updates them.
+        if (it->second.additive) {
+          it = published.erase(it);
+        } else {
+          it++;
+        }
+      }
+    }
+  }
+
+  auto data = SubscribeData{};
+  for (auto const& entry : samples) {
+    auto const& sample = entry.second;
+    data[entry.first] =
+        sample.additive ? sample.value : sample.value / sample.count;
+  }
+
+  for (auto const& callback : getInstance().callbacks_) {
+    callback(data);
+  }
+}
+
+/* static */ void StatsManager::publish() {
+  auto samples = std::map<StatKey, Sample>{};
+  getInstance().collectInto(samples);
+
+  std::lock_guard<std::mutex> lock(publishedMutex_);
+  auto& published = published_[&getInstance()];
+
+  // Stats that are gone since the last publish() only leave behind what they
+  // added up to and was not collected yet.
+  for (auto const& entry : published) {
+    if (entry.second.additive) {
+      merge(samples, entry.first, entry.second);
+    }
+  }
+  published = std::move(samples);
+}
+
+void StatsManager::collectInto(std::map<StatKey, Sample>& samples) {
+  for (auto stat : stats_) {
+    merge(samples, std::make_pair(stat->entity_, stat->metric_),
+          Sample{stat->collect(), stat->isAdditive(), 1});
+  }
+}
+
+/* static */ void StatsManager::merge(std::map<StatKey, Sample>& samples,
+                                      StatKey const& key,
+                                      Sample const& sample) {
+  auto it = samples.find(key);
+  if (it == samples.end()) {
+    samples[key] = sample;
+    return;
+  }
+
+  it->second.value += sample.value;
+  it->second.count += sample.count;
+}
 }
@@ -1,9 +1,11 @@
 #pragma once
 
+#include <atomic>
 #include <functional>
 #include <iomanip>
 #include <iostream>
 #include <map>
+#include <mutex>
 #include <queue>
 #include <set>
 #include <string>
@@ -31,16 +33,24 @@ protected:
   std::string metric_;
 
 private:
-  static size_t seq_;
+  static std::atomic<size_t> seq_;
 
   size_t id_;
   Prefix prefix_;
 
   virtual double collect() = 0;
 
+  // Whether values collected from stats with the same name (e.g. from
+  // different sessions or threads) should be added up. Otherwise they get
+  // averaged.
+  virtual bool isAdditive() const { return false; }
+
   friend class StatsManager;
 };
 
+// Each thread has its own StatsManager, which only ever touches the stats
+// created on that thread. Threads other than the one collecting stats publish
+// theirs periodically, and those get aggregated into the next collection.
 class StatsManager {
 public:
   using SubscribeData = std::map<std::pair<std::string, std::string>, double>;
@@ -53,19 +63,14 @@ public:
     getInstance().callbacks_.push_back(callback);
   }
 
-  // Collects all the stats the send the aggregated data to all the subscribed
-  // callbacks.
-  static void collect() {
-    auto data = SubscribeData{};
-
-    for (auto stat : getInstance().stats_) {
-      data[std::make_pair(stat->entity_, stat->metric_)] = stat->collect();
-    }
+  // Collects all the stats of this thread and the ones published by other
+  // threads, and sends the aggregated data to all the callbacks subscribed on
+  // this thread.
+  static void collect();
 
-    for (auto const& callback : getInstance().callbacks_) {
-      callback(data);
-    }
-  }
+  // Collects all the stats of this thread, to be picked up by the next
+  // collect() on whichever thread does the collecting.
+  static void publish();
 
   template <typename O> static void dump(O& output, SubscribeData const& data) {
     dump(output, data,
@@ -113,9 +118,31 @@ public:
 private:
   static const size_t kNamePaddingLength = 10;
 
+  using StatKey = std::pair<std::string, std::string>;
+
+  // The sum of the values of count stats
+  struct Sample {
+    double value;
+    bool additive;
+    size_t count;
+  };
+
   std::set<StatBase*> stats_;
   std::vector<SubscribeCallback> callbacks_;
 
+  // What each thread published last. Additive samples add up until they get
+  // collected, while the others get replaced by every publish().
+  static std::mutex publishedMutex_;
+  static std::map<StatsManager*, std::map<StatKey, Sample>> published_;
+
+  StatsManager() {}
+  // Whatever the thread published goes away with it
+  ~StatsManager();
+
   static StatsManager& getInstance();
+
+  void collectInto(std::map<StatKey, Sample>& samples);
+  static void merge(std::map<StatKey, Sample>& samples, StatKey const& key,
+                    Sample const& sample);
 };
 }
@@ -1,7 +1,6 @@
 #include "stun/Client.h"
 
 #include <event/Action.h>
-#include <event/Trigger.h>
 
 namespace stun {
 
@@ -9,31 +8,41 @@ using namespace std::chrono_literals;
 
 const event::Duration kReconnectDelayInterval = 5s;
 
-Client::Client(ClientConfig config) : config_(config) { connect(); }
+Client::Client(ClientConfig config) : config_(config) {
+  for (size_t i = 1; i < config_.tunnelQueues; i++) {
+    laneThreads_.emplace_back(new event::LoopThread());
+  }
+
+  runner_ = run();
+}
 
 void Client::connect() {
   auto socket = TCPSocket{};
   socket.connect(config_.serverAddr);
 
+  auto laneLoops = std::vector<event::EventLoop*>{};
+  for (auto const& thread : laneThreads_) {
+    laneLoops.push_back(thread->getLoop());
+  }
+
   handler_.reset(new ClientSessionHandler(
-      config_, std::make_unique<TCPSocket>(std::move(socket))));
-  reconnector_.reset(new event::Action({handler_->didEnd()}));
-  reconnector_->callback.setMethod<Client, &Client::doReconnect>(this);
+      config_, std::make_unique<TCPSocket>(std::move(socket)), laneLoops));
 }
 
-void Client::doReconnect() {
-  handler_.reset();
-  reconnector_.reset();
+event::Coroutine Client::run() {
+  while (true) {
+    connect();
+    co_await handler_->didEnd();
+    handler_.reset();
 
-  LOG_I("Client") << "Will reconnect in "
-                  << std::chrono::duration_cast<std::chrono::milliseconds>(
-                         kReconnectDelayInterval)
-                         .count()
-                  << " ms." << std::endl;
+    LOG_I("Client") << "Will reconnect in "
+                    << std::chrono::duration_cast<std::chrono::milliseconds>(
+                           kReconnectDelayInterval)
+                           .count()
+                    << " ms." << std::endl;
 
-  event::Trigger::performIn(kReconnectDelayInterval, [this]() {
+    co_await kReconnectDelayInterval;
     LOG_I("Client") << "Reconnecting..." << std::endl;
-    connect();
-  });
+  }
 }
 }
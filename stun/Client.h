@@ -2,6 +2,9 @@
 
 #include <stun/ClientSessionHandler.h>
 
+#include <event/Coroutine.h>
+#include <event/LoopThread.h>
+
 namespace stun {
 
 class Client {
@@ -12,6 +15,7 @@ private:
   ClientConfig config_;
 
   void connect();
+  event::Coroutine run();
 
 private:
   Client(Client const& copy) = delete;
@@ -20,9 +24,11 @@ private:
   Client(Client&& move) = delete;
   Client& operator=(Client&& move) = delete;
 
-  std::unique_ptr<ClientSessionHandler> handler_;
-  std::unique_ptr<event::Action> reconnector_;
+  // Where the lanes of the tunnel beyond the first one run. These outlive the
+  // sessions, which tear their lanes down by posting to them.
+  std::vector<std::unique_ptr<event::LoopThread>> laneThreads_;
 
-  void doReconnect();
+  std::unique_ptr<ClientSessionHandler> handler_;
+  event::Coroutine runner_;
 };
 }
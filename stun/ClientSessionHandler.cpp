@@ -3,6 +3,7 @@
 #include <event/Trigger.h>
 #include <networking/InterfaceConfig.h>
 
+#include <algorithm>
 #include <chrono>
 
 namespace stun {
@@ -12,9 +13,14 @@ const static size_t kClientSessionHandlerRouteChunkSize = 50;
 using namespace std::chrono_literals;
 
 ClientSessionHandler::ClientSessionHandler(
-    ClientConfig config, std::unique_ptr<TCPSocket> commandPipe)
-    : config_(config), messenger_(new Messenger(std::move(commandPipe))),
+    ClientConfig config, std::unique_ptr<TCPSocket> commandPipe,
+    std::vector<event::EventLoop*> laneLoops)
+    : config_(config), laneLoops_(std::move(laneLoops)),
+      memory_(std::make_shared<common::MemoryAccount>()),
+      messenger_(new Messenger(std::move(commandPipe))),
       didEnd_(new event::BaseCondition()) {
+  messenger_->setMemoryAccount(memory_.get(),
+                               config_.queueBudget.messengerBytes);
 
   if (!config_.secret.empty()) {
     messenger_->addEncryptor(
@@ -44,10 +50,18 @@ void ClientSessionHandler::attachHandlers() {
   messenger_->addHandler("config", [this](auto const& message) {
     auto body = message.getBody();
 
-    dispatcher_.reset(new Dispatcher(createTunnel(
-        IPAddress(body["client_tunnel_ip"].template get<std::string>()),
-        IPAddress(body["server_tunnel_ip"].template get<std::string>()),
-        SubnetAddress(body["server_subnet"].template get<std::string>()))));
+    // Pipes get handed to the queues in turns, so each queue only gets some
+    // if there are no more of them than the server sends pipes at a time.
+    size_t serverQueues = body.value("tunnel_queues", size_t(1));
+    size_t queues = std::min(config_.tunnelQueues, serverQueues);
+
+    dispatcher_.reset(new Dispatcher(
+        createTunnel(
+            queues,
+            IPAddress(body["client_tunnel_ip"].template get<std::string>()),
+            IPAddress(body["server_tunnel_ip"].template get<std::string>()),
+            SubnetAddress(body["server_subnet"].template get<std::string>())),
+        laneLoops_, config_.dataBudget, config_.queueBudget, memory_));
 
     LOG_I("Session") << "Received config from the server." << std::endl;
 
@@ -57,16 +71,33 @@ void ClientSessionHandler::attachHandlers() {
   messenger_->addHandler("new_data_pipe", [this](auto const& message) {
     auto body = message.getBody();
 
-    UDPSocket udpPipe;
+    // Connected here, while the rest of the pipe gets created on the loop of
+    // the lane it goes to
+    Socket udpPipe(networking::UDP);
     udpPipe.connect(
         SocketAddress(config_.serverAddr.getHost().toString(), body["port"]));
 
-    DataPipe* dataPipe = new DataPipe(
-        std::make_unique<UDPSocket>(std::move(udpPipe)), body["aes_key"],
-        body["padding_to_size"], body["compression"], 0s);
-    dataPipe->setPrePrimed();
+    // Padding only concerns the sender, so whatever does not fit can go
+    size_t paddingTo = body["padding_to_size"];
+    if (paddingTo > kMaxPaddingTo) {
+      LOG_I("Session") << "Server asked to pad packets to " << paddingTo
+                       << " bytes, using " << kMaxPaddingTo << " instead."
+                       << std::endl;
+      paddingTo = kMaxPaddingTo;
+    }
 
-    dispatcher_->addDataPipe(std::unique_ptr<DataPipe>(dataPipe));
+    dispatcher_->addDataPipe([
+      udpPipe = std::move(udpPipe),
+      aesKey = body["aes_key"].template get<std::string>(), paddingTo,
+      compression = body["compression"].template get<bool>(),
+      dataBudget = config_.dataBudget
+    ]() mutable {
+      auto dataPipe = std::make_unique<DataPipe>(
+          std::make_unique<UDPSocket>(std::move(udpPipe)), aesKey, paddingTo,
+          compression, 0s, dataBudget);
+      dataPipe->setPrePrimed();
+      return dataPipe;
+    });
 
     LOG_V("Session") << "Rotated to a new data pipe." << std::endl;
 
@@ -106,26 +137,29 @@ ClientSessionHandler::createRoutes(std::vector<Route> routes) {
       LOG_V("Session") << "Added " << kClientSessionHandlerRouteChunkSize
                        << " routes." << std::endl;
 
-      // We yield the remaining routes to the next event loop iteration
-      event::Trigger::perform([routes = std::move(routes)]() {
-        ClientSessionHandler::createRoutes(routes);
-      });
+      // We yield the remaining routes to the next event loop iteration, after
+      // whatever else is ready to go by then.
+      event::Trigger::perform(
+          [routes = std::move(routes)]() {
+            ClientSessionHandler::createRoutes(routes);
+          },
+          event::ActionPriority::Housekeeping);
 
       break;
     }
   }
 }
 
-Tunnel
-ClientSessionHandler::createTunnel(IPAddress const& myTunnelAddr,
-                                   IPAddress const& peerTunnelAddr,
-                                   SubnetAddress const& serverSubnetAddr) {
-  Tunnel tunnel;
+Tunnel ClientSessionHandler::createTunnel(
+    size_t queues, IPAddress const& myTunnelAddr,
+    IPAddress const& peerTunnelAddr, SubnetAddress const& serverSubnetAddr) {
+  auto tunnel = Tunnel::open(queues, config_.tunnelOffload);
+  std::string const& deviceName = tunnel.deviceName;
 
   // Configure the new interface
   InterfaceConfig config;
-  config.newLink(tunnel.deviceName, kTunnelEthernetMTU);
-  config.setLinkAddress(tunnel.deviceName, myTunnelAddr, peerTunnelAddr);
+  config.newLink(deviceName, kTunnelEthernetMTU);
+  config.setLinkAddress(deviceName, myTunnelAddr, peerTunnelAddr);
 
   auto routes = std::vector<Route>{};
 
@@ -23,17 +23,30 @@ public:
 
   std::vector<SubnetAddress> subnetsToForward;
   std::vector<SubnetAddress> subnetsToExclude;
+
+  DataBudget dataBudget;
+  QueueBudget queueBudget;
+  // No more than the server uses, each on a thread of its own
+  size_t tunnelQueues;
+  bool tunnelOffload;
 };
 
 class ClientSessionHandler {
 public:
+  // Lanes of the tunnel beyond the first one run on the given loops
   ClientSessionHandler(ClientConfig config,
-                       std::unique_ptr<TCPSocket> commandPipe);
+                       std::unique_ptr<TCPSocket> commandPipe,
+                       std::vector<event::EventLoop*> laneLoops);
 
   event::Condition* didEnd() const;
 
 private:
   ClientConfig config_;
+  std::vector<event::EventLoop*> laneLoops_;
+
+  // Everything the session buffers. Shared with the dispatcher's lanes, which
+  // can be torn down after the session is gone.
+  std::shared_ptr<common::MemoryAccount> memory_;
 
   std::unique_ptr<Messenger> messenger_;
   std::unique_ptr<Dispatcher> dispatcher_;
@@ -42,7 +55,8 @@ private:
 
   void attachHandlers();
   static void createRoutes(std::vector<networking::Route> routes);
-  Tunnel createTunnel(IPAddress const& myAddr, IPAddress const& peerAddr,
+  Tunnel createTunnel(size_t queues, IPAddress const& myAddr,
+                      IPAddress const& peerAddr,
                       SubnetAddress const& serverSubnetAddr);
 };
 }
@@ -2,6 +2,7 @@
 
 #include <event/Trigger.h>
 
+#include <algorithm>
 #include <chrono>
 
 namespace stun {
@@ -10,20 +11,33 @@ using namespace std::chrono_literals;
 
 static const event::Duration kDataPipeProbeInterval = 1s;
 static const size_t kDataPipeFIFOSize = 256;
+static const std::chrono::microseconds kDataPipeBusyPollTime = 50us;
 
 DataPipe::DataPipe(std::unique_ptr<networking::UDPSocket> socket,
                    std::string const& aesKey, size_t minPaddingTo,
-                   bool compression, event::Duration ttl)
+                   bool compression, event::Duration ttl,
+                   DataBudget budget)
     : inboundQ(new event::FIFO<DataPacket>(kDataPipeFIFOSize)),
       outboundQ(new event::FIFO<DataPacket>(kDataPipeFIFOSize)),
       socket_(std::move(socket)), aesKey_(aesKey), minPaddingTo_(minPaddingTo),
+      budget_(budget),
       didClose_(new event::BaseCondition()),
-      isPrimed_(new event::BaseCondition()) {
+      isPrimed_(new event::BaseCondition()),
+      receiveBatch_(networking::kUDPBatchSize) {
+  sendBatch_.reserve(networking::kUDPBatchSize);
+
+  // A busy-polling loop checks on the socket all the time anyway, so the
+  // kernel might as well spin a little on the device queue for it.
+  if (event::EventLoop::getCurrentLoop()->isBusyPolling()) {
+    socket_->setBusyPoll(kDataPipeBusyPollTime);
+  }
+
   // Sets up TTL killer
   if (ttl != 0s) {
     ttlTimer_.reset(new event::Timer(ttl));
     ttlKiller_.reset(new event::Action({ttlTimer_->didFire()}));
     ttlKiller_->callback.setMethod<DataPipe, &DataPipe::doKill>(this);
+    ttlKiller_->setName("DataPipe::doKill");
   }
 
   // Prepare Encryptor-s
@@ -43,20 +57,29 @@ DataPipe::DataPipe(std::unique_ptr<networking::UDPSocket> socket,
   sender_.reset(new event::Action(
       {outboundQ->canPop(), socket_->canWrite(), isPrimed_.get()}));
   sender_->callback.setMethod<DataPipe, &DataPipe::doSend>(this);
+  sender_->setName("DataPipe::doSend");
+  sender_->setPriority(event::ActionPriority::DataPlane);
   receiver_.reset(new event::Action({inboundQ->canPush(), socket_->canRead()}));
   receiver_->callback.setMethod<DataPipe, &DataPipe::doReceive>(this);
+  receiver_->setName("DataPipe::doReceive");
+  receiver_->setPriority(event::ActionPriority::DataPlane);
 
   // Setup prober
   probeTimer_.reset(new event::Timer(0s));
   prober_.reset(new event::Action(
       {probeTimer_->didFire(), outboundQ->canPush(), isPrimed_.get()}));
   prober_->callback.setMethod<DataPipe, &DataPipe::doProbe>(this);
+  prober_->setName("DataPipe::doProbe");
 }
 
 DataPipe::DataPipe(DataPipe&& move)
     : inboundQ(std::move(move.inboundQ)), outboundQ(std::move(move.outboundQ)),
-      statEfficiency(move.statEfficiency), socket_(std::move(move.socket_)),
-      aesKey_(std::move(move.aesKey_)), minPaddingTo_(move.minPaddingTo_),
+      statEfficiency(move.statEfficiency), statDropped(move.statDropped),
+      socket_(std::move(move.socket_)), aesKey_(std::move(move.aesKey_)),
+      minPaddingTo_(move.minPaddingTo_), budget_(move.budget_),
+      memory_(move.memory_),
+      compressorMemory_(std::move(move.compressorMemory_)),
+      receiveBatchMemory_(std::move(move.receiveBatchMemory_)),
       didClose_(std::move(move.didClose_)),
       isPrimed_(std::move(move.isPrimed_)),
       ttlTimer_(std::move(move.ttlTimer_)),
@@ -65,7 +88,9 @@ DataPipe::DataPipe(DataPipe&& move)
       compressor_(std::move(move.compressor_)),
       padder_(std::move(move.padder_)),
       aesEncryptor_(std::move(move.aesEncryptor_)),
-      sender_(std::move(move.sender_)), receiver_(std::move(move.receiver_)) {
+      sender_(std::move(move.sender_)), receiver_(std::move(move.receiver_)),
+      receiveBatch_(std::move(move.receiveBatch_)),
+      sendBatch_(std::move(move.sendBatch_)) {
   ttlKiller_->callback.target = this;
   prober_->callback.target = this;
   sender_->callback.target = this;
@@ -74,6 +99,29 @@ DataPipe::DataPipe(DataPipe&& move)
 
 void DataPipe::setPrePrimed() { isPrimed_->fire(); }
 
+void DataPipe::setGroup(std::string const& name) {
+  sender_->setGroup(name);
+  receiver_->setGroup(name);
+  prober_->setGroup(name);
+}
+
+void DataPipe::setMemoryAccount(common::MemoryAccount* memory,
+                                size_t queueBytes) {
+  memory_ = memory;
+  inboundQ->setByteBudget(queueBytes, memory);
+  outboundQ->setByteBudget(queueBytes, memory);
+  if (!!compressor_) {
+    compressorMemory_ =
+        common::MemoryCharge(memory, compressor_->getFootprint());
+  }
+
+  size_t receiveBatchBytes = socket_->getFootprint();
+  for (auto const& packet : receiveBatch_) {
+    receiveBatchBytes += packet.getFootprint();
+  }
+  receiveBatchMemory_ = common::MemoryCharge(memory, receiveBatchBytes);
+}
+
 event::Condition* DataPipe::didClose() { return didClose_.get(); }
 event::Condition* DataPipe::isPrimed() { return isPrimed_.get(); }
 
@@ -91,74 +139,192 @@ void DataPipe::doProbe() {
 }
 
 void DataPipe::doSend() {
-  while (outboundQ->canPop()->eval()) {
-    DataPacket data = outboundQ->pop();
-    UDPPacket out;
-
-    size_t payloadSize = data.size;
+  size_t packets = 0;
+  size_t bytes = 0;
 
-    out.fill(std::move(data));
-    if (!!compressor_) {
-      out.size = compressor_->encrypt(out.data, out.size, out.capacity);
-    }
-    if (!!padder_) {
-      out.size = padder_->encrypt(out.data, out.size, out.capacity);
-    }
-    if (!!aesEncryptor_) {
-      out.size = aesEncryptor_->encrypt(out.data, out.size, out.capacity);
-    }
+  while (outboundQ->canPop()->eval() && socket_->canWrite()->eval() &&
+         budget_.allows(packets, bytes)) {
+    // Packets are taken over straight from the FIFO's slots, and go out
+    // together once the batch is full or the FIFO runs dry.
+    size_t popped = 0;
+    for (auto& data : outboundQ->peek()) {
+      size_t datagrams =
+          (data.segmentSize != 0 ? networking::countSegments(data) : 1);
+      if ((!sendBatch_.empty() &&
+           sendBatch_.size() + datagrams > networking::kUDPBatchSize) ||
+          !budget_.allows(packets, bytes)) {
+        break;
+      }
 
-    if (statEfficiency != nullptr) {
-      statEfficiency->accumulate(payloadSize, out.size);
+      popped++;
+      packets++;
+      bytes += data.size;
+      if (!queueForSend(std::move(data))) {
+        outboundQ->discard(popped);
+        doKill();
+        return;
+      }
     }
 
-    try {
-      socket_->write(std::move(out));
-    } catch (networking::SocketClosedException const& ex) {
-      LOG_V("DataPipe") << "While sending: " << ex.what() << std::endl;
+    outboundQ->discard(popped);
+    if (!flushSendBatch()) {
       doKill();
       return;
     }
   }
 }
 
+bool DataPipe::queueForSend(DataPacket&& data) {
+  if (data.segmentSize == 0) {
+    sendBatch_.push_back(encodePacket(std::move(data)));
+    return true;
+  }
+
+  // Super-packets from a tunnel with offloads only get cut into segments here,
+  // which then leave as a run of datagrams of the same size.
+  size_t segments = networking::countSegments(data);
+  for (size_t i = 0; i < segments; i++) {
+    if (sendBatch_.size() == networking::kUDPBatchSize && !flushSendBatch()) {
+      return false;
+    }
+
+    DataPacket segment;
+    networking::segmentFrame(data, i, segment);
+    sendBatch_.push_back(encodePacket(std::move(segment)));
+  }
+
+  return true;
+}
+
+UDPPacket DataPipe::encodePacket(DataPacket&& data) {
+  size_t payloadSize = data.size;
+
+  // The packet leaves in the buffer the tunnel read it into, which has room
+  // for whatever the transforms append. Only compression cannot work in place,
+  // and writes into a fresh buffer instead.
+  UDPPacket out(std::move(data));
+  if (!!compressor_) {
+    UDPPacket compressed;
+    compressed.size = compressor_->compress(out.data, out.size,
+                                            compressed.data,
+                                            compressed.capacity);
+    out.fill(std::move(compressed));
+  }
+  if (!!padder_) {
+    out.size = padder_->encrypt(out.data, out.size, out.capacity);
+  }
+  if (!!aesEncryptor_) {
+    out.size = aesEncryptor_->encrypt(out.data, out.size, out.capacity);
+  }
+
+  if (statEfficiency != nullptr) {
+    statEfficiency->accumulate(payloadSize, out.size);
+  }
+
+  return out;
+}
+
+bool DataPipe::flushSendBatch() {
+  size_t sent = 0;
+  try {
+    sent = socket_->writeBatch(sendBatch_.data(), sendBatch_.size());
+  } catch (networking::SocketClosedException const& ex) {
+    LOG_V("DataPipe") << "While sending: " << ex.what() << std::endl;
+    sendBatch_.clear();
+    return false;
+  }
+
+  if (sent < sendBatch_.size()) {
+    LOG_V("DataPipe") << "Socket buffer full, dropped "
+                      << sendBatch_.size() - sent << " packets." << std::endl;
+  }
+
+  sendBatch_.clear();
+  return true;
+}
+
 void DataPipe::doReceive() {
-  while (inboundQ->canPush()->eval()) {
-    UDPPacket in;
-    DataPacket data;
+  size_t packets = 0;
+  size_t bytes = 0;
+
+  // The inbound FIFO's conditions only get updated once we are done
+  inboundQ->reserve(inboundQ->getCapacity());
+  while (inboundQ->getReserved() > 0 && budget_.allows(packets, bytes)) {
+    // Read no more than the FIFO has slots for, nor than the buffers read into
+    // would take it past its byte limit
+    size_t count = 0;
+    size_t footprint = 0;
+    size_t byteRoom = inboundQ->getByteRoom();
+    while (count < std::min(inboundQ->getReserved(), receiveBatch_.size()) &&
+           footprint < byteRoom) {
+      footprint += receiveBatch_[count++].getFootprint();
+    }
+    size_t read = 0;
 
     try {
-      bool read = socket_->read(in);
-      if (!read) {
+      read = socket_->readBatch(receiveBatch_.data(), count);
+      if (read == 0) {
         break;
       }
     } catch (networking::SocketClosedException const& ex) {
       LOG_V("DataPipe") << "While receiving: " << ex.what() << std::endl;
+      inboundQ->commit();
       doKill();
       return;
     }
 
-    size_t wireSize = in.size;
+    for (size_t i = 0; i < read; i++) {
+      UDPPacket& in = receiveBatch_[i];
+      size_t wireSize = in.size;
+      packets++;
+      bytes += wireSize;
 
-    data.fill(std::move(in));
-    if (!!aesEncryptor_) {
-      data.size = aesEncryptor_->decrypt(data.data, data.size, data.capacity);
-    }
-    if (!!padder_) {
-      data.size = padder_->decrypt(data.data, data.size, data.capacity);
-    }
-    if (!!compressor_) {
-      data.size = compressor_->decrypt(data.data, data.size, data.capacity);
-    }
+      // Dropped just like a full socket buffer would, which leaves the buffer
+      // to the next read
+      if (memory_ != nullptr && memory_->isOverLimit()) {
+        if (statDropped != nullptr) {
+          statDropped->accumulate(1);
+        }
+        continue;
+      }
 
-    if (statEfficiency != nullptr) {
-      statEfficiency->accumulate(data.size, wireSize);
-    }
+      // Mirrors encodePacket(), down to the buffer ending up in the tunnel.
+      // The batch gets a fresh buffer in its place.
+      DataPacket data(std::move(in));
+      in.fill(UDPPacket());
+      if (!!aesEncryptor_) {
+        data.size =
+            aesEncryptor_->decrypt(data.data, data.size, data.capacity);
+      }
+      if (!!padder_) {
+        data.size = padder_->decrypt(data.data, data.size, data.capacity);
+      }
+      if (!!compressor_) {
+        DataPacket decompressed;
+        decompressed.size = compressor_->decompress(
+            data.data, data.size, decompressed.data, decompressed.capacity);
+        data.fill(std::move(decompressed));
+      }
 
-    if (data.size > 0) {
-      inboundQ->push(std::move(data));
+      if (statEfficiency != nullptr) {
+        statEfficiency->accumulate(data.size, wireSize);
+      }
+
+      if (data.size == 0) {
+        continue;
+      }
+      // Only when a transform handed out a larger buffer than the one read
+      // into, which took the FIFO to its byte limit sooner
+      if (inboundQ->getReserved() == 0) {
+        if (statDropped != nullptr) {
+          statDropped->accumulate(1);
+        }
+        continue;
+      }
+      inboundQ->emplace(std::move(data));
     }
   }
+  inboundQ->commit();
 
   isPrimed_->fire();
 }
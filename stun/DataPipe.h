@@ -1,5 +1,6 @@
 #pragma once
 
+#include <common/MemoryAccount.h>
 #include <crypto/AESEncryptor.h>
 #include <crypto/LZOCompressor.h>
 #include <crypto/Padder.h>
@@ -7,7 +8,9 @@
 #include <event/Timer.h>
 #include <networking/Packet.h>
 #include <networking/Tunnel.h>
+#include <networking/TunnelOffload.h>
 #include <networking/UDPSocket.h>
+#include <stats/RateStat.h>
 #include <stats/RatioStat.h>
 
 using crypto::AESEncryptor;
@@ -20,17 +23,57 @@ using networking::UDPSocket;
 
 namespace stun {
 
-static const size_t kDataPacketSize = 1 << 20;
+// Data packets trade buffers with tunnel and UDP packets, so they share their
+// size class. What the encryptors add to a tunnel frame (an MTU plus the
+// packet information header) has to fit in the tailroom: LZO's worst case
+// expansion, the padder's footer and the AES IV.
+static const size_t kDataPacketSize = networking::kDataPathPacketSize;
+static const size_t kMaxTunnelFrameSize = networking::kTunnelEthernetMTU + 4;
+static_assert(kMaxTunnelFrameSize + kMaxTunnelFrameSize / 16 + 64 + 3 +
+                      sizeof(size_t) + 16 <=
+                  kDataPacketSize,
+              "Data packets leave no room for encryption.");
+// Padding a packet past this would leave no room for the padder's footer and
+// the AES IV.
+static const size_t kMaxPaddingTo = kDataPacketSize - sizeof(size_t) - 16;
+
+// How much a data path callback gets to do before yielding. One that runs out
+// stays runnable and carries on in the next iteration of the event loop, once
+// every other session got its turn.
+struct DataBudget {
+  size_t packets;
+  size_t bytes;
+
+  bool allows(size_t packetsSpent, size_t bytesSpent) const {
+    return packetsSpent < packets && bytesSpent < bytes;
+  }
+};
+
+static const DataBudget kDefaultDataBudget = {64, 256 * 1024};
+
+// How many bytes the queues of a session get to hold before they push back,
+// counting the whole buffer of each packet or message in them.
+struct QueueBudget {
+  // Each of the inbound and outbound queues of a data pipe
+  size_t dataPipeBytes;
+  // The outbound queue of the messenger
+  size_t messengerBytes;
+};
+
+static const QueueBudget kDefaultQueueBudget = {256 * 1024, 64 * 1024};
 
 class DataPacket : public Packet {
 public:
   DataPacket() : Packet(kDataPacketSize) {}
+  // Takes over the buffer of a tunnel or UDP packet
+  explicit DataPacket(Packet&& packet) : Packet(std::move(packet)) {}
 };
 
 class DataPipe {
 public:
   DataPipe(std::unique_ptr<UDPSocket> socket, std::string const& aesKey,
-           size_t minPaddingTo, bool compression, event::Duration ttl);
+           size_t minPaddingTo, bool compression, event::Duration ttl,
+           DataBudget budget);
 
   DataPipe(DataPipe&& move);
 
@@ -38,10 +81,17 @@ public:
   std::unique_ptr<event::FIFO<DataPacket>> outboundQ;
 
   void setPrePrimed();
+  // Accounts the time spent on this pipe to the given group, see
+  // event::Action::setGroup()
+  void setGroup(std::string const& name);
   event::Condition* isPrimed();
   event::Condition* didClose();
+  // Charges the queues and the compressor to the given account. Once the
+  // account is over its limit, incoming packets are dropped.
+  void setMemoryAccount(common::MemoryAccount* memory, size_t queueBytes);
 
   stats::RatioStat* statEfficiency;
+  stats::RateStat* statDropped = nullptr;
 
 private:
   DataPipe(DataPipe const& copy) = delete;
@@ -51,6 +101,10 @@ private:
   std::unique_ptr<networking::UDPSocket> socket_;
   std::string aesKey_;
   size_t minPaddingTo_;
+  DataBudget budget_;
+  common::MemoryAccount* memory_ = nullptr;
+  common::MemoryCharge compressorMemory_;
+  common::MemoryCharge receiveBatchMemory_;
 
   std::unique_ptr<event::BaseCondition> didClose_;
   std::unique_ptr<event::BaseCondition> isPrimed_;
@@ -71,9 +125,23 @@ private:
   std::unique_ptr<event::Action> sender_;
   std::unique_ptr<event::Action> receiver_;
 
+  // Datagrams move through the socket kUDPBatchSize at a time. The receive
+  // batch keeps its buffers between reads, while the send batch only holds
+  // packets until they are flushed.
+  std::vector<UDPPacket> receiveBatch_;
+  std::vector<UDPPacket> sendBatch_;
+
   void doKill();
   void doProbe();
   void doSend();
   void doReceive();
+
+  // Adds a packet to the send batch, flushing it whenever it gets full.
+  // Returns false if the socket turned out to be closed.
+  bool queueForSend(DataPacket&& data);
+  // Applies the encryptors to a packet on its way out
+  UDPPacket encodePacket(DataPacket&& data);
+  // Returns false if the socket turned out to be closed
+  bool flushSendBatch();
 };
 }
@@ -1,126 +1,338 @@
 #include "stun/Dispatcher.h"
 
+#include <event/Action.h>
 #include <event/Trigger.h>
+#include <networking/TunnelOffload.h>
+#include <stats/RateStat.h>
+#include <stats/RatioStat.h>
+
+#include <algorithm>
+#include <atomic>
 
 namespace stun {
 
 using networking::TunnelClosedException;
 
-Dispatcher::Dispatcher(networking::Tunnel&& tunnel)
-    : tunnel_(std::move(tunnel)), canSend_(new event::ComputedCondition()),
-      canReceive_(new event::ComputedCondition()),
-      statTxBytes_("Connection", "tx_bytes"),
-      statRxBytes_("Connection", "rx_bytes"),
-      statEfficiency_("Connection", "efficiency") {
-  canSend_->expression.setMethod<Dispatcher, &Dispatcher::calculateCanSend>(
-      this);
-  canReceive_->expression
-      .setMethod<Dispatcher, &Dispatcher::calculateCanReceive>(this);
-
-  sender_.reset(new event::Action({tunnel_.canRead(), canSend_.get()}));
-  sender_->callback.setMethod<Dispatcher, &Dispatcher::doSend>(this);
-
-  receiver_.reset(new event::Action({canReceive_.get(), tunnel_.canWrite()}));
-  receiver_->callback.setMethod<Dispatcher, &Dispatcher::doReceive>(this);
-}
+// A tunnel queue and the data pipes handed to it. A lane only waits on its own
+// queue and pipes: its sender moves whatever the kernel hashed to the queue out
+// through one of the pipes, while its receiver writes whatever came in through
+// them to the queue.
+//
+// Apart from bytesDispatched, everything here belongs to the lane's loop, and
+// only gets set up once start() runs there.
+class Dispatcher::Lane {
+public:
+  Lane(event::EventLoop* loop, DataBudget budget, QueueBudget queueBudget,
+       std::shared_ptr<common::MemoryAccount> memory, std::string group)
+      : loop(loop), budget_(budget), queueBudget_(queueBudget),
+        memory_(std::move(memory)), group_(std::move(group)) {}
+
+  event::EventLoop* const loop;
+  std::atomic<size_t> bytesDispatched{0};
+
+  void start(networking::Tunnel tunnel) {
+    stats_.reset(new Stats());
+    tunnel_.reset(new networking::Tunnel(std::move(tunnel)));
+
+    canSend_.reset(new event::ComputedCondition());
+    canSend_->expression.setMethod<Lane, &Lane::calculateCanSend>(this);
+    canReceive_.reset(new event::ComputedCondition());
+    canReceive_->expression.setMethod<Lane, &Lane::calculateCanReceive>(this);
+
+    sender_.reset(new event::Action({tunnel_->canRead(), canSend_.get()}));
+    sender_->callback.setMethod<Lane, &Lane::doSend>(this);
+    sender_->setName("Dispatcher::doSend");
+    sender_->setPriority(event::ActionPriority::DataPlane);
+    sender_->setGroup(group_);
+
+    receiver_.reset(
+        new event::Action({canReceive_.get(), tunnel_->canWrite()}));
+    receiver_->callback.setMethod<Lane, &Lane::doReceive>(this);
+    receiver_->setName("Dispatcher::doReceive");
+    receiver_->setPriority(event::ActionPriority::DataPlane);
+    receiver_->setGroup(group_);
+  }
+
+  void addDataPipe(std::unique_ptr<DataPipe> dataPipe) {
+    dataPipe->statEfficiency = &stats_->efficiency;
+    dataPipe->statDropped = &stats_->dropped;
+    dataPipe->setMemoryAccount(memory_.get(), queueBudget_.dataPipeBytes);
+    dataPipe->setGroup(group_);
+    DataPipe* pipe = dataPipe.get();
+    dataPipes_.emplace_back(std::move(dataPipe));
+
+    // The event loop only re-evaluates canSend_ and canReceive_ when the
+    // conditions they are computed from change.
+    canSend_->dependOn(pipe->isPrimed());
+    canSend_->dependOn(pipe->outboundQ->canPush());
+    canReceive_->dependOn(pipe->inboundQ->canPop());
+    canSend_->invalidate();
+    canReceive_->invalidate();
+
+    // Trigger to remove the DataPipe upon it closing
+    event::Trigger::arm({pipe->didClose()}, [this, pipe]() {
+      auto it =
+          std::find_if(dataPipes_.begin(), dataPipes_.end(),
+                       [pipe](std::unique_ptr<DataPipe> const& currentPipe) {
+                         return currentPipe.get() == pipe;
+                       });
+
+      assertTrue(it != dataPipes_.end(),
+                 "Cannot find the DataPipe to remove.");
+      dataPipes_.erase(it);
+    });
+  }
+
+private:
+  Lane(Lane const& copy) = delete;
+  Lane& operator=(Lane const& copy) = delete;
+
+  Lane(Lane&& move) = delete;
+  Lane& operator=(Lane&& move) = delete;
+
+  // Added up with those of the other lanes and sessions by the StatsManager
+  struct Stats {
+    Stats()
+        : txBytes("Connection", "tx_bytes"), rxBytes("Connection", "rx_bytes"),
+          efficiency("Connection", "efficiency"),
+          dropped("Memory", "dropped_packets") {}
+
+    stats::RateStat txBytes;
+    stats::RateStat rxBytes;
+    stats::RatioStat efficiency;
+    // Packets dropped as the session or the process ran out of memory
+    stats::RateStat dropped;
+  };
+
+  DataBudget budget_;
+  QueueBudget queueBudget_;
+  std::shared_ptr<common::MemoryAccount> memory_;
+  std::string group_;
 
-bool Dispatcher::calculateCanSend() {
-  for (auto const& dataPipe_ : dataPipes_) {
-    if (dataPipe_->isPrimed()->eval() &&
-        dataPipe_->outboundQ->canPush()->eval()) {
-      return true;
+  std::unique_ptr<Stats> stats_;
+  std::vector<std::unique_ptr<DataPipe>> dataPipes_;
+  std::unique_ptr<networking::Tunnel> tunnel_;
+  // Where doSend() and doReceive() start looking, so that no pipe is always
+  // served last
+  size_t sendIndex_ = 0;
+  size_t receiveIndex_ = 0;
+
+  std::unique_ptr<event::ComputedCondition> canSend_;
+  std::unique_ptr<event::ComputedCondition> canReceive_;
+  std::unique_ptr<event::Action> sender_;
+  std::unique_ptr<event::Action> receiver_;
+
+  static bool canSendTo(DataPipe* dataPipe) {
+    return dataPipe->isPrimed()->eval() &&
+           dataPipe->outboundQ->canPush()->eval();
+  }
+
+  bool calculateCanSend() {
+    for (auto const& dataPipe : dataPipes_) {
+      if (canSendTo(dataPipe.get())) {
+        return true;
+      }
     }
+    return false;
   }
-  return false;
-}
 
-bool Dispatcher::calculateCanReceive() {
-  for (auto const& dataPipe_ : dataPipes_) {
-    if (dataPipe_->inboundQ->canPop()->eval()) {
-      return true;
+  bool calculateCanReceive() {
+    for (auto const& dataPipe : dataPipes_) {
+      if (dataPipe->inboundQ->canPop()->eval()) {
+        return true;
+      }
     }
+    return false;
   }
-  return false;
-}
 
-void Dispatcher::doSend() {
-  bool sent = false;
+  DataPipe* pickDataPipeToSend() {
+    size_t pipeCount = dataPipes_.size();
+    for (size_t i = 0; i < pipeCount; i++) {
+      size_t pipeIndex = (sendIndex_ + i) % pipeCount;
+      if (canSendTo(dataPipes_[pipeIndex].get())) {
+        sendIndex_ = (pipeIndex + 1) % pipeCount;
+        return dataPipes_[pipeIndex].get();
+      }
+    }
+    return nullptr;
+  }
 
-  // Finding a data pipe that can accept packets
-  for (int i = 0; i < dataPipes_.size(); i++) {
-    int pipeIndex = (currentDataPipeIndex_ + i) % dataPipes_.size();
+  void doSend() {
+    DataPipe* dataPipe = pickDataPipeToSend();
+    assertTrue(dataPipe != nullptr, "Cannot find a free DataPipe to send to.");
 
-    if (dataPipes_[pipeIndex]->isPrimed()->eval() &&
-        dataPipes_[pipeIndex]->outboundQ->canPush()->eval()) {
-      // Found a data pipe that can accept packets
-      // Push as many as possible
-      while (dataPipes_[pipeIndex]->outboundQ->canPush()->eval()) {
-        TunnelPacket in;
+    // Push as many as possible, or as the budget allows
+    auto& outboundQ = dataPipe->outboundQ;
+    outboundQ->reserve(outboundQ->getCapacity());
+    size_t bytes = 0;
+    for (size_t j = 0;
+         outboundQ->getReserved() > 0 && budget_.allows(j, bytes); j++) {
+      TunnelPacket in;
 
-        try {
-          auto ret = tunnel_.read(in);
-          if (!ret) {
-            break;
-          }
-        } catch (TunnelClosedException const& ex) {
-          LOG_E("Dispatcher") << "Tunnel is closed: " << ex.what() << std::endl;
-          assertTrue(false, "Tunnel should never close.");
+      try {
+        auto ret = tunnel_->read(in);
+        if (!ret) {
+          break;
         }
+      } catch (TunnelClosedException const& ex) {
+        LOG_E("Dispatcher") << "Tunnel is closed: " << ex.what() << std::endl;
+        assertTrue(false, "Tunnel should never close.");
+      }
 
-        DataPacket out;
-        bytesDispatched += in.size;
-        statTxBytes_.accumulate(in.size);
-        out.fill(std::move(in));
-
-        dataPipes_[pipeIndex]->outboundQ->push(std::move(out));
+      // Dropped just like a full tunnel queue would
+      if (memory_->isOverLimit()) {
+        stats_->dropped.accumulate(1);
+        continue;
       }
 
-      sent = true;
-      break;
+      bytes += in.size;
+      bytesDispatched.fetch_add(in.size, std::memory_order_relaxed);
+      stats_->txBytes.accumulate(in.size);
+      networking::PacketPool::countForwarded(in.size);
+      outboundQ->emplace(std::move(in));
     }
+    outboundQ->commit();
   }
 
-  currentDataPipeIndex_ = (currentDataPipeIndex_ + 1) % dataPipes_.size();
-  assertTrue(sent, "Cannot find a free DataPipe to send to.");
-}
+  void doReceive() {
+    bool received = false;
+    size_t packets = 0;
+    size_t bytes = 0;
 
-void Dispatcher::doReceive() {
-  bool received = false;
+    size_t pipeCount = dataPipes_.size();
+    for (size_t i = 0; i < pipeCount && budget_.allows(packets, bytes); i++) {
+      size_t pipeIndex = (receiveIndex_ + i) % pipeCount;
+      auto& inboundQ = dataPipes_[pipeIndex]->inboundQ;
+      // Segments of a TCP stream that come in one after the other go to the
+      // tunnel together, if it takes super-packets
+      networking::TCPCoalescer coalescer;
+      while (inboundQ->canPop()->eval() && budget_.allows(packets, bytes)) {
+        // Packets are handed over straight from the FIFO's slots
+        size_t written = 0;
+        for (auto& packet : inboundQ->peek()) {
+          if (!budget_.allows(packets, bytes)) {
+            break;
+          }
 
-  for (auto const& dataPipe_ : dataPipes_) {
-    while (dataPipe_->inboundQ->canPop()->eval()) {
-      TunnelPacket in;
-      in.fill(dataPipe_->inboundQ->pop());
-      bytesDispatched += in.size;
-      statRxBytes_.accumulate(in.size);
+          TunnelPacket in(std::move(packet));
+          written++;
+          packets++;
+          bytes += in.size;
+          bytesDispatched.fetch_add(in.size, std::memory_order_relaxed);
+          stats_->rxBytes.accumulate(in.size);
+          networking::PacketPool::countForwarded(in.size);
 
-      if (!tunnel_.write(std::move(in))) {
+          if (!writeToTunnel(coalescer, std::move(in))) {
+            LOG_I("Dispatcher") << "Dropped an incoming packet." << std::endl;
+            inboundQ->discard(written);
+            return;
+          }
+        }
+
+        inboundQ->discard(written);
+        received = true;
+      }
+
+      if (!coalescer.isEmpty() &&
+          !tunnel_->write(TunnelPacket(coalescer.take()))) {
         LOG_I("Dispatcher") << "Dropped an incoming packet." << std::endl;
         return;
       }
+    }
 
-      received = true;
+    receiveIndex_ = (receiveIndex_ + 1) % pipeCount;
+    assertTrue(received, "Cannot find a ready DataPipe to receive from.");
+  }
+
+  // Returns false if the tunnel had no room
+  bool writeToTunnel(networking::TCPCoalescer& coalescer, TunnelPacket&& in) {
+    if (tunnel_->hasOffload()) {
+      if (coalescer.add(in)) {
+        return true;
+      }
+
+      // Whatever was merged so far goes first
+      if (!coalescer.isEmpty()) {
+        if (!tunnel_->write(TunnelPacket(coalescer.take()))) {
+          return false;
+        }
+        if (coalescer.add(in)) {
+          return true;
+        }
+      }
     }
+
+    return tunnel_->write(std::move(in));
   }
+};
 
-  assertTrue(received, "Cannot find a ready DataPipe to receive from.");
+Dispatcher::Dispatcher(networking::Tunnel tunnel,
+                       std::vector<event::EventLoop*> loops,
+                       DataBudget budget, QueueBudget queueBudget,
+                       std::shared_ptr<common::MemoryAccount> memory)
+    : memory_(memory), group_("Session " + tunnel.deviceName),
+      statMemory_(group_, "buffered_bytes",
+                  [memory = memory.get()]() { return memory->getBytes(); }) {
+  assertTrue(budget.packets > 0 && budget.bytes > 0,
+             "The data budget must allow at least one packet.");
+
+  // The first lane stays on our own loop, the others go to the loops after it
+  auto current = event::EventLoop::getCurrentLoop();
+  auto it = std::find(loops.begin(), loops.end(), current);
+  if (it != loops.end()) {
+    std::rotate(loops.begin(), it, loops.end());
+  } else {
+    loops.insert(loops.begin(), current);
+  }
+
+  for (size_t i = 0; i < tunnel.getQueueCount(); i++) {
+    lanes_.emplace_back(new Lane(loops[i % loops.size()], budget, queueBudget,
+                                 memory_, group_));
+  }
+
+  // Every other queue is attached on the thread of its lane
+  for (size_t i = 1; i < lanes_.size(); i++) {
+    Lane* lane = lanes_[i].get();
+    runOnLane(*lane, [lane, deviceName = tunnel.deviceName,
+                      offload = tunnel.hasOffload()]() {
+      lane->start(networking::Tunnel::attachQueue(deviceName, offload));
+    });
+  }
+  lanes_.front()->start(std::move(tunnel));
+}
+
+Dispatcher::~Dispatcher() {
+  for (auto& lane : lanes_) {
+    Lane& target = *lane;
+    runOnLane(target, [lane = std::move(lane)]() mutable { lane.reset(); });
+  }
 }
 
-void Dispatcher::addDataPipe(std::unique_ptr<DataPipe> dataPipe) {
-  dataPipe->statEfficiency = &statEfficiency_;
-  DataPipe* pipe = dataPipe.get();
-  dataPipes_.emplace_back(std::move(dataPipe));
-
-  // Trigger to remove the DataPipe upon it closing
-  event::Trigger::arm({pipe->didClose()}, [this, pipe]() {
-    auto it =
-        std::find_if(dataPipes_.begin(), dataPipes_.end(),
-                     [pipe](std::unique_ptr<DataPipe> const& currentPipe) {
-                       return currentPipe.get() == pipe;
-                     });
-
-    assertTrue(it != dataPipes_.end(), "Cannot find the DataPipe to remove.");
-    dataPipes_.erase(it);
+size_t Dispatcher::getBytesDispatched() const {
+  size_t bytes = 0;
+  for (auto const& lane : lanes_) {
+    bytes += lane->bytesDispatched.load(std::memory_order_relaxed);
+  }
+  return bytes;
+}
+
+void Dispatcher::addDataPipe(DataPipeFactory create) {
+  // Pipes come in batches of one for each queue, on both ends
+  Lane* lane = lanes_[nextLane_].get();
+  nextLane_ = (nextLane_ + 1) % lanes_.size();
+
+  runOnLane(*lane, [lane, create = std::move(create)]() mutable {
+    lane->addDataPipe(create.invoke());
   });
 }
+
+/* static */ void Dispatcher::runOnLane(Lane& lane,
+                                        event::Callback<void> task) {
+  if (lane.loop == event::EventLoop::getCurrentLoop()) {
+    task.invoke();
+    return;
+  }
+
+  lane.loop->post(std::move(task));
+}
 }
@@ -2,21 +2,45 @@
 
 #include <stun/DataPipe.h>
 
+#include <common/MemoryAccount.h>
+#include <event/Callback.h>
+#include <event/EventLoop.h>
 #include <networking/Tunnel.h>
-#include <stats/RateStat.h>
-#include <stats/RatioStat.h>
+#include <stats/GaugeStat.h>
+
+#include <memory>
+#include <vector>
 
 namespace stun {
 
 using networking::TunnelPacket;
 
+// Moves packets between the queues of a tunnel and the data pipes. Each queue
+// makes a lane with the data pipes handed to it in turn, so that with as many
+// pipes as queues, every flow the kernel hashes to a queue leaves and comes
+// back through a pipe of its own.
+//
+// Lanes run on loops of their own where there are any: the first one on the
+// loop of the thread that creates the dispatcher, the others on the loops
+// given, in turns. A lane's queue, pipes and stats are all created on its
+// loop's thread, as they belong to the thread that creates them.
 class Dispatcher {
 public:
-  Dispatcher(networking::Tunnel&& tunnel);
+  // Data pipes get charged to the given account, which is the session's. Lanes
+  // on other loops are torn down there after the dispatcher is gone, and hold
+  // on to the account until then.
+  Dispatcher(networking::Tunnel tunnel, std::vector<event::EventLoop*> loops,
+             DataBudget budget, QueueBudget queueBudget,
+             std::shared_ptr<common::MemoryAccount> memory);
+  ~Dispatcher();
 
-  size_t bytesDispatched = 0;
+  // Can be read at any time, while the lanes keep adding to it
+  size_t getBytesDispatched() const;
 
-  void addDataPipe(std::unique_ptr<DataPipe> dataPipe);
+  // Creates a data pipe on the loop of the next lane in turn, and hands it to
+  // that lane.
+  using DataPipeFactory = event::Callback<std::unique_ptr<DataPipe>>;
+  void addDataPipe(DataPipeFactory create);
 
 private:
   Dispatcher(Dispatcher const& copy) = delete;
@@ -25,24 +49,19 @@ private:
   Dispatcher(Dispatcher&& move) = delete;
   Dispatcher& operator=(Dispatcher&& move) = delete;
 
-  networking::Tunnel tunnel_;
-  std::vector<std::unique_ptr<DataPipe>> dataPipes_;
-  size_t currentDataPipeIndex_;
-
-  std::unique_ptr<event::ComputedCondition> canSend_;
-  std::unique_ptr<event::ComputedCondition> canReceive_;
+  class Lane;
 
-  std::unique_ptr<event::Action> sender_;
-  std::unique_ptr<event::Action> receiver_;
+  std::shared_ptr<common::MemoryAccount> memory_;
+  // All the time spent on this session, on top of the per-action stats
+  std::string group_;
 
-  stats::RateStat statTxBytes_;
-  stats::RateStat statRxBytes_;
-  stats::RatioStat statEfficiency_;
+  std::vector<std::unique_ptr<Lane>> lanes_;
+  // The lane the next data pipe goes to
+  size_t nextLane_ = 0;
 
-  void doSend();
-  void doReceive();
+  stats::GaugeStat statMemory_;
 
-  bool calculateCanReceive();
-  bool calculateCanSend();
+  // Runs the task on the lane's loop, right away if that is the current one
+  static void runOnLane(Lane& lane, event::Callback<void> task);
 };
 }
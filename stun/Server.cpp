@@ -1,12 +1,110 @@
 #include "stun/Server.h"
 
+#include <event/LoopThread.h>
 #include <event/Trigger.h>
 #include <networking/IPTables.h>
 
+#include <algorithm>
+#include <atomic>
+#include <future>
+
 namespace stun {
 
 using networking::IPTables;
 
+// Owns a group of sessions and the event loop they run on. A threaded worker
+// runs its own event loop on a thread of its own, and gets new clients posted
+// to its loop. Sessions also run lanes of their tunnel on the loops of other
+// workers.
+class Server::Worker {
+public:
+  Worker(Server* server, bool threaded) : server_(server), threaded_(threaded) {
+    if (!threaded_) {
+      loop_ = event::EventLoop::getCurrentLoop();
+      return;
+    }
+
+    thread_.reset(new event::LoopThread());
+    loop_ = thread_->getLoop();
+  }
+
+  ~Worker() { endSessions(); }
+
+  // Can be called from any thread
+  void addSession(std::unique_ptr<TCPSocket> client) {
+    sessionCount_++;
+
+    if (!threaded_) {
+      startSession(std::move(client));
+      return;
+    }
+
+    loop_->post([ this, client = std::move(client) ]() mutable {
+      startSession(std::move(client));
+    });
+  }
+
+  // Ends all sessions on the worker's own thread, and waits for that. Their
+  // lanes on other workers get torn down by tasks posted to those, so every
+  // worker has to be done with this before any of them stops.
+  void endSessions() {
+    if (!threaded_) {
+      sessionHandlers_.clear();
+      return;
+    }
+
+    std::promise<void> ended;
+    auto done = ended.get_future();
+    loop_->post([this, &ended]() {
+      sessionHandlers_.clear();
+      ended.set_value();
+    });
+    done.wait();
+  }
+
+  size_t getSessionCount() const { return sessionCount_; }
+  event::EventLoop* getLoop() const { return loop_; }
+
+private:
+  Server* server_;
+  bool threaded_;
+  event::EventLoop* loop_ = nullptr;
+  std::unique_ptr<event::LoopThread> thread_;
+
+  std::atomic<size_t> sessionCount_{0};
+
+  // Only ever touched from the worker's own thread
+  std::vector<std::unique_ptr<ServerSessionHandler>> sessionHandlers_;
+
+  void startSession(std::unique_ptr<TCPSocket> client) {
+    auto handler = std::make_unique<ServerSessionHandler>(
+        server_, server_->getSessionConfig(), std::move(client));
+
+    // Trigger to remove finished clients
+    auto handlerPtr = handler.get();
+    event::Trigger::arm({handler->didEnd()}, [this, handlerPtr]() {
+      auto it = std::find_if(sessionHandlers_.begin(), sessionHandlers_.end(),
+                             [handlerPtr](auto const& handler) {
+                               return handler.get() == handlerPtr;
+                             });
+
+      assertTrue(it != sessionHandlers_.end(),
+                 "Cannot find the client to remove.");
+      sessionHandlers_.erase(it);
+      sessionCount_--;
+    });
+
+    sessionHandlers_.push_back(std::move(handler));
+  }
+
+private:
+  Worker(Worker const& copy) = delete;
+  Worker& operator=(Worker const& copy) = delete;
+
+  Worker(Worker&& move) = delete;
+  Worker& operator=(Worker&& move) = delete;
+};
+
 Server::Server(ServerConfig config) : config_(config) {
   IPTables::clear();
   IPTables::masquerade(config.addressPool);
@@ -16,9 +114,18 @@ Server::Server(ServerConfig config) : config_(config) {
     addrPool->reserve(entry.second);
   }
 
+  if (config_.workerThreads == 0) {
+    workers_.emplace_back(new Worker(this, false));
+  } else {
+    for (size_t i = 0; i < config_.workerThreads; i++) {
+      workers_.emplace_back(new Worker(this, true));
+    }
+  }
+
   server_.reset(new TCPServer());
   listener_.reset(new event::Action({server_->canAccept()}));
   listener_->callback.setMethod<Server, &Server::doAccept>(this);
+  listener_->setName("Server::doAccept");
   server_->bind(config.port);
 
   if (config.authentication && config.quotaTable.empty()) {
@@ -31,36 +138,55 @@ Server::Server(ServerConfig config) : config_(config) {
   }
 }
 
+Server::~Server() {
+  // Workers hold on to this server, so they have to stop before anything here
+  // goes away. Sessions go first everywhere, see Worker::endSessions().
+  for (auto const& worker : workers_) {
+    worker->endSessions();
+  }
+  workers_.clear();
+}
+
 void Server::doAccept() {
   TCPSocket client = server_->accept();
 
   LOG_I("Center") << "Accepted a client from "
                   << client.getPeerAddress().getHost() << std::endl;
 
-  auto sessionConfig = ServerSessionConfig{config_.encryption,
-                                           config_.secret,
-                                           config_.paddingTo,
-                                           config_.compression,
-                                           config_.dataPipeRotationInterval,
-                                           config_.authentication,
-                                           config_.quotaTable};
-
-  auto handler = std::make_unique<ServerSessionHandler>(
-      this, sessionConfig, std::make_unique<TCPSocket>(std::move(client)));
-
-  // Trigger to remove finished clients
-  auto handlerPtr = handler.get();
-  event::Trigger::arm({handler->didEnd()}, [this, handlerPtr]() {
-    auto it = std::find_if(sessionHandlers_.begin(), sessionHandlers_.end(),
-                           [handlerPtr](auto const& handler) {
-                             return handler.get() == handlerPtr;
-                           });
-
-    assertTrue(it != sessionHandlers_.end(),
-               "Cannot find the client to remove.");
-    sessionHandlers_.erase(it);
-  });
-
-  sessionHandlers_.push_back(std::move(handler));
+  pickWorker()->addSession(std::make_unique<TCPSocket>(std::move(client)));
+}
+
+Server::Worker* Server::pickWorker() {
+  // Go for the worker with the fewest sessions
+  Worker* result = workers_.front().get();
+  for (auto const& worker : workers_) {
+    if (worker->getSessionCount() < result->getSessionCount()) {
+      result = worker.get();
+    }
+  }
+
+  return result;
+}
+
+std::vector<event::EventLoop*> Server::getLaneLoops() const {
+  std::vector<event::EventLoop*> loops;
+  for (auto const& worker : workers_) {
+    loops.push_back(worker->getLoop());
+  }
+  return loops;
+}
+
+ServerSessionConfig Server::getSessionConfig() const {
+  return ServerSessionConfig{config_.encryption,
+                             config_.secret,
+                             config_.paddingTo,
+                             config_.compression,
+                             config_.dataPipeRotationInterval,
+                             config_.authentication,
+                             config_.quotaTable,
+                             config_.dataBudget,
+                             config_.queueBudget,
+                             config_.tunnelQueues,
+                             config_.tunnelOffload};
 }
 }
@@ -24,22 +24,41 @@ public:
   bool authentication;
   std::map<std::string, size_t> quotaTable;
   std::map<std::string, IPAddress> staticHosts;
+  // Number of threads to run sessions on. With 0, sessions run on the main
+  // event loop alongside the listener.
+  size_t workerThreads;
+  // How much each session gets to do at a time before the next one's turn
+  DataBudget dataBudget;
+  QueueBudget queueBudget;
+  // Queues of each session's tunnel, each with a data pipe of its own and run
+  // on the worker threads in turns. At least 1.
+  size_t tunnelQueues;
+  // Whether tunnels move TCP super-packets, see networking::Tunnel
+  bool tunnelOffload;
 };
 
 class Server {
 public:
   Server(ServerConfig config);
+  ~Server();
 
   std::unique_ptr<IPAddressPool> addrPool;
 
 private:
   ServerConfig config_;
 
+  class Worker;
+
   std::unique_ptr<TCPServer> server_;
   std::unique_ptr<event::Action> listener_;
-  std::vector<std::unique_ptr<ServerSessionHandler>> sessionHandlers_;
+  std::vector<std::unique_ptr<Worker>> workers_;
 
   void doAccept();
+  Worker* pickWorker();
+  // The loops of all workers, which sessions spread the lanes of their tunnel
+  // across
+  std::vector<event::EventLoop*> getLaneLoops() const;
+  ServerSessionConfig getSessionConfig() const;
 
   // FIXME: This should really be a inner class instead;
   friend ServerSessionHandler;
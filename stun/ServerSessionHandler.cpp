@@ -23,6 +23,8 @@ static const event::Duration kSessionHandlerRotationGracePeriod = 5s;
 
 static const event::Duration kSessionHandlerQuotaPoliceInterval = 1s;
 
+static const size_t kSessionHandlerInboxSize = 4;
+
 class ServerSessionHandler::QuotaReporter {
 public:
   QuotaReporter(ServerSessionHandler* session) : session_(session) {
@@ -34,6 +36,8 @@ public:
         {timer_->didFire(), session->messenger_->outboundQ->canPush()}));
     reporter_->callback.setMethod<QuotaReporter, &QuotaReporter::doReport>(
         this);
+    reporter_->setName("QuotaReporter::doReport");
+    reporter_->setPriority(event::ActionPriority::Housekeeping);
   }
 
 private:
@@ -53,8 +57,9 @@ private:
     session_->messenger_->outboundQ->push(
         Message("message",
                 "You have used " +
-                    toMegaBytesString(session_->config_.priorQuotaUsed +
-                                      session_->dispatcher_->bytesDispatched) +
+                    toMegaBytesString(
+                        session_->config_.priorQuotaUsed +
+                        session_->dispatcher_->getBytesDispatched()) +
                     +" out of your quota of " +
                     toMegaBytesString(session_->config_.quota) + "."));
     timer_->extend(kSessionHandlerQuotaReportInterval);
@@ -78,6 +83,8 @@ public:
     police_.reset(new event::Action(
         {timer_->didFire(), session->messenger_->outboundQ->canPush()}));
     police_->callback.setMethod<QuotaPolice, &QuotaPolice::doPolice>(this);
+    police_->setName("QuotaPolice::doPolice");
+    police_->setPriority(event::ActionPriority::Housekeeping);
   }
 
 private:
@@ -90,7 +97,7 @@ private:
     session_->savePriorQuota();
 
     if (session_->config_.priorQuotaUsed +
-            session_->dispatcher_->bytesDispatched >=
+            session_->dispatcher_->getBytesDispatched() >=
         session_->config_.quota) {
       session_->messenger_->outboundQ->push(
           Message("error", "You have reached your usage quota. Goodbye!"));
@@ -112,19 +119,27 @@ ServerSessionHandler::ServerSessionHandler(
     Server* server, ServerSessionConfig config,
     std::unique_ptr<TCPSocket> commandPipe)
     : server_(server), config_(config),
+      memory_(std::make_shared<common::MemoryAccount>()),
       messenger_(new Messenger(std::move(commandPipe))),
+      inbox_(new event::FIFO<Message>(kSessionHandlerInboxSize)),
       didEnd_(new event::BaseCondition()) {
+  messenger_->setMemoryAccount(memory_.get(),
+                               config_.queueBudget.messengerBytes);
+  inbox_->setByteBudget(0, memory_.get());
+
   if (!config_.secret.empty()) {
     messenger_->addEncryptor(
         std::make_unique<crypto::AESEncryptor>(crypto::AESKey(config_.secret)));
   }
   attachHandlers();
+  handshake_ = runHandshake();
 }
 
 void ServerSessionHandler::savePriorQuota() {
   auto& notebook = *common::Notebook::getInstance();
+  auto lock = notebook.lock();
   notebook["priorQuotas"][config_.user] =
-      config_.priorQuotaUsed + dispatcher_->bytesDispatched;
+      config_.priorQuotaUsed + dispatcher_->getBytesDispatched();
   notebook.save();
 }
 
@@ -149,97 +164,151 @@ void ServerSessionHandler::attachHandlers() {
   event::Trigger::arm({messenger_->didDisconnect()},
                       [this]() { didEnd_->fire(); });
 
-  messenger_->addHandler("hello", [this](auto const& message) {
-    if (config_.authentication) {
-      auto body = message.getBody();
+  // The handshake takes it from here
+  auto deliver = [this](auto const& message) {
+    if (!inbox_->canPush()->eval()) {
+      return Message("error", "Too many requests during the handshake.");
+    }
 
-      if (body.find("user") == body.end()) {
-        return Message("error", "No user name provided.");
-      }
+    Message copy;
+    copy.fill(message.data, message.size);
+    inbox_->push(std::move(copy));
+    return Message::null();
+  };
 
-      config_.user = body["user"].template get<std::string>();
-      LOG_I("Session") << "Client " << config_.user << " said hello!"
-                       << std::endl;
-
-      // Retrieve this user's quota
-      if (!config_.quotaTable.empty()) {
-        auto it = config_.quotaTable.find(config_.user);
-        if (it == config_.quotaTable.end()) {
-          return Message(
-              "error", "User " + config_.user + " not allowed on the server.");
-        }
-
-        config_.quota = it->second;
-        LOG_V("Session") << "Client " << config_.user << " has a quota of "
-                         << config_.quota << " bytes." << std::endl;
-
-        // Retrieve the user's prior used quota
-        auto& notebook = *common::Notebook::getInstance();
-        if (notebook["priorQuotas"].is_null()) {
-          notebook["priorQuotas"] = json({});
-        }
-        if (notebook["priorQuotas"][config_.user].is_null()) {
-          notebook["priorQuotas"][config_.user] = 0;
-        }
-        config_.priorQuotaUsed = notebook["priorQuotas"][config_.user];
-        notebook.save();
-
-        if (config_.quota != 0) {
-          quotaReporter_.reset(new QuotaReporter(this));
-          quotaPolice_.reset(new QuotaPolice(this));
-        }
-      }
-    }
+  messenger_->addHandler("hello", deliver);
+  messenger_->addHandler("config_done", deliver);
+}
 
-    // Acquire IP addresses
-    config_.myTunnelAddr = server_->addrPool->acquire();
+event::Coroutine ServerSessionHandler::runHandshake() {
+  Message hello = co_await event::pop(inbox_.get());
+  Message reply = (hello.getType() == "hello"
+                       ? configure(hello)
+                       : Message("error", "Expected a hello first."));
+  bool accepted = (reply.getType() == "config");
+
+  co_await messenger_->outboundQ->canPush();
+  messenger_->outboundQ->push(std::move(reply));
+  if (!accepted) {
+    co_return;
+  }
 
-    if (config_.authentication &&
-        (server_->config_.staticHosts.count(config_.user) != 0)) {
-      // This host has a static IP assigned
-      config_.peerTunnelAddr = server_->config_.staticHosts[config_.user];
-    } else {
-      config_.peerTunnelAddr = server_->addrPool->acquire();
+  Message done = co_await event::pop(inbox_.get());
+  if (done.getType() != "config_done") {
+    co_await messenger_->outboundQ->canPush();
+    messenger_->outboundQ->push(Message("error", "Expected a config_done."));
+    co_return;
+  }
+
+  // A data pipe for each tunnel queue
+  for (size_t i = 0; i < config_.tunnelQueues; i++) {
+    co_await messenger_->outboundQ->canPush();
+    messenger_->outboundQ->push(Message("new_data_pipe", createDataPipe()));
+  }
+}
+
+Message ServerSessionHandler::configure(Message const& hello) {
+  if (config_.authentication) {
+    auto body = hello.getBody();
+
+    if (body.find("user") == body.end()) {
+      return Message("error", "No user name provided.");
     }
 
-    // Set up the data tunnel. Data pipes will be set up in a later stage.
-    auto tunnel = Tunnel{};
-    auto interface = InterfaceConfig{};
-    interface.newLink(tunnel.deviceName, kTunnelEthernetMTU);
-    interface.setLinkAddress(tunnel.deviceName, config_.myTunnelAddr,
-                             config_.peerTunnelAddr);
-
-    dispatcher_.reset(new Dispatcher(std::move(tunnel)));
-
-    // Set up data pipe rotation if it is configured in the server config.
-    if (config_.dataPipeRotationInterval != 0s) {
-      dataPipeRotationTimer_.reset(
-          new event::Timer(config_.dataPipeRotationInterval));
-      dataPipeRotator_.reset(
-          new event::Action({dataPipeRotationTimer_->didFire(),
-                             messenger_->outboundQ->canPush()}));
-      dataPipeRotator_->callback.setMethod<
-          ServerSessionHandler, &ServerSessionHandler::doRotateDataPipe>(this);
+    config_.user = body["user"].template get<std::string>();
+    LOG_I("Session") << "Client " << config_.user << " said hello!"
+                     << std::endl;
+
+    // Retrieve this user's quota
+    if (!config_.quotaTable.empty()) {
+      auto it = config_.quotaTable.find(config_.user);
+      if (it == config_.quotaTable.end()) {
+        return Message(
+            "error", "User " + config_.user + " not allowed on the server.");
+      }
+
+      config_.quota = it->second;
+      LOG_V("Session") << "Client " << config_.user << " has a quota of "
+                       << config_.quota << " bytes." << std::endl;
+
+      // Retrieve the user's prior used quota
+      auto& notebook = *common::Notebook::getInstance();
+      auto lock = notebook.lock();
+      if (notebook["priorQuotas"].is_null()) {
+        notebook["priorQuotas"] = json({});
+      }
+      if (notebook["priorQuotas"][config_.user].is_null()) {
+        notebook["priorQuotas"][config_.user] = 0;
+      }
+      config_.priorQuotaUsed = notebook["priorQuotas"][config_.user];
+      notebook.save();
+
+      if (config_.quota != 0) {
+        quotaReporter_.reset(new QuotaReporter(this));
+        quotaPolice_.reset(new QuotaPolice(this));
+      }
     }
+  }
 
-    return Message("config",
-                   json{{"server_tunnel_ip", config_.myTunnelAddr},
-                        {"client_tunnel_ip", config_.peerTunnelAddr},
-                        {"server_subnet", server_->config_.addressPool}});
-  });
+  // Acquire IP addresses
+  config_.myTunnelAddr = server_->addrPool->acquire();
 
-  messenger_->addHandler("config_done", [this](auto const& message) {
-    return Message("new_data_pipe", createDataPipe());
-  });
+  if (config_.authentication &&
+      (server_->config_.staticHosts.count(config_.user) != 0)) {
+    // This host has a static IP assigned
+    config_.peerTunnelAddr = server_->config_.staticHosts.at(config_.user);
+  } else {
+    config_.peerTunnelAddr = server_->addrPool->acquire();
+  }
+
+  // Set up the data tunnel. Data pipes will be set up in a later stage.
+  auto tunnel = Tunnel::open(config_.tunnelQueues, config_.tunnelOffload);
+  auto interface = InterfaceConfig{};
+  interface.newLink(tunnel.deviceName, kTunnelEthernetMTU);
+  interface.setLinkAddress(tunnel.deviceName, config_.myTunnelAddr,
+                           config_.peerTunnelAddr);
+
+  dispatcher_.reset(new Dispatcher(std::move(tunnel), server_->getLaneLoops(),
+                                   config_.dataBudget, config_.queueBudget,
+                                   memory_));
+
+  // Set up data pipe rotation if it is configured in the server config.
+  if (config_.dataPipeRotationInterval != 0s) {
+    dataPipeRotationTimer_.reset(
+        new event::Timer(config_.dataPipeRotationInterval));
+    dataPipeRotator_.reset(
+        new event::Action({dataPipeRotationTimer_->didFire(),
+                           messenger_->outboundQ->canPush()}));
+    dataPipeRotator_->callback.setMethod<
+        ServerSessionHandler, &ServerSessionHandler::doRotateDataPipe>(this);
+    dataPipeRotator_->setName("ServerSessionHandler::doRotateDataPipe");
+  }
+
+  return Message("config",
+                 json{{"server_tunnel_ip", config_.myTunnelAddr},
+                      {"client_tunnel_ip", config_.peerTunnelAddr},
+                      {"server_subnet", server_->config_.addressPool},
+                      {"tunnel_queues", config_.tunnelQueues}});
 }
 
 void ServerSessionHandler::doRotateDataPipe() {
-  messenger_->outboundQ->push(Message("new_data_pipe", createDataPipe()));
-  dataPipeRotationTimer_->extend(config_.dataPipeRotationInterval);
+  // A new data pipe for each tunnel queue, as fast as the messenger takes them
+  while (rotatedDataPipes_ < config_.tunnelQueues &&
+         messenger_->outboundQ->canPush()->eval()) {
+    messenger_->outboundQ->push(Message("new_data_pipe", createDataPipe()));
+    rotatedDataPipes_++;
+  }
+
+  if (rotatedDataPipes_ == config_.tunnelQueues) {
+    rotatedDataPipes_ = 0;
+    dataPipeRotationTimer_->extend(config_.dataPipeRotationInterval);
+  }
 }
 
 json ServerSessionHandler::createDataPipe() {
-  UDPSocket udpPipe;
+  // Bound here so that the port is known right away. The rest of the pipe gets
+  // created on the loop of the lane it goes to.
+  networking::Socket udpPipe(networking::UDP);
   int port = udpPipe.bind(0);
 
   LOG_V("Session") << "Creating a new data pipe." << std::endl;
@@ -257,10 +326,14 @@ json ServerSessionHandler::createDataPipe() {
                   ? 0s
                   : config_.dataPipeRotationInterval +
                         kSessionHandlerRotationGracePeriod);
-  DataPipe* dataPipe =
-      new DataPipe(std::make_unique<UDPSocket>(std::move(udpPipe)), aesKey,
-                   config_.paddingTo, config_.compression, ttl);
-  dispatcher_->addDataPipe(std::unique_ptr<DataPipe>{dataPipe});
+  dispatcher_->addDataPipe([
+    udpPipe = std::move(udpPipe), aesKey, paddingTo = config_.paddingTo,
+    compression = config_.compression, ttl, dataBudget = config_.dataBudget
+  ]() mutable {
+    return std::make_unique<DataPipe>(
+        std::make_unique<UDPSocket>(std::move(udpPipe)), aesKey, paddingTo,
+        compression, ttl, dataBudget);
+  });
 
   return json{{"port", port},
               {"aes_key", aesKey},
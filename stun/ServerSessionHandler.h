@@ -4,6 +4,7 @@
 
 #include <stun/Dispatcher.h>
 
+#include <event/Coroutine.h>
 #include <networking/IPAddressPool.h>
 #include <networking/Messenger.h>
 #include <networking/TCPSocket.h>
@@ -13,6 +14,7 @@ namespace stun {
 using json = nlohmann::json;
 
 using networking::TCPSocket;
+using networking::Message;
 using networking::Messenger;
 using networking::SubnetAddress;
 using networking::IPAddress;
@@ -26,6 +28,10 @@ public:
   event::Duration dataPipeRotationInterval;
   bool authentication;
   std::map<std::string, size_t> quotaTable;
+  DataBudget dataBudget;
+  QueueBudget queueBudget;
+  size_t tunnelQueues;
+  bool tunnelOffload;
 
   std::string user = "";
   size_t quota = 0;
@@ -51,18 +57,29 @@ private:
   class QuotaReporter;
   class QuotaPolice;
 
+  // Everything the session buffers. Shared with the dispatcher's lanes, which
+  // can be torn down after the session is gone.
+  std::shared_ptr<common::MemoryAccount> memory_;
+
   std::unique_ptr<Messenger> messenger_;
+  // Handshake messages, taken in order by runHandshake()
+  std::unique_ptr<event::FIFO<Message>> inbox_;
   std::unique_ptr<Dispatcher> dispatcher_;
 
   std::unique_ptr<event::Timer> dataPipeRotationTimer_;
   std::unique_ptr<event::Action> dataPipeRotator_;
+  size_t rotatedDataPipes_ = 0;
 
   std::unique_ptr<QuotaReporter> quotaReporter_;
   std::unique_ptr<QuotaPolice> quotaPolice_;
 
   std::unique_ptr<event::BaseCondition> didEnd_;
 
+  event::Coroutine handshake_;
+
   void attachHandlers();
+  event::Coroutine runHandshake();
+  Message configure(Message const& hello);
   json createDataPipe();
   void doRotateDataPipe();
   void savePriorQuota();